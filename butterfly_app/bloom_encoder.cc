@@ -0,0 +1,227 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "bloom_encoder.hh"
+#include <algorithm>
+
+namespace vigil
+{
+  size_t
+  bloom_encoder::key_hash::operator()(const key& k) const
+  {
+    // FNV-1a over the node ids
+    uint64_t h = 14695981039346656037ULL;
+    h = (h ^ k.source) * 1099511628211ULL;
+    for (size_t i = 0; i < k.receivers.size(); i++)
+      h = (h ^ k.receivers[i]) * 1099511628211ULL;
+    return h;
+  }
+
+  bloom_encoder::bloom_encoder(const adjacency& links, size_t max_cached)
+    : links(links), max_cached(max_cached), n_hits(0), n_misses(0)
+  {
+    pthread_mutex_init(&mutex, NULL);
+  }
+
+  bloom_encoder::~bloom_encoder()
+  {
+    pthread_mutex_destroy(&mutex);
+  }
+
+  bloom_encoder::key
+  bloom_encoder::make_key(uint32_t source, const uint32_t *receivers,
+                          size_t num)
+  {
+    key k;
+    k.source = source;
+    k.receivers.assign(receivers, receivers + num);
+    std::sort(k.receivers.begin(), k.receivers.end());
+    k.receivers.erase(std::unique(k.receivers.begin(), k.receivers.end()),
+                      k.receivers.end());
+    return k;
+  }
+
+  bool
+  bloom_encoder::lookup(const key& k, result& r)
+  {
+    pthread_mutex_lock(&mutex);
+    std::unordered_map<key, result, key_hash>::const_iterator i;
+    i = cache.find(k);
+    bool found = i != cache.end();
+    if (found) {
+      r = i->second;
+      n_hits++;
+    } else {
+      n_misses++;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return found;
+  }
+
+  void
+  bloom_encoder::insert(const key& k, const result& r)
+  {
+    pthread_mutex_lock(&mutex);
+    if (cache.size() >= max_cached)
+      cache.clear();
+    cache[k] = r;
+    pthread_mutex_unlock(&mutex);
+  }
+
+  /* Breadth-first search from 'source'.  Only the source and switches
+   * forward: the search does not go on from nodes of degree one. */
+  void
+  bloom_encoder::shortest_paths(uint32_t source, scratch& s) const
+  {
+    size_t num_nodes = links.max_node() + 1;
+
+    s.source = source;
+    s.parent.assign(num_nodes, adjacency::no_link);
+    if (s.node_mark.size() != num_nodes) {
+      s.node_mark.assign(num_nodes, 0);
+      s.link_mark.assign(links.num_links(), 0);
+      s.epoch = 0;
+    }
+
+    std::vector<uint32_t> queue(1, source);
+    std::vector<bool> seen(num_nodes, false);
+    if (source < num_nodes)
+      seen[source] = true;
+    for (size_t q = 0; q < queue.size(); q++) {
+      uint32_t n = queue[q];
+      if (n != source && links.degree(n) == 1)
+        continue;
+      for (uint32_t i = links.begin(n); i < links.end(n); i++) {
+        uint32_t to = links.neighbor(i);
+        if (seen[to])
+          continue;
+        seen[to] = true;
+        s.parent[to] = i;
+        queue.push_back(to);
+      }
+    }
+  }
+
+  bloom_encoder::result
+  bloom_encoder::compute(const key& k, scratch& s) const
+  {
+    result r = { OK, 0, adjacency::no_link };
+
+    if (s.source != k.source)
+      shortest_paths(k.source, s);
+    if (++s.epoch == 0) {
+      std::fill(s.node_mark.begin(), s.node_mark.end(), 0);
+      std::fill(s.link_mark.begin(), s.link_mark.end(), 0);
+      s.epoch = 1;
+    }
+
+    // Union of the paths to the receivers, walking back until a node
+    // already on the tree.
+    s.tree_nodes.assign(1, k.source);
+    if (k.source < s.node_mark.size())
+      s.node_mark[k.source] = s.epoch;
+    for (size_t j = 0; j < k.receivers.size(); j++) {
+      uint32_t n = k.receivers[j];
+      if (n == k.source)
+        continue;
+      if (n >= s.parent.size() || s.parent[n] == adjacency::no_link) {
+        r.st = NO_ROUTE;
+        return r;
+      }
+      while (s.node_mark[n] != s.epoch) {
+        uint32_t l = s.parent[n];
+        s.node_mark[n] = s.epoch;
+        s.link_mark[l] = s.epoch;
+        s.tree_nodes.push_back(n);
+        r.filter |= links.addr(l);
+        n = links.source(l);
+      }
+    }
+
+    // Every node of the tree tests all of its links but the one the
+    // packet came in.
+    for (size_t j = 0; j < s.tree_nodes.size(); j++) {
+      uint32_t n = s.tree_nodes[j];
+      uint32_t back = adjacency::no_link;
+      if (n != k.source)
+        back = links.reverse(s.parent[n]);
+      for (uint32_t i = links.begin(n); i < links.end(n); i++) {
+        if (i == back || s.link_mark[i] == s.epoch)
+          continue;
+        if ((links.addr(i) & ~r.filter) == 0) {
+          r.st = FALSE_POSITIVE;
+          r.link = i;
+          return r;
+        }
+      }
+    }
+
+    return r;
+  }
+
+  bloom_encoder::result
+  bloom_encoder::encode(uint32_t source, const uint32_t *receivers,
+                        size_t num)
+  {
+    key k = make_key(source, receivers, num);
+    result r;
+    if (lookup(k, r))
+      return r;
+
+    scratch s;
+    r = compute(k, s);
+    insert(k, r);
+
+    return r;
+  }
+
+  static bool
+  by_source(const std::pair<uint32_t, size_t>& a,
+            const std::pair<uint32_t, size_t>& b)
+  {
+    return a.first < b.first;
+  }
+
+  void
+  bloom_encoder::encode_batch(const bloom_tree *trees, size_t num,
+                              result *results)
+  {
+    std::vector<std::pair<uint32_t, size_t> > missed;
+    std::vector<key> keys(num);
+
+    for (size_t i = 0; i < num; i++) {
+      const std::vector<uint32_t>& rcv = trees[i].receivers;
+      keys[i] = make_key(trees[i].source, rcv.empty() ? NULL : &rcv[0],
+                         rcv.size());
+      if (!lookup(keys[i], results[i]))
+        missed.push_back(std::make_pair(trees[i].source, i));
+    }
+
+    std::sort(missed.begin(), missed.end(), by_source);
+    scratch s;
+    for (size_t j = 0; j < missed.size(); j++) {
+      size_t i = missed[j].second;
+      results[i] = compute(keys[i], s);
+      insert(keys[i], results[i]);
+    }
+  }
+} // vigil namespace
@@ -0,0 +1,129 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef bloom_encoder_HH
+#define bloom_encoder_HH
+
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include "topology.hh"
+
+namespace vigil
+{
+  /* A multicast group: the switch where its packets enter the network
+   * and the nodes (usually hosts) receiving them. */
+  struct bloom_tree
+  {
+    uint32_t source;
+    std::vector<uint32_t> receivers;
+  };
+
+  /** \brief Encoder of multicast trees into Bloom filter addresses.
+   *
+   * The tree of a group is the union of the shortest paths from its
+   * source to its receivers, and its filter is the OR of the IDs of
+   * the tree's links, as BloomHelper.get_mac_from_route() computes
+   * it.  A tree is rejected if a switch on it would also forward to a
+   * link outside of it, i.e., if the filter covers the ID of such a
+   * link (the link leading back is not tested, the switch does not
+   * send to the in_port).
+   *
+   * Results are cached by source and receiver set; the cache is
+   * emptied when it grows over 'max_cached' entries.  The encoder may
+   * be used from several threads at once.
+   */
+  class bloom_encoder
+  {
+  public:
+    enum status {
+      OK = 0,
+      NO_ROUTE,                 /* a receiver cannot be reached */
+      FALSE_POSITIVE,           /* the filter would leak to 'link' */
+    };
+
+    struct result
+    {
+      status st;
+      uint64_t filter;
+      uint32_t link;            /* the leaking link if FALSE_POSITIVE */
+    };
+
+    bloom_encoder(const adjacency& links, size_t max_cached = 65536);
+    ~bloom_encoder();
+
+    result encode(uint32_t source, const uint32_t *receivers, size_t num);
+    /* Encode 'num' trees into 'results'.  Trees of the same source
+     * share one shortest path computation. */
+    void encode_batch(const bloom_tree *trees, size_t num, result *results);
+
+    size_t hits() const { return n_hits; }
+    size_t misses() const { return n_misses; }
+
+  private:
+    struct key
+    {
+      uint32_t source;
+      std::vector<uint32_t> receivers;      /* sorted, unique */
+
+      bool operator==(const key& k) const
+      { return source == k.source && receivers == k.receivers; }
+    };
+
+    struct key_hash
+    {
+      size_t operator()(const key& k) const;
+    };
+
+    /* Shortest path tree of 'source' and marks of the tree at hand. */
+    struct scratch
+    {
+      scratch() : source(adjacency::no_link), epoch(0) {}
+
+      uint32_t source;
+      std::vector<uint32_t> parent;         /* link into a node */
+      std::vector<uint32_t> node_mark;
+      std::vector<uint32_t> link_mark;
+      std::vector<uint32_t> tree_nodes;
+      uint32_t epoch;
+    };
+
+    const adjacency& links;
+    size_t max_cached;
+    std::unordered_map<key, result, key_hash> cache;
+    pthread_mutex_t mutex;
+    size_t n_hits;
+    size_t n_misses;
+
+    static key make_key(uint32_t source, const uint32_t *receivers,
+                        size_t num);
+    bool lookup(const key& k, result& r);
+    void insert(const key& k, const result& r);
+    void shortest_paths(uint32_t source, scratch& s) const;
+    result compute(const key& k, scratch& s) const;
+
+    bloom_encoder(const bloom_encoder&);
+    bloom_encoder& operator=(const bloom_encoder&);
+  };
+} // vigil namespace
+
+#endif
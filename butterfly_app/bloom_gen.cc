@@ -0,0 +1,197 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Generate Bloom link IDs for a topology:
+ *
+ *   bloom_gen [-k bits_per_id] [-s num_sets] [-l path_length]
+ *             [-f receivers] [-t trees] [-r seed] [-a] links out.csv
+ *
+ * 'links' is a links file (CSV or binary, see topo_convert), its IDs
+ * are ignored.  Each candidate set is scored on random trees of
+ * 'receivers' paths of 'path_length' links, and the set with the
+ * fewest false positives is written to out.csv in the layout of
+ * bloom_ids.csv.  With -a every set i is written to out.csv.i as
+ * well.  Without -k the number of bits per ID is chosen for trees of
+ * the given size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "bloom_ids.hh"
+#include "topology.hh"
+
+using namespace vigil;
+
+static bool
+write_set(const char *filename, const adjacency& links,
+          const bloom_id_sets& ids, unsigned set)
+{
+  FILE *f = fopen(filename, "w");
+  if (f == NULL)
+    return false;
+  for (uint32_t i = 0; i < links.num_links(); i++)
+    fprintf(f, "%u, %u, %u, %012llx\n", links.source(i), links.neighbor(i),
+            links.port_no(i), (unsigned long long)ids.id(set, i));
+
+  return fclose(f) == 0;
+}
+
+/* Links of 'receivers' random walks of at most 'length' links, not
+ * visiting a node twice, from a random node of degree one (a host) if
+ * there is any. */
+static void
+random_tree(const adjacency& links, const std::vector<uint32_t>& sources,
+            unsigned receivers, unsigned length, std::vector<uint32_t>& tree)
+{
+  uint32_t src = sources[random() % sources.size()];
+
+  tree.clear();
+  for (unsigned r = 0; r < receivers; r++) {
+    std::vector<uint32_t> visited(1, src);
+    uint32_t node = src;
+    for (unsigned h = 0; h < length; h++) {
+      std::vector<uint32_t> next;
+      for (uint32_t i = links.begin(node); i < links.end(node); i++) {
+        if (std::find(visited.begin(), visited.end(), links.neighbor(i))
+            == visited.end())
+          next.push_back(i);
+      }
+      if (next.empty())
+        break;
+      uint32_t i = next[random() % next.size()];
+      tree.push_back(i);
+      node = links.neighbor(i);
+      visited.push_back(node);
+    }
+  }
+  std::sort(tree.begin(), tree.end());
+  tree.erase(std::unique(tree.begin(), tree.end()), tree.end());
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned k = 0, num_sets = 8, length = 4, receivers = 2, num_trees = 10000;
+  unsigned long seed = 1;
+  bool all = false;
+  int c;
+
+  while ((c = getopt(argc, argv, "k:s:l:f:t:r:a")) != -1) {
+    switch (c) {
+    case 'k': k = atoi(optarg); break;
+    case 's': num_sets = atoi(optarg); break;
+    case 'l': length = atoi(optarg); break;
+    case 'f': receivers = atoi(optarg); break;
+    case 't': num_trees = atoi(optarg); break;
+    case 'r': seed = strtoul(optarg, NULL, 0); break;
+    case 'a': all = true; break;
+    default:
+      return 1;
+    }
+  }
+  if (argc - optind != 2 || num_sets == 0 || length == 0 || receivers == 0) {
+    fprintf(stderr, "usage: %s [-k bits_per_id] [-s num_sets] "
+            "[-l path_length] [-f receivers] [-t trees] [-r seed] [-a] "
+            "links out.csv\n", argv[0]);
+    return 1;
+  }
+
+  topo_file t;
+  adjacency links;
+  if (!t.load_links(argv[optind])) {
+    fprintf(stderr, "%s\n", t.error().c_str());
+    return 1;
+  }
+  if (!links.build(t.links(), t.num_links())) {
+    fprintf(stderr, "%s: node ids exceed %u\n", argv[optind],
+            adjacency::max_node_id);
+    return 1;
+  }
+  if (links.num_links() == 0) {
+    fprintf(stderr, "%s: no links\n", argv[optind]);
+    return 1;
+  }
+
+  unsigned tree_links = length * receivers;
+  if (k == 0)
+    k = bloom_id_sets::optimal_bits_per_id(tree_links);
+  bloom_id_sets ids(links, num_sets, k);
+  ids.generate(seed);
+
+  std::vector<uint32_t> sources, any;
+  for (uint32_t n = 1; n <= links.max_node(); n++) {
+    if (links.degree(n) == 1)
+      sources.push_back(n);
+    if (links.degree(n))
+      any.push_back(n);
+  }
+  if (sources.empty())
+    sources = any;
+
+  std::vector<unsigned long long> fp(num_sets, 0), fill(num_sets, 0);
+  std::vector<bloom_score> scores(num_sets);
+  std::vector<uint32_t> tree;
+  unsigned long long links_scored = 0;
+  srandom(seed);
+  for (unsigned i = 0; i < num_trees; i++) {
+    random_tree(links, sources, receivers, length, tree);
+    if (tree.empty())
+      continue;
+    ids.score(&tree[0], tree.size(), &scores[0]);
+    for (unsigned s = 0; s < num_sets; s++) {
+      fp[s]   += scores[s].false_positives;
+      fill[s] += scores[s].fill;
+    }
+    links_scored += tree.size();
+  }
+
+  unsigned best = std::min_element(fp.begin(), fp.end()) - fp.begin();
+  printf("%u links, %u bits per id, %u sets\n",
+         (unsigned)links.num_links(), ids.bits_per_id(), num_sets);
+  printf("expected false-positive rate for %u-link trees: %.6f\n",
+         tree_links, ids.expected_fp_rate(tree_links));
+  printf("%u random trees, %.2f links each\n", num_trees,
+         num_trees ? (double)links_scored / num_trees : 0.0);
+  for (unsigned s = 0; s < num_sets; s++)
+    printf("set %u: %llu false positives, %.2f per tree, fill %.2f bits%s\n",
+           s, fp[s], num_trees ? (double)fp[s] / num_trees : 0.0,
+           num_trees ? (double)fill[s] / num_trees : 0.0,
+           s == best ? " *" : "");
+
+  const char *out = argv[optind + 1];
+  if (!write_set(out, links, ids, best)) {
+    perror(out);
+    return 1;
+  }
+  for (unsigned s = 0; all && s < num_sets; s++) {
+    char name[4096];
+    snprintf(name, sizeof name, "%s.%u", out, s);
+    if (!write_set(name, links, ids, s)) {
+      perror(name);
+      return 1;
+    }
+  }
+
+  return 0;
+}
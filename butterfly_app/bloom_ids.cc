@@ -0,0 +1,171 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "bloom_ids.hh"
+#include <algorithm>
+#include <math.h>
+
+namespace vigil
+{
+  /* Bits a link ID may use. */
+  static const unsigned usable_bits =
+    bloom_filter_bits - __builtin_popcountll(bloom_reserved_bits);
+
+  /* xorshift64* */
+  static uint64_t
+  next_random(uint64_t& state)
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+  }
+
+  static uint64_t
+  random_id(uint64_t& state, unsigned k)
+  {
+    uint64_t id = 0;
+    while ((unsigned)__builtin_popcountll(id) < k) {
+      unsigned bit = next_random(state) % bloom_filter_bits;
+      id |= (1ULL << bit) & ~bloom_reserved_bits;
+    }
+    return id;
+  }
+
+  bloom_id_sets::bloom_id_sets(const adjacency& links, unsigned num_sets,
+                               unsigned bits_per_id)
+    : links(links), sets(std::max(num_sets, 1u)),
+      k(std::min(std::max(bits_per_id, 1u), usable_bits - 1)),
+      ids((size_t)links.num_links() * sets, 0)
+  {
+  }
+
+  void
+  bloom_id_sets::generate(uint64_t seed)
+  {
+    uint64_t state = seed ^ 0x9e3779b97f4a7c15ULL;
+    if (state == 0)
+      state = 1;
+
+    for (uint32_t i = 0; i < links.num_links(); i++) {
+      uint32_t first = links.begin(links.source(i));
+      for (unsigned s = 0; s < sets; s++) {
+        // Redraw an ID equal to that of a sibling link, but give up
+        // on nodes having more links than distinct IDs.
+        uint64_t id;
+        bool taken;
+        int tries = 0;
+        do {
+          id = random_id(state, k);
+          taken = false;
+          for (uint32_t j = first; j < i && !taken; j++)
+            taken = ids[(size_t)j * sets + s] == id;
+        } while (taken && ++tries < 64);
+        ids[(size_t)i * sets + s] = id;
+      }
+    }
+  }
+
+  void
+  bloom_id_sets::take_ids()
+  {
+    for (uint32_t i = 0; i < links.num_links(); i++)
+      ids[(size_t)i * sets] = links.addr(i);
+  }
+
+  void
+  bloom_id_sets::score(const uint32_t *tree, size_t num,
+                       bloom_score *scores) const
+  {
+    std::vector<uint64_t> filter(sets, 0);
+    std::vector<unsigned> fp(sets, 0);
+    std::vector<uint32_t> nodes, skip;
+
+    for (size_t t = 0; t < num; t++) {
+      const uint64_t *id = &ids[(size_t)tree[t] * sets];
+      for (unsigned s = 0; s < sets; s++)
+        filter[s] |= id[s];
+
+      nodes.push_back(links.source(tree[t]));
+      nodes.push_back(links.neighbor(tree[t]));
+      skip.push_back(tree[t]);
+      if (links.reverse(tree[t]) != adjacency::no_link)
+        skip.push_back(links.reverse(tree[t]));
+    }
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    std::sort(skip.begin(), skip.end());
+
+    // First order only: links reached through a false positive are
+    // not followed.
+    for (size_t n = 0; n < nodes.size(); n++) {
+      for (uint32_t i = links.begin(nodes[n]); i < links.end(nodes[n]); i++) {
+        if (std::binary_search(skip.begin(), skip.end(), i))
+          continue;
+        const uint64_t *id = &ids[(size_t)i * sets];
+        for (unsigned s = 0; s < sets; s++)
+          fp[s] += (id[s] & ~filter[s]) == 0;
+      }
+    }
+
+    for (unsigned s = 0; s < sets; s++) {
+      scores[s].false_positives = fp[s];
+      scores[s].fill = __builtin_popcountll(filter[s]);
+    }
+  }
+
+  unsigned
+  bloom_id_sets::best_set(const uint32_t *tree, size_t num,
+                          bloom_score *best) const
+  {
+    std::vector<bloom_score> scores(sets);
+    score(tree, num, &scores[0]);
+
+    unsigned b = 0;
+    for (unsigned s = 1; s < sets; s++) {
+      if (scores[s].false_positives < scores[b].false_positives
+          || (scores[s].false_positives == scores[b].false_positives
+              && scores[s].fill < scores[b].fill))
+        b = s;
+    }
+    if (best)
+      *best = scores[b];
+
+    return b;
+  }
+
+  double
+  bloom_id_sets::expected_fp_rate(unsigned tree_links) const
+  {
+    double fill = 1.0 - pow(1.0 - 1.0 / usable_bits, (double)k * tree_links);
+    return pow(fill, k);
+  }
+
+  unsigned
+  bloom_id_sets::optimal_bits_per_id(unsigned tree_links)
+  {
+    if (tree_links == 0)
+      tree_links = 1;
+    unsigned k = (unsigned)lround((double)usable_bits / tree_links * M_LN2);
+
+    return std::min(std::max(k, 1u), usable_bits / 2);
+  }
+} // vigil namespace
@@ -0,0 +1,87 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef bloom_ids_HH
+#define bloom_ids_HH
+
+#include <vector>
+#include <stdint.h>
+#include "topology.hh"
+
+namespace vigil
+{
+  /* Link IDs are ORed into the 48-bit destination MAC address. */
+  const unsigned bloom_filter_bits = 48;
+  /* The I/G bit of the MAC: filters must stay unicast addresses. */
+  const uint64_t bloom_reserved_bits = 1ULL << 40;
+
+  struct bloom_score
+  {
+    unsigned false_positives;   /* links matching the filter wrongly */
+    unsigned fill;              /* bits set in the filter */
+  };
+
+  /** \brief Candidate sets of Bloom link IDs of a topology.
+   *
+   * Every set assigns an ID of 'bits_per_id' bits to each link of
+   * the adjacency, in the manner of zFilters' link ID tables: the
+   * encoder of a tree can pick the set giving the fewest false
+   * positives.  The IDs are stored link-major, the candidates of a
+   * link next to each other, so scoring a tree touches one
+   * contiguous run per link and the loops over the sets vectorize.
+   */
+  class bloom_id_sets
+  {
+  public:
+    bloom_id_sets(const adjacency& links, unsigned num_sets,
+                  unsigned bits_per_id);
+
+    /* Draw fresh random IDs.  IDs of the links of a node differ. */
+    void generate(uint64_t seed);
+    /* Use the IDs of the adjacency (e.g., of bloom_ids.csv) as set 0. */
+    void take_ids();
+
+    unsigned num_sets() const { return sets; }
+    unsigned bits_per_id() const { return k; }
+    uint64_t id(unsigned set, uint32_t link) const
+    { return ids[(size_t)link * sets + set]; }
+
+    /* Score the tree made of 'num' links (indices of the adjacency)
+     * in every set.  'scores' has num_sets() elements.  A false
+     * positive is a link leaving a node of the tree, not part of it
+     * and not leading back, whose ID is covered by the filter. */
+    void score(const uint32_t *tree, size_t num, bloom_score *scores) const;
+    unsigned best_set(const uint32_t *tree, size_t num,
+                      bloom_score *best = 0) const;
+
+    /* Probability that an ID matches a filter of 'tree_links' IDs. */
+    double expected_fp_rate(unsigned tree_links) const;
+    static unsigned optimal_bits_per_id(unsigned tree_links);
+
+  private:
+    const adjacency& links;
+    unsigned sets;
+    unsigned k;
+    std::vector<uint64_t> ids;
+  };
+} // vigil namespace
+
+#endif
@@ -0,0 +1,363 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Offline simulator of Bloom filter forwarding:
+ *
+ *   bloom_sim [-n trees] [-f receivers] [-g ports_per_table]
+ *             [-j threads] [-r seed] links
+ *
+ * For random multicast groups (a switch and 'receivers' hosts) the
+ * filter of the shortest path tree is computed from the IDs of the
+ * links file, then a packet is forwarded hop by hop the way the
+ * rules of bloom_filter_join_handler() do: every switch decrements
+ * the TTL, then tests its links in table order with the masked
+ * eth_dst match of bloom_fill_table(), (eth_dst & id) == id, and
+ * outputs on each match but the in_port.  A port towards a host
+ * rewrites the destination to the host's ID, which the later tables
+ * see.  -g mimics bloom_group=N (host ports last).
+ *
+ * Reported are the receivers reached, the link traversals on and off
+ * the tree (false positives) and the arrivals at nodes the packet
+ * has already visited (loops).
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "topology.hh"
+
+using namespace vigil;
+
+/* TTL of the simulated packets. */
+static const unsigned initial_ttl = 64;
+/* A tree is given up after this many link traversals. */
+static const uint64_t max_traversals = 100000;
+
+struct sim_stats
+{
+  uint64_t trees;
+  uint64_t unroutable;
+  uint64_t receivers;
+  uint64_t delivered;
+  uint64_t duplicates;
+  uint64_t tree_hops;
+  uint64_t fp_hops;
+  uint64_t loop_hops;
+  uint64_t ttl_drops;
+  uint64_t storms;
+};
+
+struct sim_packet
+{
+  uint32_t node;
+  uint32_t in_link;
+  uint64_t addr;
+  unsigned ttl;
+};
+
+struct sim_thread
+{
+  pthread_t tid;
+  const adjacency *links;
+  const std::vector<uint32_t> *switches;
+  const std::vector<uint32_t> *hosts;
+  uint64_t num_trees;
+  unsigned receivers;
+  unsigned group;
+  unsigned seed;
+  sim_stats st;
+};
+
+static bool
+is_host(const adjacency& links, uint32_t n)
+{
+  return links.degree(n) == 1;
+}
+
+/* Links of node 'n' in table order. */
+static void
+table_order(const adjacency& links, uint32_t n, unsigned group,
+            std::vector<uint32_t>& order)
+{
+  order.clear();
+  for (uint32_t i = links.begin(n); i < links.end(n); i++) {
+    if (group <= 1 || !is_host(links, links.neighbor(i)))
+      order.push_back(i);
+  }
+  for (uint32_t i = links.begin(n); group > 1 && i < links.end(n); i++) {
+    if (is_host(links, links.neighbor(i)))
+      order.push_back(i);
+  }
+}
+
+static void*
+run(void *arg)
+{
+  sim_thread *t = (sim_thread*)arg;
+  const adjacency& links = *t->links;
+  const uint64_t *ids = links.addr_data();
+  size_t num_nodes = links.max_node() + 1;
+  std::vector<uint32_t> parent(num_nodes), seen(num_nodes, 0);
+  std::vector<uint32_t> visited(num_nodes, 0), tree_mark(num_nodes, 0);
+  std::vector<uint32_t> link_mark(links.num_links(), 0);
+  std::vector<uint32_t> queue, rcv, order;
+  std::vector<uint8_t> match;
+  std::vector<sim_packet> packets;
+  uint32_t epoch = 0;
+  unsigned seed = t->seed;
+
+  memset(&t->st, 0, sizeof t->st);
+  for (uint64_t tr = 0; tr < t->num_trees; tr++) {
+    epoch++;
+    uint32_t src = (*t->switches)[rand_r(&seed) % t->switches->size()];
+    rcv.clear();
+    for (unsigned r = 0; r < t->receivers; r++)
+      rcv.push_back((*t->hosts)[rand_r(&seed) % t->hosts->size()]);
+    std::sort(rcv.begin(), rcv.end());
+    rcv.erase(std::unique(rcv.begin(), rcv.end()), rcv.end());
+
+    // Shortest path tree from the source, hosts do not forward.
+    queue.assign(1, src);
+    seen[src] = epoch;
+    parent[src] = adjacency::no_link;
+    for (size_t q = 0; q < queue.size(); q++) {
+      uint32_t n = queue[q];
+      if (n != src && is_host(links, n))
+        continue;
+      for (uint32_t i = links.begin(n); i < links.end(n); i++) {
+        uint32_t to = links.neighbor(i);
+        if (seen[to] == epoch)
+          continue;
+        seen[to] = epoch;
+        parent[to] = i;
+        queue.push_back(to);
+      }
+    }
+
+    uint64_t filter = 0;
+    bool routable = true;
+    tree_mark[src] = epoch;
+    for (size_t r = 0; r < rcv.size() && routable; r++) {
+      uint32_t n = rcv[r];
+      routable = seen[n] == epoch;
+      while (routable && tree_mark[n] != epoch) {
+        tree_mark[n] = epoch;
+        link_mark[parent[n]] = epoch;
+        filter |= ids[parent[n]];
+        n = links.source(parent[n]);
+      }
+    }
+    if (!routable) {
+      t->st.unroutable++;
+      continue;
+    }
+    t->st.trees++;
+    t->st.receivers += rcv.size();
+
+    // Forward the packet.  'seen' now marks the receivers reached.
+    uint64_t traversals = 0;
+    packets.clear();
+    sim_packet first = { src, adjacency::no_link, filter, initial_ttl };
+    packets.push_back(first);
+    visited[src] = epoch;
+    while (!packets.empty()) {
+      sim_packet p = packets.back();
+      packets.pop_back();
+
+      if (p.node != src && is_host(links, p.node)) {
+        if (std::binary_search(rcv.begin(), rcv.end(), p.node)) {
+          if (seen[p.node] == epoch + 1u)
+            t->st.duplicates++;
+          else
+            t->st.delivered++;
+          seen[p.node] = epoch + 1;
+        }
+        continue;
+      }
+      if (--p.ttl == 0) {
+        t->st.ttl_drops++;
+        continue;
+      }
+
+      // Test every link of the node against the address at once,
+      // tests after a rewrite are redone.
+      uint32_t first_link = links.begin(p.node);
+      uint32_t degree = links.degree(p.node);
+      const uint64_t *node_ids = ids + first_link;
+      match.resize(degree);
+      for (uint32_t j = 0; j < degree; j++)
+        match[j] = (node_ids[j] & ~p.addr) == 0;
+
+      table_order(links, p.node, t->group, order);
+      uint64_t addr = p.addr;
+      uint64_t next_addr = addr;
+      uint32_t back = p.in_link == adjacency::no_link
+        ? adjacency::no_link : links.reverse(p.in_link);
+      for (size_t j = 0; j < order.size(); j++) {
+        if (t->group <= 1 || j % t->group == 0)
+          addr = next_addr;
+        uint32_t i = order[j];
+        bool m = addr == p.addr ? match[i - first_link]
+                                : (ids[i] & ~addr) == 0;
+        if (!m || i == back)
+          continue;
+
+        uint32_t to = links.neighbor(i);
+        sim_packet out = { to, i, addr, p.ttl };
+        if (is_host(links, to)) {
+          out.addr = ids[links.begin(to)];
+          next_addr = out.addr;
+        }
+        if (link_mark[i] == epoch)
+          t->st.tree_hops++;
+        else
+          t->st.fp_hops++;
+        if (visited[to] == epoch)
+          t->st.loop_hops++;
+        visited[to] = epoch;
+        packets.push_back(out);
+        traversals++;
+      }
+      if (traversals > max_traversals) {
+        t->st.storms++;
+        break;
+      }
+    }
+    epoch++;
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  uint64_t num_trees = 100000;
+  unsigned receivers = 4, group = 1, seed = 1;
+  unsigned num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int c;
+
+  while ((c = getopt(argc, argv, "n:f:g:j:r:")) != -1) {
+    switch (c) {
+    case 'n': num_trees = strtoull(optarg, NULL, 0); break;
+    case 'f': receivers = atoi(optarg); break;
+    case 'g': group = atoi(optarg); break;
+    case 'j': num_threads = atoi(optarg); break;
+    case 'r': seed = strtoul(optarg, NULL, 0); break;
+    default:
+      return 1;
+    }
+  }
+  if (argc - optind != 1 || receivers == 0) {
+    fprintf(stderr, "usage: %s [-n trees] [-f receivers] "
+            "[-g ports_per_table] [-j threads] [-r seed] links\n", argv[0]);
+    return 1;
+  }
+  if (num_threads == 0)
+    num_threads = 1;
+
+  topo_file f;
+  adjacency links;
+  if (!f.load_links(argv[optind])) {
+    fprintf(stderr, "%s\n", f.error().c_str());
+    return 1;
+  }
+  if (!links.build(f.links(), f.num_links())) {
+    fprintf(stderr, "%s: node ids exceed %u\n", argv[optind],
+            adjacency::max_node_id);
+    return 1;
+  }
+
+  std::vector<uint32_t> switches, hosts;
+  for (uint32_t n = 1; n <= links.max_node(); n++) {
+    if (links.degree(n) > 1)
+      switches.push_back(n);
+    else if (links.degree(n) == 1)
+      hosts.push_back(n);
+  }
+  if (switches.empty() || hosts.empty()) {
+    fprintf(stderr, "%s: no switches or no hosts\n", argv[optind]);
+    return 1;
+  }
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  std::vector<sim_thread> threads(num_threads);
+  for (unsigned i = 0; i < num_threads; i++) {
+    sim_thread& t = threads[i];
+    t.links     = &links;
+    t.switches  = &switches;
+    t.hosts     = &hosts;
+    t.num_trees = num_trees / num_threads + (i < num_trees % num_threads);
+    t.receivers = receivers;
+    t.group     = group;
+    t.seed      = seed * 7919 + i;
+    if (pthread_create(&t.tid, NULL, run, &t) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+
+  sim_stats sum;
+  memset(&sum, 0, sizeof sum);
+  for (unsigned i = 0; i < num_threads; i++) {
+    const sim_stats& s = threads[i].st;
+    pthread_join(threads[i].tid, NULL);
+    sum.trees      += s.trees;
+    sum.unroutable += s.unroutable;
+    sum.receivers  += s.receivers;
+    sum.delivered  += s.delivered;
+    sum.duplicates += s.duplicates;
+    sum.tree_hops  += s.tree_hops;
+    sum.fp_hops    += s.fp_hops;
+    sum.loop_hops  += s.loop_hops;
+    sum.ttl_drops  += s.ttl_drops;
+    sum.storms     += s.storms;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+  printf("%u switches, %u hosts, %u links\n", (unsigned)switches.size(),
+         (unsigned)hosts.size(), (unsigned)links.num_links());
+  printf("trees:            %llu (%llu unroutable)\n",
+         (unsigned long long)sum.trees, (unsigned long long)sum.unroutable);
+  printf("delivered:        %llu of %llu receivers, %llu duplicates\n",
+         (unsigned long long)sum.delivered,
+         (unsigned long long)sum.receivers,
+         (unsigned long long)sum.duplicates);
+  printf("tree traversals:  %llu\n", (unsigned long long)sum.tree_hops);
+  printf("false positives:  %llu (%.4f of traversals)\n",
+         (unsigned long long)sum.fp_hops,
+         sum.tree_hops + sum.fp_hops
+         ? (double)sum.fp_hops / (sum.tree_hops + sum.fp_hops) : 0.0);
+  printf("looped:           %llu, %llu TTL drops, %llu storms\n",
+         (unsigned long long)sum.loop_hops,
+         (unsigned long long)sum.ttl_drops, (unsigned long long)sum.storms);
+  printf("%.3f s, %.0f trees/s on %u threads\n", secs,
+         secs > 0 ? (sum.trees + sum.unroutable) / secs : 0.0, num_threads);
+
+  return 0;
+}
@@ -41,6 +41,9 @@ def get_file_path():
 def get_topo_filename():
     return get_file_path() + '/bloom_ids.csv' 
 
+def get_paths_filename():
+    return get_file_path() + '/butterfly_paths.txt'
+
 def get_coords_filename():
     return get_file_path() + '/greedy_coords.csv'
 
@@ -458,6 +461,10 @@ class ButterflyTopo( Topo ):
 # Changing the defaults by redefining 'minimal', 'ovsk', 'ref' is
 # really ugly, but those are useless in our scenario.
 #
+mpls_command = "'butterfly app'=links=%s,paths=%s" \
+    % ( get_topo_filename(), get_paths_filename() )
+nc_command = "'butterfly app'=nc,links=%s,paths=%s" \
+    % ( get_topo_filename(), get_paths_filename() )
 bloom_command = "'butterfly app'=bloom,links=%s" % get_topo_filename()
 greedy_command = "'butterfly app'=greedy,links=%s,coords=%s" \
     % ( get_topo_filename(), get_coords_filename() )
@@ -465,8 +472,8 @@ greedy_command = "'butterfly app'=greedy,links=%s,coords=%s" \
 topos = { 'minimal': ( lambda: ButterflyTopo() ),
           'butterfly': ( lambda: ButterflyTopo() ) } 
 switches = { 'ovsk': UserSwitch }
-controllers = { 'ref': lambda name: NOX( name, "'butterfly app'" ),
-                'nc' : lambda name: NOX( name, "'butterfly app'=nc" ),
-                'mpls' : lambda name: NOX( name, "'butterfly app'" ),
+controllers = { 'ref': lambda name: NOX( name, mpls_command ),
+                'nc' : lambda name: NOX( name, nc_command ),
+                'mpls' : lambda name: NOX( name, mpls_command ),
                 'bloom': lambda name: NOX( name, bloom_command ),
                 'greedy' : lambda name: NOX( name, greedy_command ) }
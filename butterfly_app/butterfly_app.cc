@@ -20,12 +20,17 @@
  */
 
 #include <boost/bind.hpp>
-#include <fstream>
-#include <iostream>
+#include <algorithm>
+#include <errno.h>
+#include <sstream>
+#include <sys/time.h>
+#include <time.h>
 #include <utility>
 #include <unordered_map>
 #include "assert.hh"
 #include "datapath-join.hh"
+#include "datapath-leave.hh"
+#include "ofp-msg-event.hh"
 #include <openflow/bme-ext.h>
 #include "../oflib/ofl-packets.h"
 #include "../oflib-exp/ofl-exp-bme.h"
@@ -36,515 +41,619 @@ namespace vigil
 {
   static Vlog_module lg("butterfly_app");
 
-  const uint32_t h1_ip_addr = 0x0a000001;
-  const uint32_t h2_ip_addr = 0x0a000002;
-  const uint32_t h3_ip_addr = 0x0a000003;
-  const uint32_t h4_ip_addr = 0x0a000004;
-
-  const int s5_port_to_h1  = 1;
-  const int s5_port_to_s7  = 2;
-  const int s5_port_to_s9  = 3;
-  const int s6_port_to_h2  = 1;
-  const int s6_port_to_s7  = 2;
-  const int s6_port_to_s10 = 3;
-  const int s7_port_to_s5  = 1;
-  const int s7_port_to_s6  = 2;
-  const int s7_port_to_s8  = 3;
-  const int s8_port_to_s7  = 1;
-  const int s8_port_to_s9  = 2;
-  const int s8_port_to_s10 = 3;
-  const int s9_port_to_h3  = 1;
-  const int s9_port_to_s5  = 2;
-  const int s9_port_to_s8  = 3;
-  const int s10_port_to_h4 = 1;
-  const int s10_port_to_s6 = 2;
-  const int s10_port_to_s8 = 3;
+  /* Bytes waiting for a datapath above which its joins are put off. */
+  const size_t dp_queue_high_water = 256 * 1024;
+  /* Bytes waiting for all datapaths above which joins are put off. */
+  const size_t join_high_water = 16 * 1024 * 1024;
+  /* A message rejected by a switch is sent at most this many times. */
+  const int max_send_tries = 3;
+  /* Delay of the next attempt when a connection does not accept more. */
+  const long drain_retry_us = 10 * 1000;
+  /* How often finished joins are picked up from the workers. */
+  const long collect_interval_us = 1000;
+  /* Time a datapath has to send back its flow tables. */
+  const time_t flow_stats_timeout_s = 5;
+  /* A Bloom table of n ports holds 2^n entries. */
+  const int max_bloom_group = 8;
+
+  static uint64_t
+  now_ns()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+  static uint64_t
+  now_us()
+  {
+    return now_ns() / 1000;
+  }
 
+  /* Queue a message built by b_flow_template::build().  The batch
+   * frees it. */
   void
-  butterfly_app::b_send(b_flow_mod* b)
+  butterfly_app::b_send(dp_context& ctx, struct ofp_header* oh)
   {
-    struct ofp_header *oh = b->build();
-    send_openflow_command(dp_id, oh, true);
-    delete b;
+    ctx.batch->add(oh);
   }
 
-  Disposition
-  butterfly_app::general_join_handler(const Event& e0)
+  dp_context*
+  butterfly_app::find_context(const datapathid& dpid)
   {
-    const Datapath_join_event& e 
-      = assert_cast <const Datapath_join_event&> (e0);
-    b_flow_mod *b;
+    std::unordered_map<uint64_t, dp_context*>::iterator i;
+    i = contexts.find(dpid.as_host());
 
-#if OFP_VERSION == 0x01
-    this->dp_id = e.datapath_id;
-#else
-    this->dp_id = e.dpid;
-#endif
-    lg.dbg(" general_join_handler called ============== pathid: %s ",
-           dp_id.string().c_str());
-
-    switch (dp_id.as_host()) {
-    case 5: { /* ================================================== */
-      b = new b_flow_mod();
-      b->match_src( h1_ip_addr );
-      b->match_dst( h3_ip_addr );
-      b->apply_actions()->push_mpls_header()
-                        ->set_mpls_label( 1 )
-                        ->output( s5_port_to_s7 )
-                        ->output( s5_port_to_s9 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->write_actions()->output( s5_port_to_h1 );
-      b_send(b);
+    return i == contexts.end() ? NULL : i->second;
+  }
 
-      break;
-    }
-    case 6: { /* ================================================== */
-      b = new b_flow_mod();
-      b->match_src( h2_ip_addr );
-      b->match_dst( h4_ip_addr );
-      b->apply_actions()->push_mpls_header()
-                        ->set_mpls_label( 2 )
-                        ->output( s6_port_to_s7 )
-                        ->output( s6_port_to_s10 );
-      b_send(b);
+  dp_context*
+  butterfly_app::new_context(const datapathid& dpid)
+  {
+    dp_context *ctx = new dp_context(dpid, dp_queue_high_water,
+                                     &queued_total);
+    if (metrics)
+      ctx->metrics = metrics->get(dpid.as_host());
+    contexts[dpid.as_host()] = ctx;
 
-      b = new b_flow_mod();
-      b->write_actions()->output( s6_port_to_h2 );
-      b_send(b);
+    return ctx;
+  }
 
-      break;
+  int
+  butterfly_app::send_msg(const datapathid& dpid, const struct ofp_header* oh)
+  {
+    return send_openflow_command(dpid, oh, false);
+  }
+
+  /* send_msg() for the queue of 'ctx', counting what is sent. */
+  int
+  butterfly_app::send_queued(dp_context *ctx, const struct ofp_header* oh)
+  {
+    int error = send_msg(ctx->dpid, oh);
+    if (error == 0 && ctx->metrics) {
+      ctx->metrics->msgs_sent++;
+      ctx->metrics->bytes_sent += ntohs(oh->length);
+      if (oh->type == OFPT_FLOW_MOD)
+        ctx->metrics->flow_mods_sent++;
     }
-    case 7: { /* ================================================== */
-      b = new b_flow_mod();
-      b->match_mpls_label( 1 );
-      b->write_actions()->output( s7_port_to_s8 );
-      b_send(b);
 
-      b = new b_flow_mod();
-      b->match_mpls_label( 2 );
-      b->write_actions()->output( s7_port_to_s8 );
-      b_send(b);
+    return error;
+  }
 
-      break;
+  /* Send what the connection accepts without blocking, and come back
+   * later for the rest. */
+  void
+  butterfly_app::drain(const datapathid& dpid)
+  {
+    dp_context *ctx = find_context(dpid);
+    if (ctx == NULL)
+      return;
+
+    b_dp_queue *q = &ctx->queue;
+    uint64_t start = ctx->metrics ? now_ns() : 0;
+    int error = q->drain(boost::bind(&butterfly_app::send_queued,
+                                     this, ctx, _1));
+    if (ctx->metrics) {
+      ctx->metrics->send.add(now_ns() - start);
+      if (error && error != EAGAIN)
+        ctx->metrics->send_errors++;
+    }
+    if (error == EAGAIN) {
+      if (!q->drain_scheduled) {
+        timeval tv = { 0, drain_retry_us };
+        q->drain_scheduled = true;
+        post(boost::bind(&butterfly_app::drain_timer, this, dpid), tv);
+      }
+    } else if (error) {
+      lg.err("sending to %s failed (%d)", dpid.string().c_str(), error);
     }
-    case 8: { /* ================================================== */
-      b_flow_mod *b = new b_flow_mod();
-      b->match_mpls_label( 1 );
-      b->write_actions()->output( s8_port_to_s10 );
-      b_send(b);
+  }
+
+  void
+  butterfly_app::drain_timer(const datapathid& dpid)
+  {
+    dp_context *ctx = find_context(dpid);
+    if (ctx)
+      ctx->queue.drain_scheduled = false;
+    drain(dpid);
+    run_deferred_joins();
+  }
 
-      b = (new b_flow_mod());
-      b->match_mpls_label( 2 );
-      b->write_actions()->output( s8_port_to_s9 );
-      b_send(b);
+  /* Send the rules compiled from the path spec for this datapath. */
+  Disposition
+  butterfly_app::path_join_handler(dp_context& ctx)
+  {
+    lg.dbg(" path_join_handler called ============== pathid: %s ",
+           ctx.dpid.string().c_str());
 
-      break;
+    const path_compiler::rule_list_t *l = NULL;
+    if (paths)
+      l = paths->rules(ctx.dpid.as_host());
+    if (l == NULL) {
+      lg.warn("\n\n UNKNOWN PATHID, IGNORED -=-=-=-=-=-=-=-=-=-=-=-=-=\n\n");
+      return CONTINUE;
     }
-    case 9: { /* ================================================== */
-      b_flow_mod *b = new b_flow_mod();
-      b->match_mpls_label( 1 );
-      b->write_actions()->pop_mpls_header()
-                        ->output( s9_port_to_h3 );
-      b_send(b);
 
+    for (size_t i = 0; i < l->size(); i++)
+      b_send(ctx, (*l)[i]->build());
 
-      b = new b_flow_mod();
-      b->match_mpls_label( 2 );
-      b->write_actions()->pop_mpls_header()
-                        ->set_ipv4_destination( h3_ip_addr )
-                        ->output( s9_port_to_h3 );
-      b_send(b);
+    return CONTINUE;
+  }
 
-      b = new b_flow_mod();
-      b->write_actions()->output( s9_port_to_s5 );
-      b_send(b);
+  Disposition
+  butterfly_app::greedy_routing_join_handler(dp_context& ctx)
+  {
+    lg.dbg(" greedy_routing_join_handler called =========== pathid: %s ",
+           ctx.dpid.string().c_str());
 
-      break;
+    if (!rules->greedy(ctx.dpid.as_host(), ctx.down.get(), ctx.batch))
+      lg.warn("\n\n UNKNOWN PATHID, IGNORED -=-=-=-=-=-=-=-=-=-=-=-=-=\n\n");
+
+    return CONTINUE;
+  }
+
+  Disposition
+  butterfly_app::bloom_filter_join_handler(dp_context& ctx)
+  {
+    lg.dbg(" bloom_filter_join_handler called =========== pathid: %s ",
+           ctx.dpid.string().c_str());
+
+    if (!rules->bloom(ctx.dpid.as_host(), ctx.down.get(), ctx.batch))
+      lg.warn("\n\n UNKNOWN PATHID, IGNORED -=-=-=-=-=-=-=-=-=-=-=-=-=\n\n");
+
+    return CONTINUE;
+  }
+
+  /* Hand the rule computation of 'ctx' to a worker. */
+  void
+  butterfly_app::start_join(dp_context *ctx)
+  {
+    ctx->joining = true;
+    ctx->batch   = new b_batch();
+    ctx->batch->set_start_us(now_us());
+    ctx->down    = links_down;
+    running_joins++;
+    if (ctx->metrics) {
+      ctx->batch->time_packing();
+      if (ctx->update)
+        ctx->metrics->updates++;
+      else
+        ctx->metrics->joins++;
     }
-    case 10: { /* ================================================== */
-      b = new b_flow_mod();
-      b->match_mpls_label( 2 );
-      b->write_actions()->pop_mpls_header()
-                        ->output( s10_port_to_h4 );
-      b_send(b);
 
-      b = new b_flow_mod();
-      b->match_mpls_label( 1 );
-      b->write_actions()->pop_mpls_header()
-                        ->set_ipv4_destination( h4_ip_addr )
-                        ->output( s10_port_to_h4 );
-      b_send(b);
+    if (reconcile && !ctx->update)
+      request_flows(ctx);
 
-      b = new b_flow_mod();
-      b->write_actions()->output( s10_port_to_s6 );
-      b_send(b);
+    workers->submit(boost::bind(&butterfly_app::compute_join, this, ctx));
 
-      break;
+    if (!collect_scheduled && running_joins) {
+      timeval tv = { 0, collect_interval_us };
+      collect_scheduled = true;
+      post(boost::bind(&butterfly_app::collect_joins, this), tv);
     }
-    case 1: { /* ================================================== */
-      /* test topo:                  */
-      /*  s1 <-> h2-eth0 h3-eth0     */
-      /*  s1: intfs=s1-eth1,s1-eth2  */
-      //send_set_mpls_from_counter(dp_id, 2);
-      //send_set_metadata(dp_id, OFPFMF_IN_PORT, 0, 2);
-      //send_set_metadata(dp_id, OFPFMF_NW_PROTO, 4, 2);
-      //send_set_metadata(dp_id, OFPFMF_MPLS_LABEL, 16, 2);
-      //send_set_metadata(dp_id, OFPFMF_DL_SRC, 0, 2);
-      //send_set_output(dp_id);
+  }
 
-      break;
+  /* Recompute the rules of a datapath after a link change.  A join
+   * still to come computes everything anyway. */
+  void
+  butterfly_app::start_update(dp_context *ctx)
+  {
+    if (std::find(deferred_joins.begin(), deferred_joins.end(), ctx->dpid)
+        != deferred_joins.end())
+      return;
+    if (ctx->busy()) {
+      ctx->stale = true;
+      return;
     }
-    default:
-      lg.warn("\n\n UNKNOWN PATHID, IGNORED -=-=-=-=-=-=-=-=-=-=-=-=-=\n\n");
+    ctx->update = true;
+    start_join(ctx);
+  }
 
+  /* Runs on a worker thread: fill ctx->batch, then hand 'ctx' back. */
+  void
+  butterfly_app::compute_join(dp_context *ctx)
+  {
+    uint64_t start = now_ns();
+    switch (type) {
+    case MPLS_MULTICAST:
+    case NETWORK_CODING: {path_join_handler(*ctx); break;}
+    case GREEDY_ROUTING: {greedy_routing_join_handler(*ctx); break;}
+    case BLOOM_FILTER:   {bloom_filter_join_handler(*ctx); break;}
+    default: {
+      lg.warn("unknown app_type (%d)", type);
       break;
     }
+    }
+    ctx->compute_ns = now_ns() - start;
 
-    return CONTINUE;
+    pthread_mutex_lock(&done_mutex);
+    done_joins.push_back(ctx);
+    pthread_mutex_unlock(&done_mutex);
   }
 
-  Disposition
-  butterfly_app::network_coding_join_handler(const Event& e0)
+  /* Timer on the NOX thread picking up the joins the workers are
+   * done with. */
+  void
+  butterfly_app::collect_joins()
   {
-    const Datapath_join_event& e 
-      = assert_cast <const Datapath_join_event&> (e0);
-    b_flow_mod *b;
-
-    this->dp_id = e.dpid;
-    lg.dbg(" network_coding_join_handler called =========== pathid: %s ",
-           dp_id.string().c_str());
-
-    switch (dp_id.as_host()) {
-    case 5: { /* ================================================== */
-      b = new b_flow_mod();
-      b->match_src( h1_ip_addr );
-      b->match_dst( h3_ip_addr );
-      b->apply_actions()->push_mpls_header()
-                        ->set_mpls_label( 0 )
-                        ->push_mpls_header()
-                        ->set_mpls_label_from_counter()
-                        ->push_mpls_header()
-                        ->set_mpls_label( 1 )
-                        ->output( s5_port_to_s7 )
-                        ->output( s5_port_to_s9 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->write_actions()->output( s5_port_to_h1 );
-      b_send(b);
+    std::vector<dp_context*> done;
 
-      break;
+    collect_scheduled = false;
+    pthread_mutex_lock(&done_mutex);
+    done.swap(done_joins);
+    pthread_mutex_unlock(&done_mutex);
+
+    for (size_t i = 0; i < done.size(); i++)
+      finish_join(done[i]);
+    running_joins -= done.size();
+
+    run_deferred_joins();
+
+    if (!collect_scheduled && running_joins) {
+      timeval tv = { 0, collect_interval_us };
+      collect_scheduled = true;
+      post(boost::bind(&butterfly_app::collect_joins, this), tv);
     }
-    case 6: { /* ================================================== */
-      b = new b_flow_mod();
-      b->match_src( h2_ip_addr );
-      b->match_dst( h4_ip_addr );
-      b->apply_actions()->push_mpls_header()
-                        ->set_mpls_label_from_counter()
-                        ->push_mpls_header()
-                        ->set_mpls_label( 0 )
-                        ->push_mpls_header()
-                        ->set_mpls_label( 2 )
-                        ->output( s6_port_to_s7 )
-                        ->output( s6_port_to_s10 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->write_actions()->output( s6_port_to_h2 );
-      b_send(b);
+  }
 
-      break;
+  /* Take the rules of a computed join from its worker. */
+  void
+  butterfly_app::finish_join(dp_context *ctx)
+  {
+    b_batch *b = ctx->batch;
+    ctx->batch   = NULL;
+    ctx->joining = false;
+
+    if (ctx->metrics) {
+      ctx->metrics->compute.add(ctx->compute_ns);
+      ctx->metrics->pack.add(b->packing_ns());
     }
-    case 7: { /* ================================================== */
-      b = new b_flow_mod();
-      b->match_mpls_label( 1 );
-      b->apply_actions()->set_mpls_label( 3 )
-                        ->xor_encode( 3, 11 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 2 );
-      b->apply_actions()->set_mpls_label( 3 )
-                        ->xor_encode( 3, 12 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 3 );
-      b->write_actions()->output( s7_port_to_s8 );
-      b_send(b);
-      
-      b = new b_flow_mod();
-      b->match_mpls_label( 11 );
-      b->write_actions()->set_mpls_label( 1 )
-                        ->output( s7_port_to_s8 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 12 );
-      b->write_actions()->set_mpls_label( 2 )
-                        ->output( s7_port_to_s8 );
-      b_send(b);
-
-      /* for debugging purposes */
-      b = new b_flow_mod();
-      b->write_actions()->output( s7_port_to_s8 );
-      b_send(b);
 
-      break;
+    if (ctx->left) {
+      delete b;
+      delete ctx;
+      return;
     }
-    case 8: { /* ================================================== */
-      b = new b_flow_mod();
-      b->match_mpls_label( 1 );
-      b->write_actions()->output( s8_port_to_s10 );
-      b_send(b);
 
-      b = new b_flow_mod();
-      b->match_mpls_label( 2 );
-      b->write_actions()->output( s8_port_to_s9 );
-      b_send(b);
+    // The rules are compared with the flow tables still being read.
+    if (ctx->stats_xid) {
+      ctx->batch = b;
+      return;
+    }
+    send_rules(ctx, b);
+  }
 
-      b = new b_flow_mod();
-      b->match_mpls_label( 3 );
-      b->apply_actions()->output( s8_port_to_s9 )
-                        ->output( s8_port_to_s10 );
-      b_send(b);
+  /* Close the rules of a join with a barrier request, hand them to
+   * the datapath's queue and start sending. */
+  void
+  butterfly_app::send_rules(dp_context *ctx, b_batch *b)
+  {
+    // A join sends everything, an update only what differs from the
+    // rules sent before.
+    if (ctx->update) {
+      b_rule_set next;
+      next.insert(*b);
+      b_batch *delta = new b_batch();
+      delta->set_start_us(b->start_us());
+      ctx->installed.diff(next, delta);
+      ctx->installed.swap(next);
+      lg.dbg("%s updated: %zu of %zu rules sent", ctx->dpid.string().c_str(),
+             delta->num_msgs(), ctx->installed.size());
+      delete b;
+      b = delta;
+    } else {
+      ctx->installed.clear();
+      ctx->installed.insert(*b);
+    }
+    ctx->update = false;
+
+    if (b->num_msgs() > 0) {
+      dp_pending p;
+      p.num_msgs    = b->num_msgs();
+      p.barrier_xid = b->close();
+      p.bytes       = b->size();
+      p.start_us    = b->start_us();
+      ctx->pending.push_back(p);
+      ctx->queue.push(b);
+      drain(ctx->dpid);
+    } else {
+      delete b;
+    }
 
-      break;
+    // A link changed while these rules were computed.
+    if (ctx->stale) {
+      ctx->stale = false;
+      start_update(ctx);
     }
-    case 9: { /* ================================================== */
-      b = new b_flow_mod();
-      b->match_mpls_label( 1 );
-      b->apply_actions()->set_mpls_label( 3 )
-                        ->xor_decode( 13, 23 )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_IP )
-                        ->output( s9_port_to_h3 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 2 );
-      b->apply_actions()->set_mpls_label( 3 )
-                        ->xor_decode( 13, 23 )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_IP )
-                        ->set_ipv4_destination( h3_ip_addr )
-                        ->output( s9_port_to_h3 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 3 );
-      b->apply_actions()->xor_decode( 13, 23 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 13 );
-      b->apply_actions()->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_IP )
-                        ->set_ipv4_destination( h3_ip_addr )
-                        ->output( s9_port_to_h3 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 23 );
-      b->apply_actions()->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_IP )
-                        ->set_ipv4_destination( h3_ip_addr )
-                        ->output( s9_port_to_h3 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->write_actions()->output( s9_port_to_s5 );
-      b_send(b);
+  }
 
-      break;
+  /* Handle the joins put off by datapath_join_handler() as long as the
+   * queues have room. */
+  void
+  butterfly_app::run_deferred_joins()
+  {
+    while (!deferred_joins.empty() && queued_total < join_high_water) {
+      dp_context *ctx = find_context(deferred_joins.front());
+      if (ctx && (ctx->busy() || ctx->queue.congested()))
+        break;
+      if (ctx == NULL)
+        ctx = new_context(deferred_joins.front());
+      deferred_joins.pop_front();
+      start_join(ctx);
     }
-    case 10: { /* ================================================== */
-      b = new b_flow_mod();
-      b->match_mpls_label( 1 );
-      b->apply_actions()->set_mpls_label( 3 )
-                        ->xor_decode( 13, 23 )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_IP )
-                        ->set_ipv4_destination( h4_ip_addr )
-                        ->output( s10_port_to_h4 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 2 );
-      b->apply_actions()->set_mpls_label( 3 )
-                        ->xor_decode( 13, 23 )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_IP )
-                        ->output( s10_port_to_h4 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 3 );
-      b->apply_actions()->xor_decode( 13, 23 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 13 );
-      b->apply_actions()->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_IP )
-                        ->set_ipv4_destination( h4_ip_addr )
-                        ->output( s10_port_to_h4 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->match_mpls_label( 23 );
-      b->apply_actions()->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_MPLS )
-                        ->pop_mpls_header( ETH_TYPE_IP )
-                        ->set_ipv4_destination( h4_ip_addr )
-                        ->output( s10_port_to_h4 );
-      b_send(b);
-
-      b = new b_flow_mod();
-      b->write_actions()->output( s10_port_to_s6 );
-      b_send(b);
+  }
 
-      break;
+  Disposition
+  butterfly_app::datapath_join_handler(const Event& e0)
+  {
+    const Datapath_join_event& e 
+      = assert_cast <const Datapath_join_event&> (e0);
+#if OFP_VERSION == 0x01
+    datapathid dpid = e.datapath_id;
+#else
+    datapathid dpid = e.dpid;
+#endif
+
+    // Computing rules that cannot be sent anyway only adds to the
+    // backlog, so wait until the queues drain.  A datapath that
+    // rejoins before its last join is computed waits as well.
+    dp_context *ctx = find_context(dpid);
+    if (!deferred_joins.empty() || queued_total >= join_high_water
+        || (ctx && (ctx->busy() || ctx->queue.congested()))) {
+      lg.dbg("join of %s put off, %zu bytes queued",
+             dpid.string().c_str(), queued_total);
+      deferred_joins.push_back(dpid);
+      return CONTINUE;
     }
-    default:
-      lg.warn("\n\n UNKNOWN PATHID, IGNORED -=-=-=-=-=-=-=-=-=-=-=-=-=\n\n");
 
-      break;
+    if (ctx == NULL)
+      ctx = new_context(dpid);
+    start_join(ctx);
+
+    return CONTINUE;
+  }
+
+  Disposition
+  butterfly_app::datapath_leave_handler(const Event& e0)
+  {
+    const Datapath_leave_event& e 
+      = assert_cast <const Datapath_leave_event&> (e0);
+
+    std::unordered_map<uint64_t, dp_context*>::iterator i;
+    i = contexts.find(e.dpid.as_host());
+    if (i != contexts.end()) {
+      // A worker may still be filling the batch, finish_join() frees
+      // the context then.
+      if (i->second->joining)
+        i->second->left = true;
+      else
+        delete i->second;
+      contexts.erase(i);
     }
+    deferred_joins.erase(std::remove(deferred_joins.begin(),
+                                     deferred_joins.end(), e.dpid),
+                         deferred_joins.end());
+    if (port_stats)
+      port_stats->remove(e.dpid.as_host());
 
     return CONTINUE;
   }
 
   Disposition
-  butterfly_app::greedy_routing_join_handler(const Event& e0)
+  butterfly_app::barrier_reply_handler(const Event& e0)
   {
-    const Datapath_join_event& e 
-      = assert_cast <const Datapath_join_event&> (e0);
-    
-    this->dp_id = e.dpid;
-    lg.dbg(" greedy_routing_join_handler called =========== pathid: %s ",
-           dp_id.string().c_str());
+    const Ofp_msg_event& e = assert_cast <const Ofp_msg_event&> (e0);
 
-    if (links.find(dp_id.as_host()) == links.end()) {
-      lg.warn("\n\n UNKNOWN PATHID, IGNORED -=-=-=-=-=-=-=-=-=-=-=-=-=\n\n");
+    dp_context *ctx = find_context(e.dpid);
+    if (ctx == NULL)
+      return CONTINUE;
+
+    ctx->queue.ack(e.xid);
+
+    // Barriers are answered in order, a batch still waiting before
+    // this one has lost its reply.
+    std::deque<dp_pending>::iterator i;
+    for (i = ctx->pending.begin(); i != ctx->pending.end(); i++) {
+      if (i->barrier_xid == e.xid)
+        break;
+    }
+    if (i == ctx->pending.end())
       return CONTINUE;
+    dp_pending p = *i;
+    ctx->pending.erase(ctx->pending.begin(), ++i);
+
+    uint64_t elapsed_us = now_us() - p.start_us;
+    lg.info("datapath %s programmed: %zu messages, %zu bytes, "
+            "join-to-ready %.3f ms", e.dpid.string().c_str(),
+            p.num_msgs, p.bytes, elapsed_us / 1000.0);
+    if (ctx->metrics) {
+      ctx->metrics->programmed++;
+      ctx->metrics->programmed_in.add(elapsed_us * 1000);
     }
-    uint32_t from_node = dp_id.as_host();
-    port_list_t *l = &links[ from_node ];
 
-    b_flow_mod *b = new b_flow_mod();
-    b->write_metadata( 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL );
-    
-    for(port_list_t::iterator i = l->begin(); i != l->end(); i++) {
-      port_t p = *i;
-      uint32_t to_node = std::get<0>(p);
-      uint32_t port_no = std::get<1>(p);
-
-      coord_t c = greedy_coords[ to_node ];
-      uint32_t x = std::get<0>(c);
-      uint32_t y = std::get<1>(c);
-      //lg.dbg(" node,x,y,port_no: %d,%d,%d,%d ", from_node, x, y, port_no);
-
-      b->apply_actions()
-            ->update_distance_in_metadata( x, y, port_no );
-    }
-    b->write_metadata( 0x0000000000000000ULL, 0xFFFFFFFFFFFF0000ULL );
-    b->apply_actions()->output_by_metadata();
-    b_send(b);
-    
     return CONTINUE;
   }
 
+  /* Ask for the flow tables of a datapath to compare the rules of its
+   * join with.  Without an answer every rule is sent. */
   void
-  butterfly_app::bloom_fill_table(int table_id, int port_no,
-                                  uint64_t bloom_addr, uint64_t eth_dst_addr,
-                                  uint32_t ip_dst_addr)
+  butterfly_app::request_flows(dp_context *ctx)
   {
-    b_flow_mod *b;
+    uint32_t xid = b_flow_mod::get_new_xid();
+    struct ofp_header *oh = b_flow_stats_request(xid);
+    if (oh == NULL)
+      return;
+
+    int error = send_msg(ctx->dpid, oh);
+    free(oh);
+    if (error) {
+      lg.warn("cannot read flow tables of %s (%d), sending every rule",
+              ctx->dpid.string().c_str(), error);
+      return;
+    }
 
-    b = new b_flow_mod();
-    b->table( table_id );
-    b->match_eth_dst( bloom_addr, ~bloom_addr );
-    if (eth_dst_addr)
-      b->apply_actions()->set_eth_dst( eth_dst_addr )
-                        ->set_ipv4_destination( ip_dst_addr );
-    b->apply_actions()->output( port_no );
-    b->instructions()->goto_table( table_id + 1 );
-    b_send(b);
+    ctx->installed.clear();
+    ctx->update    = true;
+    ctx->stats_xid = xid;
 
-    b = new b_flow_mod();
-    b->table( table_id );
-    b->instructions()->goto_table( table_id + 1 );
-    b_send(b);
+    timeval tv = { flow_stats_timeout_s, 0 };
+    post(boost::bind(&butterfly_app::flow_stats_timer, this,
+                     ctx->dpid, xid), tv);
   }
 
-  Disposition
-  butterfly_app::bloom_filter_join_handler(const Event& e0)
+  /* The flow tables are in 'installed': send the join if it is
+   * computed already. */
+  void
+  butterfly_app::flows_read(dp_context *ctx)
   {
-    const Datapath_join_event& e 
-      = assert_cast <const Datapath_join_event&> (e0);
+    ctx->stats_xid = 0;
+    if (ctx->joining || ctx->batch == NULL)
+      return;
 
-    this->dp_id = e.dpid;
-    lg.dbg(" bloom_filter_join_handler called =========== pathid: %s ",
-           dp_id.string().c_str());
+    b_batch *b = ctx->batch;
+    ctx->batch = NULL;
+    send_rules(ctx, b);
+  }
 
-    if (links.find(dp_id.as_host()) == links.end()) {
-      lg.warn("\n\n UNKNOWN PATHID, IGNORED -=-=-=-=-=-=-=-=-=-=-=-=-=\n\n");
+  /* Stale entries stay, but at least every rule gets sent. */
+  void
+  butterfly_app::flows_failed(dp_context *ctx, const char *why)
+  {
+    lg.warn("reading flow tables of %s %s, sending every rule",
+            ctx->dpid.string().c_str(), why);
+    ctx->installed.clear();
+    flows_read(ctx);
+  }
+
+  void
+  butterfly_app::flow_stats_timer(const datapathid& dpid, uint32_t xid)
+  {
+    dp_context *ctx = find_context(dpid);
+    if (ctx && ctx->stats_xid == xid)
+      flows_failed(ctx, "timed out");
+  }
+
+  /* Collect the entries of a flow stats reply, which may come in
+   * several parts. */
+  Disposition
+  butterfly_app::stats_reply_handler(const Event& e0)
+  {
+    const Ofp_msg_event& e = assert_cast <const Ofp_msg_event&> (e0);
+    struct ofl_msg_stats_reply_header *rep
+      = (struct ofl_msg_stats_reply_header*)e.msg;
+
+    if (rep->type == OFPST_PORT) {
+      if (port_stats)
+        port_stats_reply(e.dpid, (struct ofl_msg_stats_reply_port*)rep);
       return CONTINUE;
     }
 
-    b_flow_mod *b = new b_flow_mod();
-    b->table( 0 );
-    b->apply_actions()->decrement_ipv4_ttl();
-    b->instructions()->goto_table( 1 );
-    b_send(b);
-
-    uint32_t from_node = dp_id.as_host();
-    port_list_t *l = &links[ from_node ];
-    int num_links = 0;
-    for(port_list_t::iterator i = l->begin(); i != l->end(); i++) {
-      port_t p = *i;
-      uint32_t to_node = std::get<0>(p);
-      uint32_t port_no = std::get<1>(p);
-      uint64_t addr    = std::get<2>(p);
-
-      lg.dbg("flowmod: %d, %d, 0x%"PRIx64, to_node, port_no, addr);
-
-      uint64_t host_eth = 0;
-      uint32_t host_ip  = 0;
-      port_list_t *l_to = &links[ to_node ];
-      if (l_to->size() == 1) {
-        host_eth = std::get<2>( l_to->front() );
-        host_ip  = 0x0a000000 + to_node;  // assuming: 10.0.0.id
-      }
+    dp_context *ctx = find_context(e.dpid);
+    if (ctx == NULL || ctx->stats_xid == 0 || ctx->stats_xid != e.xid
+        || rep->type != OFPST_FLOW)
+      return CONTINUE;
 
-      bloom_fill_table( ++num_links, port_no, addr, host_eth, host_ip );
+    struct ofl_msg_stats_reply_flow *flows
+      = (struct ofl_msg_stats_reply_flow*)rep;
+    for (size_t i = 0; i < flows->stats_num; i++)
+      ctx->installed.insert(flows->stats[i]);
+
+    if (!(rep->flags & OFPSF_REPLY_MORE)) {
+      lg.dbg("%s holds %zu rules", e.dpid.string().c_str(),
+             ctx->installed.size());
+      flows_read(ctx);
     }
-    
+
     return CONTINUE;
   }
 
+  /* Find the message an OFPT_ERROR refers to by its xid, and send it
+   * again or give up on it.  Other datapaths are not affected. */
   Disposition
-  butterfly_app::datapath_join_handler(const Event& e0)
+  butterfly_app::error_handler(const Event& e0)
   {
-    switch (type) {
-    case MPLS_MULTICAST: {return general_join_handler(e0);}
-    case NETWORK_CODING: {return network_coding_join_handler(e0);}
-    case GREEDY_ROUTING: {return greedy_routing_join_handler(e0);}
-    case BLOOM_FILTER:   {return bloom_filter_join_handler(e0);}
-    default: {
-      lg.warn("unknown app_type (%d)", type);
+    const Ofp_msg_event& e = assert_cast <const Ofp_msg_event&> (e0);
+    struct ofl_msg_error *err = (struct ofl_msg_error*)e.msg;
+
+    dp_context *ctx = find_context(e.dpid);
+    if (ctx && ctx->stats_xid != 0 && ctx->stats_xid == e.xid) {
+      flows_failed(ctx, "failed");
       return CONTINUE;
     }
+    if (ctx && ctx->metrics)
+      ctx->metrics->rejected++;
+    b_dp_queue *q = ctx ? &ctx->queue : NULL;
+    const struct ofp_header *oh = q ? q->lookup(e.xid) : NULL;
+    if (oh == NULL) {
+      lg.warn("error (type %u, code %u) from %s for unknown xid %u",
+              err->type, err->code, e.dpid.string().c_str(), e.xid);
+      return CONTINUE;
+    }
+
+    if (q->retry(e.xid, max_send_tries)) {
+      lg.warn("%s rejected message type %u xid %u (type %u, code %u), "
+              "sending it again", e.dpid.string().c_str(), oh->type, e.xid,
+              err->type, err->code);
+      drain(e.dpid);
+    } else {
+      lg.err("%s rejected message type %u xid %u (type %u, code %u), "
+             "giving up", e.dpid.string().c_str(), oh->type, e.xid,
+             err->type, err->code);
+      if (ctx->metrics)
+        ctx->metrics->given_up++;
+    }
+
+    return CONTINUE;
+  }
+
+  Disposition
+  butterfly_app::port_status_handler(const Event& e0)
+  {
+    const Ofp_msg_event& e = assert_cast <const Ofp_msg_event&> (e0);
+    struct ofl_msg_port_status *ps = (struct ofl_msg_port_status*)e.msg;
+
+    bool up = ps->reason != OFPPR_DELETE
+      && !(ps->desc->state & OFPPS_LINK_DOWN)
+      && !(ps->desc->config & OFPPC_PORT_DOWN);
+    uint32_t from = e.dpid.as_host();
+    for (uint32_t i = links.begin(from); i < links.end(from); i++) {
+      if (links.port_no(i) == ps->desc->port_no) {
+        set_link_state(i, up);
+        break;
+      }
+    }
+
+    return CONTINUE;
+  }
+
+  /* Mark link 'i' and its opposite direction up or down, then update
+   * the datapaths at its ends. */
+  void
+  butterfly_app::set_link_state(uint32_t i, bool up)
+  {
+    if ((!links_down || !(*links_down)[i]) == up)
+      return;
+
+    std::vector<uint8_t> *down = links_down
+      ? new std::vector<uint8_t>(*links_down)
+      : new std::vector<uint8_t>(links.num_links(), 0);
+    (*down)[i] = !up;
+    if (links.reverse(i) != adjacency::no_link)
+      (*down)[links.reverse(i)] = !up;
+    links_down.reset(down);
+    lg.info("link %u-%u %s", links.source(i), links.neighbor(i),
+            up ? "up" : "down");
+
+    // The rules compiled from a path spec do not depend on the links.
+    if (type != GREEDY_ROUTING && type != BLOOM_FILTER)
+      return;
+
+    uint32_t ends[2] = { links.source(i), links.neighbor(i) };
+    for (int k = 0; k < 2; k++) {
+      std::unordered_map<uint64_t, dp_context*>::iterator c;
+      c = contexts.find(ends[k]);
+      if (c != contexts.end())
+        start_update(c->second);
     }
   }
 
@@ -561,76 +670,285 @@ namespace vigil
 	lg.dbg(" === NETWORK CODING ==== ");
         continue;
       }
+      if (strcmp(arg->c_str(), "nc_plan") == 0) {
+        nc_plan = true;
+        continue;
+      }
       if (strcmp(arg->c_str(), "greedy") == 0) {
         type = GREEDY_ROUTING;
 	lg.dbg(" === GREEDY ROUTING ==== ");
         continue;
       }
+      if (strcmp(arg->c_str(), "greedy_tables") == 0) {
+        greedy_tables = true;
+        continue;
+      }
+      if (strcmp(arg->c_str(), "reconcile") == 0) {
+        reconcile = true;
+        continue;
+      }
       if (strcmp(arg->c_str(), "bloom") == 0) {
         type = BLOOM_FILTER;
 	lg.dbg(" === BLOOM FILTERS ==== ");
         continue;
       }
+      if (strncmp(arg->c_str(), "bloom_group=", 12) == 0) {
+        bloom_group = std::min(std::max(atoi(arg->c_str() + 12), 1),
+                               max_bloom_group);
+        lg.dbg(" === %u PORTS PER BLOOM TABLE ==== ", bloom_group);
+        continue;
+      }
+      if (strncmp(arg->c_str(), "workers=", 8) == 0) {
+        num_workers = atoi(arg->c_str() + 8);
+        lg.dbg(" === %u WORKER THREADS ==== ", num_workers);
+        continue;
+      }
       if (strncmp(arg->c_str(), "links=", 6) == 0) {
-        uint32_t to_id, port_no;
-        uint64_t addr;
-        char c;
-        ifstream stream(arg->c_str() + 6);
-         if (!stream) {
-           lg.err(" error opening: %s ", arg->c_str());
-           continue;
-         }
-         while (stream) {
-           // This is very fragile.  The following format is assumed:
-           // from_id, to_id, port_no, addr_in_hex\n
-           // e.g.: 1, 5, 1, 820000700000
-           uint32_t from_id = 0;
-           stream >> dec >> from_id >> c >> to_id >> c 
-                  >> port_no >> c >> hex >> addr;
-           if (from_id == 0)
-             continue;
-           //lg.dbg("0x%.12llx, %lu", addr, from_id);
-
-           port_list_t *l;
-           if (links.find(from_id) != links.end()) {
-             l = &links[from_id];
-           } else {
-             l = new port_list_t;
-           }
-           l->push_back( make_tuple(to_id, port_no, addr) );
-           links[ from_id ] = *l;
-         }
+        // Either a binary file made by topo_convert or a CSV file
+        // (see topo_file).
+        topo_file f;
+        if (!f.load_links(arg->c_str() + 6)) {
+          lg.err(" %s ", f.error().c_str());
+          continue;
+        }
+        if (!links.build(f.links(), f.num_links())) {
+          lg.err(" node ids of %s exceed %u ", arg->c_str() + 6,
+                 adjacency::max_node_id);
+          continue;
+        }
+        lg.dbg(" %zu links loaded ", f.num_links());
+        continue;
+      }
+      if (strncmp(arg->c_str(), "paths=", 6) == 0) {
+        paths_file = arg->c_str() + 6;
+        continue;
+      }
+      if (strncmp(arg->c_str(), "metrics=", 8) == 0) {
+        metrics_file = arg->c_str() + 8;
+        continue;
+      }
+      if (strncmp(arg->c_str(), "metrics_interval=", 17) == 0) {
+        metrics_interval_s = std::max(atoi(arg->c_str() + 17), 1);
+        continue;
+      }
+      if (strncmp(arg->c_str(), "port_stats=", 11) == 0) {
+        port_stats_path = arg->c_str() + 11;
+        continue;
+      }
+      if (strncmp(arg->c_str(), "port_stats_interval=", 20) == 0) {
+        port_stats_interval_s = std::max(atoi(arg->c_str() + 20), 1);
+        continue;
+      }
+      if (strncmp(arg->c_str(), "link_history=", 13) == 0) {
+        series_depth = std::max(atoi(arg->c_str() + 13), 2);
+        continue;
       }
       if (strncmp(arg->c_str(), "coords=", 7) == 0) {
-        uint32_t x, y;
-        char c;
-        ifstream stream(arg->c_str() + 7);
-         if (!stream) {
-           lg.err(" error opening: %s ", arg->c_str());
-           continue;
-         }
-         while (stream) {
-           // This is very fragile.  The following format is assumed:
-           // node_id, x_coordinate, y_coordinate\n
-           // e.g.: 1, 2, 3
-           uint32_t node_id = 0;
-           stream >> dec >> node_id >> c >> x >> c >> y;
-           if (node_id == 0)
-             continue;
-           //lg.dbg(" %d %d %d ", node_id, x, y);
-
-           greedy_coords[ node_id ] = make_tuple(x, y);
-         }
+        topo_file f;
+        if (!f.load_coords(arg->c_str() + 7)) {
+          lg.err(" %s ", f.error().c_str());
+          continue;
+        }
+        f.fill(greedy_coords);
+        lg.dbg(" %zu coordinates loaded ", f.num_coords());
+        continue;
+      }
+    }
+
+    // Without coords= the coordinates are computed from the links
+    // (greedy_embed writes the same ones for the hosts).
+    if (type == GREEDY_ROUTING && greedy_coords.empty()
+        && links.num_links() > 0) {
+      greedy_embedding e(links);
+      if (e.compute(num_workers)) {
+        e.fill(greedy_coords);
+        lg.dbg(" %zu coordinates computed, %.2f%% of sampled pairs "
+               "delivered greedily ", greedy_coords.size(),
+               100 * e.delivery_ratio());
+      } else {
+        lg.err(" cannot compute greedy coordinates ");
       }
     }
+
+    // The spec refers to the links, which may come later among the
+    // arguments.
+    if (type == MPLS_MULTICAST || type == NETWORK_CODING) {
+      if (paths_file.empty()) {
+        lg.err(" no path spec given (paths=) ");
+        return;
+      }
+      paths = new path_compiler(links);
+      bool loaded = type == NETWORK_CODING && nc_plan
+        ? plan_coding() : paths->load(paths_file.c_str());
+      if (!loaded || !paths->compile(type == NETWORK_CODING))
+        lg.err(" cannot compile path spec %s ", paths_file.c_str());
+    }
+  }
+
+  /* Replace the coding points of the path spec with those planned by
+   * nc_planner, and load the result. */
+  bool
+  butterfly_app::plan_coding()
+  {
+    nc_planner planner(links);
+    if (!planner.load(paths_file.c_str())) {
+      lg.err(" %s ", planner.error().c_str());
+      return false;
+    }
+
+    planner.plan();
+    const std::vector<nc_planner::session>& s = planner.sessions();
+    for (size_t i = 0; i < s.size(); i++)
+      lg.dbg(" session %u: %.3f -> %.3f of a link with coding ",
+             s[i].label, s[i].plain_rate, s[i].rate);
+    lg.dbg(" %zu coding points planned ", planner.codings().size());
+
+    std::stringstream spec;
+    planner.write(spec);
+    return paths->load(spec, paths_file.c_str());
   }
   
   void butterfly_app::install()
   {
     lg.dbg(" Install called ");
 
+    rules = new join_rules(links, greedy_coords);
+    if (type == GREEDY_ROUTING && greedy_tables) {
+      rules->set_greedy_tables();
+      lg.dbg(" %zu greedy destinations ", rules->num_greedy_dests());
+    }
+    if (type == BLOOM_FILTER) {
+      rules->set_bloom_group(bloom_group);
+      bloom_enc = new bloom_encoder(links);
+    }
+
+    workers = new worker_pool(num_workers);
+    lg.dbg(" %u worker threads ", workers->size());
+
+    if (!metrics_file.empty()) {
+      metrics = new b_metrics();
+      timeval tv = { metrics_interval_s, 0 };
+      post(boost::bind(&butterfly_app::write_metrics, this), tv);
+    }
+    if (!port_stats_path.empty()) {
+      port_stats = new b_port_stats();
+      series = new link_series(links, series_depth);
+      timeval tv = { port_stats_interval_s, 0 };
+      post(boost::bind(&butterfly_app::poll_port_stats, this), tv);
+    }
+
     register_handler<Datapath_join_event>
       (boost::bind(&butterfly_app::datapath_join_handler, this, _1));
+    register_handler<Datapath_leave_event>
+      (boost::bind(&butterfly_app::datapath_leave_handler, this, _1));
+    register_handler(Ofp_msg_event::get_name(OFPT_BARRIER_REPLY),
+      boost::bind(&butterfly_app::barrier_reply_handler, this, _1));
+    register_handler(Ofp_msg_event::get_name(OFPT_ERROR),
+      boost::bind(&butterfly_app::error_handler, this, _1));
+    register_handler(Ofp_msg_event::get_name(OFPT_PORT_STATUS),
+      boost::bind(&butterfly_app::port_status_handler, this, _1));
+    register_handler(Ofp_msg_event::get_name(OFPT_STATS_REPLY),
+      boost::bind(&butterfly_app::stats_reply_handler, this, _1));
+  }
+
+  butterfly_app::~butterfly_app()
+  {
+    // Let the workers finish before their contexts go away.
+    delete workers;
+    std::unordered_map<uint64_t, dp_context*>::iterator i;
+    for (i = contexts.begin(); i != contexts.end(); i++)
+      delete i->second;
+    for (size_t j = 0; j < done_joins.size(); j++) {
+      if (done_joins[j]->left)
+        delete done_joins[j];
+    }
+    pthread_mutex_destroy(&done_mutex);
+
+    delete paths;
+    delete bloom_enc;
+    delete rules;
+    delete metrics;
+    delete port_stats;
+    delete series;
+  }
+
+  /* Timer writing the metrics file. */
+  void
+  butterfly_app::write_metrics()
+  {
+    metrics->set_gauge("butterfly_datapaths", "Datapaths connected.",
+                       contexts.size());
+    metrics->set_gauge("butterfly_running_joins",
+                       "Joins being computed.", running_joins);
+    metrics->set_gauge("butterfly_deferred_joins",
+                       "Joins put off while the queues are full.",
+                       deferred_joins.size());
+    metrics->set_gauge("butterfly_queued_bytes",
+                       "Bytes waiting to be sent to the datapaths.",
+                       queued_total);
+    if (!metrics->write(metrics_file.c_str()))
+      lg.warn(" %s ", metrics->error().c_str());
+
+    timeval tv = { metrics_interval_s, 0 };
+    post(boost::bind(&butterfly_app::write_metrics, this), tv);
+  }
+
+  /* Keep the counters of a port stats reply, or of a part of it, and
+   * the rates of the links of its ports. */
+  void
+  butterfly_app::port_stats_reply(const datapathid& dpid,
+                                  const struct ofl_msg_stats_reply_port *rep)
+  {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    port_stats_record r;
+    memset(&r, 0x00, sizeof r);
+    r.dpid    = dpid.as_host();
+    r.time_ms = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    for (size_t i = 0; i < rep->stats_num; i++) {
+      const struct ofl_port_stats *ps = rep->stats[i];
+      r.port_no    = ps->port_no;
+      r.rx_packets = ps->rx_packets;
+      r.tx_packets = ps->tx_packets;
+      r.rx_bytes   = ps->rx_bytes;
+      r.tx_bytes   = ps->tx_bytes;
+      r.rx_dropped = ps->rx_dropped;
+      r.tx_dropped = ps->tx_dropped;
+      r.rx_errors  = ps->rx_errors;
+      r.tx_errors  = ps->tx_errors;
+      port_stats->update(r);
+      series->add(r);
+    }
+  }
+
+  /* Timer publishing the port counters of the last round of replies,
+   * and asking for the next round.  A datapath busy with its rules is
+   * left out of the round. */
+  void
+  butterfly_app::poll_port_stats()
+  {
+    if (!port_stats->write(port_stats_path.c_str()))
+      lg.warn(" %s ", port_stats->error().c_str());
+
+    std::unordered_map<uint64_t, dp_context*>::iterator i;
+    for (i = contexts.begin(); i != contexts.end(); i++) {
+      dp_context *ctx = i->second;
+      if (ctx->queue.congested())
+        continue;
+      uint32_t xid = b_flow_mod::get_new_xid();
+      struct ofp_header *oh = b_port_stats_request(xid);
+      if (oh == NULL)
+        break;
+      int error = send_msg(ctx->dpid, oh);
+      free(oh);
+      if (error && error != EAGAIN)
+        lg.warn("cannot ask %s for port stats (%d)",
+                ctx->dpid.string().c_str(), error);
+    }
+
+    timeval tv = { port_stats_interval_s, 0 };
+    post(boost::bind(&butterfly_app::poll_port_stats, this), tv);
   }
 
   void butterfly_app::getInstance(const Context* c,
@@ -22,7 +22,26 @@
 
 #include "component.hh"
 #include "config.h"
+#include <deque>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <boost/shared_ptr.hpp>
+#include "bloom_encoder.hh"
+#include "greedy_embedding.hh"
+#include "join_rules.hh"
+#include "link_series.hh"
+#include "nc_planner.hh"
+#include "ofp_batch.hh"
 #include "ofp_builder.hh"
+#include "ofp_metrics.hh"
+#include "ofp_queue.hh"
+#include "ofp_rules.hh"
+#include "path_compiler.hh"
+#include "port_stats.hh"
+#include "topology.hh"
+#include "worker_pool.hh"
 
 #ifdef LOG4CXX_ENABLED
 #include <boost/format.hpp>
@@ -43,11 +62,63 @@ namespace vigil
     BLOOM_FILTER,
   };
 
-  typedef std::tuple<uint32_t, uint32_t, uint64_t> port_t;
-  typedef std::list<port_t> port_list_t;
-  typedef std::unordered_map<uint32_t, port_list_t> links_t;
-  typedef std::tuple<uint32_t, uint32_t> coord_t;
-  typedef std::unordered_map<uint32_t, coord_t> coord_map_t;
+  /* Down flags of the links of the adjacency, replaced as a whole
+   * when a port changes, so a worker can keep using the one it
+   * started with.  NULL while every link is up. */
+  typedef boost::shared_ptr<const std::vector<uint8_t> > link_state_ptr;
+
+  /* A batch of rules sent to a datapath, programmed once the switch
+   * answers its barrier request. */
+  struct dp_pending
+  {
+    uint32_t barrier_xid;
+    uint64_t start_us;  /* when its join was started */
+    size_t num_msgs;
+    size_t bytes;
+  };
+
+  /** \brief State kept per datapath.
+   *
+   * The rules of a join are computed on a worker thread, which only
+   * reads 'dpid' and 'down', and fills 'batch'.  Everything else
+   * belongs to the NOX thread.  An update is a join after a link
+   * change: only the difference from 'installed' is sent.  With
+   * reconcile, a join is an update too, 'installed' being read back
+   * from the datapath while the rules are computed.  'metrics' is
+   * NULL unless metrics are written.
+   */
+  struct dp_context
+  {
+    dp_context(const datapathid& dpid, size_t high_water,
+               size_t *total_queued)
+      : dpid(dpid), queue(high_water, total_queued), batch(0),
+        joining(false), left(false), update(false), stale(false),
+        stats_xid(0), metrics(0), compute_ns(0)
+    {}
+    ~dp_context() { delete batch; }
+
+    bool link_up(uint32_t i) const { return !down || !(*down)[i]; }
+    bool busy() const { return joining || stats_xid != 0; }
+
+    datapathid dpid;
+    b_dp_queue queue;
+    b_batch *batch;     /* rules of the join being computed */
+    bool joining;       /* a worker owns 'batch' */
+    bool left;          /* the datapath left while joining */
+    bool update;        /* the join being computed is an update */
+    bool stale;         /* a link changed while joining */
+    link_state_ptr down;
+    b_rule_set installed;
+    /* Flow stats request being answered.  A computed join waits in
+     * 'batch' for its last reply. */
+    uint32_t stats_xid;
+
+    /* Sent joins waiting for their barrier replies, oldest first. */
+    std::deque<dp_pending> pending;
+
+    b_dp_metrics *metrics;
+    uint64_t compute_ns;        /* of the last join, set by the worker */
+  };
 
   /** \brief butterfly_app
    * \ingroup noxcomponents
@@ -65,11 +136,37 @@ namespace vigil
      * @param node XML configuration (JSON object)
      */
     butterfly_app(const Context* c, const json_object* node)
-      : Component(c), type(MPLS_MULTICAST)
-    {}
+      : Component(c), type(MPLS_MULTICAST), queued_total(0),
+        workers(0), num_workers(sysconf(_SC_NPROCESSORS_ONLN)),
+        running_joins(0), collect_scheduled(false), reconcile(false),
+        greedy_tables(false), nc_plan(false), paths(0),
+        bloom_group(1), bloom_enc(0), rules(0),
+        metrics(0), metrics_interval_s(5),
+        port_stats(0), port_stats_interval_s(2), series(0),
+        series_depth(60)
+    {
+      pthread_mutex_init(&done_mutex, NULL);
+    }
+
+    ~butterfly_app();
 
     Disposition
     datapath_join_handler(const Event& e);
+
+    Disposition
+    datapath_leave_handler(const Event& e);
+
+    Disposition
+    barrier_reply_handler(const Event& e);
+
+    Disposition
+    error_handler(const Event& e);
+
+    Disposition
+    port_status_handler(const Event& e);
+
+    Disposition
+    stats_reply_handler(const Event& e);
     
     /** \brief Configure butterfly_app.
      * 
@@ -94,24 +191,116 @@ namespace vigil
     static void getInstance(const container::Context* c, 
 			    butterfly_app*& component);
 
+    /** \brief Get the encoder of multicast trees into Bloom filters.
+     *
+     * Only available in Bloom mode, NULL otherwise.  It works on the
+     * topology given by links=, and can be used from any thread.
+     */
+    bloom_encoder* get_bloom_encoder() { return bloom_enc; }
+
+    /** \brief Get the load of the links given by links=.
+     *
+     * Only available with port_stats=, NULL otherwise.  Readers never
+     * block the NOX thread feeding it, and can run on any thread.
+     */
+    const link_series* get_link_series() const { return series; }
+
   private:
     enum app_type type;
-    datapathid dp_id;
-    links_t links;
+    adjacency links;
+    link_state_ptr links_down;
     coord_map_t greedy_coords;
 
-    Disposition general_join_handler(const Event& e);
-    Disposition network_coding_join_handler(const Event& e);
-    Disposition greedy_routing_join_handler(const Event& e);
-    Disposition bloom_filter_join_handler(const Event& e);
+    /* Datapaths keyed by dpid, and the bytes waiting in all of their
+     * queues. */
+    std::unordered_map<uint64_t, dp_context*> contexts;
+    size_t queued_total;
+
+    /* Joins put off while the queues are too full. */
+    std::deque<datapathid> deferred_joins;
+
+    /* Threads computing the rules of joins.  Finished joins are
+     * handed back in 'done_joins' and picked up by collect_joins(). */
+    worker_pool *workers;
+    unsigned num_workers;
+    std::vector<dp_context*> done_joins;
+    pthread_mutex_t done_mutex;
+    size_t running_joins;
+    bool collect_scheduled;
+
+    /* With reconcile a datapath's flow tables are read before its
+     * rules are sent, and only the difference is sent. */
+    bool reconcile;
+
+    /* With greedy_tables every switch gets the decision of its
+     * greedy rule precomputed for each host as an exact match on the
+     * destination MAC, the rule itself remains below them. */
+    bool greedy_tables;
+
+    /* Rules of the MPLS and NC modes compiled from a path spec.  With
+     * nc_plan the coding points of the spec are planned anew. */
+    bool nc_plan;
+    std::string paths_file;
+    path_compiler *paths;
+
+    /* Ports tested per table in Bloom mode, see
+     * join_rules::bloom_fill_compact().  1 gives the original table
+     * per link. */
+    unsigned bloom_group;
+    bloom_encoder *bloom_enc;
+
+    /* Rules of the greedy and Bloom modes. */
+    join_rules *rules;
+
+    /* With metrics= the metrics of the datapaths are written into
+     * 'metrics_file' every 'metrics_interval_s' seconds. */
+    b_metrics *metrics;
+    std::string metrics_file;
+    long metrics_interval_s;
+
+    /* With port_stats= every datapath is asked for its port counters
+     * every 'port_stats_interval_s' seconds, and the counters are
+     * published in 'port_stats_path' (see port_stats.hh). */
+    b_port_stats *port_stats;
+    std::string port_stats_path;
+    long port_stats_interval_s;
+
+    /* Rates of the links computed from the port counters, the last
+     * 'series_depth' intervals of each. */
+    link_series *series;
+    unsigned series_depth;
 
-    void bloom_fill_table(int table_id, int port_no, uint64_t bloom_addr,
-                          uint64_t eth_addr = 0, uint32_t ip_addr = 0 );
+    dp_context* find_context(const datapathid& dpid);
+    dp_context* new_context(const datapathid& dpid);
+    void start_join(dp_context *ctx);
+    void start_update(dp_context *ctx);
+    void set_link_state(uint32_t i, bool up);
+    void compute_join(dp_context *ctx);
+    void collect_joins();
+    void finish_join(dp_context *ctx);
+    void send_rules(dp_context *ctx, b_batch *b);
+    void request_flows(dp_context *ctx);
+    void flows_read(dp_context *ctx);
+    void flows_failed(dp_context *ctx, const char *why);
+    void flow_stats_timer(const datapathid& dpid, uint32_t xid);
+    void run_deferred_joins();
+    Disposition path_join_handler(dp_context& ctx);
+    Disposition greedy_routing_join_handler(dp_context& ctx);
+    Disposition bloom_filter_join_handler(dp_context& ctx);
+    bool plan_coding();
 
     uint32_t get_new_xid();
     uint64_t hton_48(uint64_t addr);
 
-    void b_send(b_flow_mod* b);
+    void b_send(dp_context& ctx, struct ofp_header* oh);
+    int send_msg(const datapathid& dpid, const struct ofp_header* oh);
+    int send_queued(dp_context *ctx, const struct ofp_header* oh);
+    void write_metrics();
+    void poll_port_stats();
+    void port_stats_reply(const datapathid& dpid,
+                          const struct ofl_msg_stats_reply_port *rep);
+    void drain(const datapathid& dpid);
+    void drain_timer(const datapathid& dpid);
   };
 }
 
@@ -0,0 +1,133 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Check greedy routing coordinates before rolling them out:
+ *
+ *   greedy_check [-j threads] [-d destinations] [-f max_failed]
+ *                links coords
+ *
+ * 'links' is a links file, 'coords' a coordinates file (CSV or
+ * binary, see topo_convert).  Every pair of hosts is routed the way
+ * the rules of greedy_routing_join_handler() do, first without
+ * failures, then under every single and (by default) double failure
+ * of the links between switches.  -d samples the destinations.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "greedy_eval.hh"
+#include "topology.hh"
+
+using namespace vigil;
+
+static double
+percent(uint64_t a, uint64_t b)
+{
+  return b ? 100.0 * a / b : 0.0;
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned num_threads = sysconf(_SC_NPROCESSORS_ONLN), max_dests = 0;
+  unsigned max_failed = 2;
+  int c;
+
+  while ((c = getopt(argc, argv, "j:d:f:")) != -1) {
+    switch (c) {
+    case 'j': num_threads = atoi(optarg); break;
+    case 'd': max_dests = atoi(optarg); break;
+    case 'f': max_failed = atoi(optarg); break;
+    default:
+      return 1;
+    }
+  }
+  if (argc - optind != 2 || max_failed > 2) {
+    fprintf(stderr, "usage: %s [-j threads] [-d destinations] "
+            "[-f max_failed (0-2)] links coords\n", argv[0]);
+    return 1;
+  }
+
+  topo_file t, tc;
+  adjacency links;
+  if (!t.load_links(argv[optind])) {
+    fprintf(stderr, "%s\n", t.error().c_str());
+    return 1;
+  }
+  if (!links.build(t.links(), t.num_links())) {
+    fprintf(stderr, "%s: node ids exceed %u\n", argv[optind],
+            adjacency::max_node_id);
+    return 1;
+  }
+  if (!tc.load_coords(argv[optind + 1])) {
+    fprintf(stderr, "%s\n", tc.error().c_str());
+    return 1;
+  }
+
+  size_t num_nodes = links.num_links() ? links.max_node() + 1 : 0;
+  std::vector<uint32_t> xs(num_nodes, 0), ys(num_nodes, 0);
+  std::vector<uint8_t> known(num_nodes, 0);
+  for (size_t i = 0; i < tc.num_coords(); i++) {
+    const topo_coord& co = tc.coords()[i];
+    if (co.node < num_nodes) {
+      xs[co.node] = co.x;
+      ys[co.node] = co.y;
+      known[co.node] = 1;
+    }
+  }
+  unsigned missing = 0;
+  for (size_t n = 0; n < num_nodes; n++)
+    missing += links.degree(n) > 0 && !known[n];
+  if (missing)
+    fprintf(stderr, "%u nodes without coordinates, using (0, 0)\n",
+            missing);
+
+  greedy_evaluator eval(links, xs, ys);
+  for (unsigned f = 0; f <= max_failed; f++) {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    greedy_stats st = eval.run(f, num_threads, max_dests);
+    gettimeofday(&end, NULL);
+
+    uint64_t reachable = st.pairs - st.unreachable;
+    printf("%u failed links: %llu scenarios, %llu pairs, "
+           "%llu unreachable, %.3f s\n", f,
+           (unsigned long long)st.scenarios, (unsigned long long)st.pairs,
+           (unsigned long long)st.unreachable,
+           (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+    printf("  delivered %.2f%% of reachable pairs, stretch %.3f "
+           "(max %.2f), hops %.3f of shortest\n",
+           percent(st.delivered, reachable),
+           st.delivered ? st.sum_stretch / st.delivered : 0.0,
+           st.max_stretch,
+           st.shortest ? (double)st.hops / st.shortest : 0.0);
+    printf("  dead ends %.2f%%: %llu bounced to the in_port, "
+           "%llu to a wrong host, %llu loops, %llu isolated\n",
+           percent(st.dead_ends(), reachable),
+           (unsigned long long)st.bounced,
+           (unsigned long long)st.misdelivered,
+           (unsigned long long)st.loops, (unsigned long long)st.isolated);
+  }
+
+  return 0;
+}
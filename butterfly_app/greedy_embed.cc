@@ -0,0 +1,107 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Compute greedy routing coordinates for a topology:
+ *
+ *   greedy_embed [-j threads] [-d destinations] links out.csv
+ *
+ * 'links' is a links file (CSV or binary, see topo_convert).  The
+ * coordinates of every node are written to out.csv in the layout of
+ * greedy_coords.csv.  butterfly_app computes the same coordinates if
+ * it is started in greedy mode without coords=, the file is for the
+ * hosts, whose MAC addresses are made of them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "greedy_embedding.hh"
+#include "topology.hh"
+
+using namespace vigil;
+
+static const char *method_names[] = { "none", "radial tree", "PivotMDS" };
+
+int
+main(int argc, char **argv)
+{
+  unsigned num_threads = sysconf(_SC_NPROCESSORS_ONLN), max_dests = 1024;
+  int c;
+
+  while ((c = getopt(argc, argv, "j:d:")) != -1) {
+    switch (c) {
+    case 'j': num_threads = atoi(optarg); break;
+    case 'd': max_dests = atoi(optarg); break;
+    default:
+      return 1;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr, "usage: %s [-j threads] [-d destinations] "
+            "links out.csv\n", argv[0]);
+    return 1;
+  }
+
+  topo_file t;
+  adjacency links;
+  if (!t.load_links(argv[optind])) {
+    fprintf(stderr, "%s\n", t.error().c_str());
+    return 1;
+  }
+  if (!links.build(t.links(), t.num_links())) {
+    fprintf(stderr, "%s: node ids exceed %u\n", argv[optind],
+            adjacency::max_node_id);
+    return 1;
+  }
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  greedy_embedding e(links);
+  if (!e.compute(num_threads, max_dests)) {
+    fprintf(stderr, "%s: cannot embed the topology\n", argv[optind]);
+    return 1;
+  }
+  gettimeofday(&end, NULL);
+
+  printf("%s, %.2f%% of sampled pairs delivered greedily, %.3f s\n",
+         method_names[e.get_method()], 100 * e.delivery_ratio(),
+         (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+
+  const char *out = argv[optind + 1];
+  FILE *f = fopen(out, "w");
+  if (f == NULL) {
+    perror(out);
+    return 1;
+  }
+  for (uint32_t n = 0; n <= links.max_node(); n++) {
+    if (e.has_coord(n)) {
+      coord_t xy = e.coord(n);
+      fprintf(f, "%u, %u, %u\n", n, std::get<0>(xy), std::get<1>(xy));
+    }
+  }
+  if (fclose(f) != 0) {
+    perror(out);
+    return 1;
+  }
+
+  return 0;
+}
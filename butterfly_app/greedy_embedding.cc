@@ -0,0 +1,475 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "greedy_embedding.hh"
+#include "greedy_eval.hh"
+#include <algorithm>
+#include <unordered_set>
+#include <math.h>
+#include "worker_pool.hh"
+
+namespace vigil
+{
+  static const uint32_t unreached = 0xffffffff;
+  static const unsigned max_pivots = 32;
+  /* Pivots whose BFSes run at once.  Fixed, so that the pivots do not
+   * depend on the number of threads. */
+  static const unsigned pivot_batch = 8;
+
+  /* Hop distances of the switches from switch 'src' along links
+   * between switches.  'dist' is indexed like 'switches'. */
+  static void
+  switch_bfs(const adjacency& links, const std::vector<uint32_t>& switches,
+             const std::vector<uint32_t>& index, uint32_t src,
+             uint32_t *dist, std::vector<uint32_t>& queue)
+  {
+    std::fill(dist, dist + switches.size(), unreached);
+    queue.clear();
+    queue.push_back(src);
+    dist[src] = 0;
+    for (size_t q = 0; q < queue.size(); q++) {
+      uint32_t u = switches[queue[q]];
+      for (uint32_t i = links.begin(u); i < links.end(u); i++) {
+        uint32_t v = index[links.neighbor(i)];
+        if (v != unreached && dist[v] == unreached) {
+          dist[v] = dist[queue[q]] + 1;
+          queue.push_back(v);
+        }
+      }
+    }
+  }
+
+  struct bfs_job
+  {
+    const adjacency *links;
+    const std::vector<uint32_t> *switches;
+    const std::vector<uint32_t> *index;
+    const uint32_t *sources;
+    uint32_t *dist;
+    std::vector<std::vector<uint32_t> > queues;
+
+    void operator()(unsigned t, size_t i)
+    {
+      switch_bfs(*links, *switches, *index, sources[i],
+                 dist + i * switches->size(), queues[t]);
+    }
+  };
+
+  /* Accumulates B^T B of the n x k matrix 'b' in blocks of rows. */
+  struct gram_job
+  {
+    const double *b;
+    size_t n;
+    unsigned k;
+    std::vector<std::vector<double> > acc;
+
+    static const size_t block = 1024;
+
+    void operator()(unsigned t, size_t blk)
+    {
+      std::vector<double>& c = acc[t];
+      size_t last = std::min(n, (blk + 1) * block);
+      for (size_t i = blk * block; i < last; i++) {
+        const double *row = b + i * k;
+        for (unsigned p = 0; p < k; p++)
+          for (unsigned q = 0; q < k; q++)
+            c[p * k + q] += row[p] * row[q];
+      }
+    }
+  };
+
+  greedy_embedding::greedy_embedding(const adjacency& links)
+    : links(links), used(NONE), ratio(0), num_pivots(0)
+  {
+  }
+
+  void
+  greedy_embedding::classify()
+  {
+    size_t num_nodes = links.num_links() ? links.max_node() + 1 : 0;
+    kind.assign(num_nodes, ABSENT);
+    index.assign(num_nodes, unreached);
+    switches.clear();
+    for (uint32_t n = 0; n < num_nodes; n++) {
+      if (links.degree(n) == 0)
+        continue;
+      if (links.degree(n) == 1
+          && links.degree(links.neighbor(links.begin(n))) > 1) {
+        kind[n] = HOST;
+        continue;
+      }
+      kind[n] = SWITCH;
+      index[n] = switches.size();
+      switches.push_back(n);
+    }
+  }
+
+  struct farther
+  {
+    const std::vector<uint32_t>& dist;
+    farther(const std::vector<uint32_t>& dist) : dist(dist) {}
+    bool operator()(uint32_t a, uint32_t b) const
+    { return dist[a] != dist[b] ? dist[a] > dist[b] : a < b; }
+  };
+
+  /* Pivots are picked farthest first: each batch takes the switches
+   * farthest from the pivots so far (unreached ones first). */
+  void
+  greedy_embedding::pivot_bfs(unsigned num_threads)
+  {
+    size_t n = switches.size();
+    unsigned k = std::min<size_t>(n, max_pivots);
+    std::vector<uint32_t> pivots, batch, order, mindist(n, unreached);
+
+    pivot_dist.assign((size_t)k * n, unreached);
+    bfs_job job;
+    job.links = &links;
+    job.switches = &switches;
+    job.index = &index;
+    job.queues.resize(std::max(num_threads, 1u));
+
+    batch.push_back(0);
+    while (!batch.empty()) {
+      job.sources = &batch[0];
+      job.dist = &pivot_dist[pivots.size() * n];
+      parallel_for(num_threads, batch.size(), job);
+      for (size_t b = 0; b < batch.size(); b++) {
+        const uint32_t *d = job.dist + b * n;
+        for (size_t i = 0; i < n; i++)
+          mindist[i] = std::min(mindist[i], d[i]);
+        pivots.push_back(batch[b]);
+      }
+
+      batch.clear();
+      size_t want = std::min<size_t>(pivot_batch, k - pivots.size());
+      order.clear();
+      for (size_t i = 0; i < n; i++) {
+        if (mindist[i] > 0)
+          order.push_back(i);
+      }
+      want = std::min(want, order.size());
+      std::partial_sort(order.begin(), order.begin() + want, order.end(),
+                        farther(mindist));
+      batch.assign(order.begin(), order.begin() + want);
+    }
+    num_pivots = pivots.size();
+    pivot_dist.resize((size_t)num_pivots * n);
+  }
+
+  /* BFS tree around the switch with the smallest eccentricity towards
+   * the pivots.  Every subtree gets a wedge proportional to its
+   * leaves, depth is the radius.  Other components hang off the
+   * root. */
+  void
+  greedy_embedding::radial_tree(std::vector<double>& fx,
+                                std::vector<double>& fy)
+  {
+    size_t n = switches.size();
+    uint32_t root = 0, best = unreached;
+    for (size_t i = 0; i < n; i++) {
+      uint32_t ecc = 0;
+      for (unsigned p = 0; p < num_pivots; p++)
+        ecc = std::max(ecc, pivot_dist[p * n + i]);
+      if (ecc < best) {
+        best = ecc;
+        root = i;
+      }
+    }
+
+    std::vector<uint32_t> parent(n, unreached), depth(n, 0), order;
+    order.reserve(n);
+    for (size_t c = 0; c <= n; c++) {
+      uint32_t start = c == 0 ? root : c - 1;
+      if (c > 0 && (start == root || parent[start] != unreached))
+        continue;
+      parent[start] = root;
+      depth[start] = c == 0 ? 0 : 1;
+      size_t q = order.size();
+      order.push_back(start);
+      for (; q < order.size(); q++) {
+        uint32_t u = order[q];
+        for (uint32_t i = links.begin(switches[u]);
+             i < links.end(switches[u]); i++) {
+          uint32_t v = index[links.neighbor(i)];
+          if (v != unreached && v != root && parent[v] == unreached) {
+            parent[v] = u;
+            depth[v] = depth[u] + 1;
+            order.push_back(v);
+          }
+        }
+      }
+    }
+
+    std::vector<double> leaves(n, 0), a0(n, 0), a1(n, 0), cursor(n, 0);
+    for (size_t q = n; q-- > 1; ) {
+      uint32_t u = order[q];
+      leaves[u] = std::max(leaves[u], 1.0);
+      leaves[parent[u]] += leaves[u];
+    }
+    leaves[root] = std::max(leaves[root], 1.0);
+    a1[root] = 2 * M_PI;
+    for (size_t q = 0; q < n; q++)
+      cursor[order[q]] = a0[order[q]];
+    for (size_t q = 1; q < n; q++) {
+      uint32_t u = order[q], p = parent[u];
+      double w = (a1[p] - a0[p]) * leaves[u] / leaves[p];
+      a0[u] = cursor[p];
+      a1[u] = a0[u] + w;
+      cursor[p] = a1[u];
+      cursor[u] = a0[u];
+    }
+
+    fx.resize(n);
+    fy.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      double a = (a0[i] + a1[i]) / 2;
+      fx[i] = depth[i] * cos(a);
+      fy[i] = depth[i] * sin(a);
+    }
+  }
+
+  /* PivotMDS (Brandes and Pich): the double centered squared
+   * distances to the pivots (B), projected onto the top two
+   * eigenvectors of B^T B. */
+  void
+  greedy_embedding::pivot_mds(unsigned num_threads,
+                              std::vector<double>& fx,
+                              std::vector<double>& fy)
+  {
+    size_t n = switches.size();
+    unsigned k = num_pivots;
+    uint32_t far = 0;
+    for (size_t j = 0; j < pivot_dist.size(); j++) {
+      if (pivot_dist[j] != unreached)
+        far = std::max(far, pivot_dist[j]);
+    }
+
+    std::vector<double> b(n * k), row(n, 0), col(k, 0);
+    double all = 0;
+    for (size_t i = 0; i < n; i++) {
+      for (unsigned p = 0; p < k; p++) {
+        uint32_t d = pivot_dist[p * n + i];
+        double d2 = d == unreached ? (far + 1.0) * (far + 1.0)
+                                   : (double)d * d;
+        b[i * k + p] = d2;
+        row[i] += d2 / k;
+        col[p] += d2 / n;
+        all += d2;
+      }
+    }
+    all /= (double)n * k;
+    for (size_t i = 0; i < n; i++)
+      for (unsigned p = 0; p < k; p++)
+        b[i * k + p] = -0.5 * (b[i * k + p] - row[i] - col[p] + all);
+
+    gram_job job;
+    job.b = &b[0];
+    job.n = n;
+    job.k = k;
+    job.acc.assign(std::max(num_threads, 1u),
+                   std::vector<double>((size_t)k * k, 0));
+    parallel_for(num_threads, (n + gram_job::block - 1) / gram_job::block,
+                 job);
+    std::vector<double> c((size_t)k * k, 0);
+    for (size_t t = 0; t < job.acc.size(); t++)
+      for (size_t j = 0; j < c.size(); j++)
+        c[j] += job.acc[t][j];
+
+    std::vector<double>* out[2] = { &fx, &fy };
+    std::vector<double> v(k), w(k);
+    for (unsigned axis = 0; axis < 2; axis++) {
+      for (unsigned p = 0; p < k; p++)
+        v[p] = 1.0 + (p * 7 + axis * 3) % 11;
+      double lambda = 0;
+      for (unsigned iter = 0; iter < 300; iter++) {
+        double norm = 0;
+        for (unsigned p = 0; p < k; p++) {
+          w[p] = 0;
+          for (unsigned q = 0; q < k; q++)
+            w[p] += c[p * k + q] * v[q];
+          norm += w[p] * w[p];
+        }
+        norm = sqrt(norm);
+        if (norm < 1e-12)
+          break;
+        lambda = norm;
+        for (unsigned p = 0; p < k; p++)
+          v[p] = w[p] / norm;
+      }
+
+      // The singular value of B is sqrt(lambda), classical MDS scales
+      // the left singular vector by the square root of that.
+      double scale = lambda > 1e-12 ? pow(lambda, -0.25) : 0;
+      out[axis]->assign(n, 0);
+      for (size_t i = 0; i < n; i++) {
+        double s = 0;
+        for (unsigned p = 0; p < k; p++)
+          s += b[i * k + p] * v[p];
+        (*out[axis])[i] = s * scale;
+      }
+      for (unsigned p = 0; p < k; p++)
+        for (unsigned q = 0; q < k; q++)
+          c[p * k + q] -= lambda * v[p] * v[q];
+    }
+  }
+
+  static bool
+  shorter(const std::pair<int, int>& a, const std::pair<int, int>& b)
+  {
+    int la = a.first * a.first + a.second * a.second;
+    int lb = b.first * b.first + b.second * b.second;
+    return la != lb ? la < lb : a < b;
+  }
+
+  /* Scale a drawing onto a grid of cells big enough for the hosts of
+   * any switch, moving switches off occupied cells. */
+  bool
+  greedy_embedding::fit(const std::vector<double>& fx,
+                        const std::vector<double>& fy)
+  {
+    size_t n = switches.size();
+    std::vector<uint32_t> num_hosts(n, 0);
+    uint32_t most = 0;
+    for (size_t node = 0; node < kind.size(); node++) {
+      if (kind[node] == HOST) {
+        uint32_t s = index[links.neighbor(links.begin(node))];
+        most = std::max(most, ++num_hosts[s]);
+      }
+    }
+
+    // Host offsets have an even x: the lowest bit of x is the I/G bit
+    // of the MAC.
+    std::vector<std::pair<int, int> > offs;
+    int64_t cell = 8;
+    for (;; cell *= 2) {
+      int half = cell / 2 - 1;
+      offs.clear();
+      for (int dx = -half + (half & 1); dx <= half; dx += 2)
+        for (int dy = -half; dy <= half; dy++)
+          if (dx != 0 || dy != 0)
+            offs.push_back(std::make_pair(dx, dy));
+      if (offs.size() >= most)
+        break;
+    }
+    std::sort(offs.begin(), offs.end(), shorter);
+
+    int64_t grid = (1LL << greedy_coord_bits) / cell - 2;
+    if (grid < 1 || (double)grid * grid < n)
+      return false;
+
+    double min_x = fx[0], max_x = fx[0], min_y = fy[0], max_y = fy[0];
+    for (size_t i = 1; i < n; i++) {
+      min_x = std::min(min_x, fx[i]);
+      max_x = std::max(max_x, fx[i]);
+      min_y = std::min(min_y, fy[i]);
+      max_y = std::max(max_y, fy[i]);
+    }
+    double span = std::max(max_x - min_x, max_y - min_y);
+    double scale = span > 0 ? (grid - 1) / span : 0;
+
+    xs.assign(kind.size(), 0);
+    ys.assign(kind.size(), 0);
+    std::unordered_set<uint64_t> taken;
+    for (size_t i = 0; i < n; i++) {
+      int64_t cx = llround((fx[i] - min_x) * scale);
+      int64_t cy = llround((fy[i] - min_y) * scale);
+      for (int64_t r = 1; taken.count(cx << 32 | cy); r++) {
+        bool found = false;
+        for (int64_t dx = -r; dx <= r && !found; dx++) {
+          for (int64_t dy = -r; dy <= r; dy += (llabs(dx) == r ? 1 : 2 * r)) {
+            int64_t x = cx + dx, y = cy + dy;
+            if (x >= 0 && y >= 0 && x < grid && y < grid
+                && !taken.count(x << 32 | y)) {
+              cx = x;
+              cy = y;
+              found = true;
+              break;
+            }
+          }
+        }
+      }
+      taken.insert(cx << 32 | cy);
+      xs[switches[i]] = (cx + 1) * cell;
+      ys[switches[i]] = (cy + 1) * cell;
+    }
+
+    std::fill(num_hosts.begin(), num_hosts.end(), 0);
+    for (size_t node = 0; node < kind.size(); node++) {
+      if (kind[node] == HOST) {
+        uint32_t sw = links.neighbor(links.begin(node));
+        const std::pair<int, int>& o = offs[num_hosts[index[sw]]++];
+        xs[node] = xs[sw] + o.first;
+        ys[node] = ys[sw] + o.second;
+      }
+    }
+    return true;
+  }
+
+  double
+  greedy_embedding::measure(unsigned num_threads, unsigned max_dests) const
+  {
+    greedy_evaluator eval(links, xs, ys);
+    greedy_stats st = eval.run(0, num_threads, std::max(max_dests, 1u));
+    return st.pairs ? (double)st.delivered / st.pairs : 0;
+  }
+
+  bool
+  greedy_embedding::compute(unsigned num_threads, unsigned max_dests)
+  {
+    used = NONE;
+    ratio = 0;
+    classify();
+    if (switches.empty())
+      return false;
+    pivot_bfs(num_threads);
+
+    std::vector<uint32_t> best_x, best_y;
+    std::vector<double> fx, fy;
+    for (int m = RADIAL_TREE; m <= PIVOT_MDS; m++) {
+      if (m == RADIAL_TREE)
+        radial_tree(fx, fy);
+      else
+        pivot_mds(num_threads, fx, fy);
+      if (!fit(fx, fy))
+        continue;
+      double r = measure(num_threads, max_dests);
+      if (used == NONE || r > ratio) {
+        used = (enum method)m;
+        ratio = r;
+        best_x.swap(xs);
+        best_y.swap(ys);
+      }
+    }
+    xs.swap(best_x);
+    ys.swap(best_y);
+    pivot_dist.clear();
+    return used != NONE;
+  }
+
+  void
+  greedy_embedding::fill(coord_map_t& coords) const
+  {
+    for (uint32_t node = 0; node < xs.size(); node++) {
+      if (kind[node] != ABSENT)
+        coords[node] = coord_t(xs[node], ys[node]);
+    }
+  }
+} // vigil namespace
@@ -0,0 +1,112 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef greedy_embedding_HH
+#define greedy_embedding_HH
+
+#include <vector>
+#include <stdint.h>
+#include "topology.hh"
+
+namespace vigil
+{
+  /* A coordinate is packed into 24 bits of the destination MAC (see
+   * update_distance_in_metadata()), and the switch keeps the squared
+   * Euclidean distance in the upper 48 bits of the metadata, so an
+   * embedding uses 23 bits per axis. */
+  const unsigned greedy_coord_bits = 23;
+
+  /* Destination MAC of a host at (x, y), as a 48-bit number for
+   * match_eth_dst(): the low three bytes of x, least significant
+   * first, then those of y (see get_greedy_mac() in butterfly.py). */
+  inline uint64_t
+  greedy_eth_addr(uint32_t x, uint32_t y)
+  {
+    uint64_t addr = 0;
+    for (int i = 0; i < 3; i++)
+      addr = addr << 8 | ((x >> (8 * i)) & 0xff);
+    for (int i = 0; i < 3; i++)
+      addr = addr << 8 | ((y >> (8 * i)) & 0xff);
+    return addr;
+  }
+
+  /** \brief Coordinates for greedy routing computed from a topology.
+   *
+   * Switches are embedded into the plane in two ways: a spanning
+   * tree drawn radially around a central switch, and the classical
+   * MDS of the hop distances approximated from a few pivots
+   * (PivotMDS).  Each is fitted to an integer grid, its greedy
+   * delivery is measured, and the better one is kept.  Hosts (nodes
+   * of degree one) sit close to their switch at an even x, so their
+   * MAC stays a unicast address.
+   *
+   * A drawing with guaranteed greedy delivery does not exist for
+   * every topology in the Euclidean plane, hence the measurement:
+   * delivery_ratio() is the fraction of host pairs (switch pairs if
+   * there are no hosts) delivered by greedy_evaluator without
+   * failures.  At most 'max_dests' destinations are sampled.
+   *
+   * The pivots' BFSes and the measurement run on 'num_threads'
+   * threads, the result does not depend on their number.
+   */
+  class greedy_embedding
+  {
+  public:
+    greedy_embedding(const adjacency& links);
+
+    bool compute(unsigned num_threads, unsigned max_dests = 1024);
+
+    enum method { NONE, RADIAL_TREE, PIVOT_MDS };
+    enum method get_method() const { return used; }
+    double delivery_ratio() const { return ratio; }
+
+    bool has_coord(uint32_t node) const
+    { return node < xs.size() && kind[node] != ABSENT; }
+    coord_t coord(uint32_t node) const
+    { return coord_t(xs[node], ys[node]); }
+    void fill(coord_map_t& coords) const;
+
+  private:
+    enum node_kind { ABSENT, SWITCH, HOST };
+
+    const adjacency& links;
+    std::vector<uint8_t> kind;
+    std::vector<uint32_t> switches;     /* nodes of the drawing */
+    std::vector<uint32_t> index;        /* node -> index in switches */
+    std::vector<uint32_t> xs, ys;
+    enum method used;
+    double ratio;
+
+    /* Hop distances of the switches from the pivots, pivot-major. */
+    std::vector<uint32_t> pivot_dist;
+    unsigned num_pivots;
+
+    void classify();
+    void pivot_bfs(unsigned num_threads);
+    void radial_tree(std::vector<double>& fx, std::vector<double>& fy);
+    void pivot_mds(unsigned num_threads,
+                   std::vector<double>& fx, std::vector<double>& fy);
+    bool fit(const std::vector<double>& fx, const std::vector<double>& fy);
+    double measure(unsigned num_threads, unsigned max_dests) const;
+  };
+} // vigil namespace
+
+#endif
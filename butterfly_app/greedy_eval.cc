@@ -0,0 +1,423 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "greedy_eval.hh"
+#include <algorithm>
+#include <math.h>
+#include "worker_pool.hh"
+
+namespace vigil
+{
+  static const uint32_t none = 0xffffffff;
+
+  void
+  greedy_stats::add(const greedy_stats& s)
+  {
+    scenarios    += s.scenarios;
+    pairs        += s.pairs;
+    unreachable  += s.unreachable;
+    delivered    += s.delivered;
+    bounced      += s.bounced;
+    misdelivered += s.misdelivered;
+    loops        += s.loops;
+    isolated     += s.isolated;
+    hops         += s.hops;
+    shortest     += s.shortest;
+    sum_stretch  += s.sum_stretch;
+    max_stretch   = std::max(max_stretch, s.max_stretch);
+  }
+
+  /* One destination under every failure set per call.  Routes
+   * without failures are computed first; a failure set only needs
+   * new routes if a failed link is the choice of a switch, and new
+   * shortest paths if a node loses all of its shortest-path
+   * parents. */
+  struct greedy_eval_job
+  {
+    enum { IN_PROGRESS, DELIVERED, BOUNCED, MISDELIVERED, LOOP, ISOLATED };
+
+    const greedy_evaluator *e;
+    const adjacency *links;
+    std::vector<uint32_t> dests;
+    unsigned num_failed;
+
+    struct scratch
+    {
+      std::vector<uint8_t> down;
+      std::vector<uint32_t> dist, parents, queue;
+      /* Without failures: shortest paths, choices, and the fate of
+       * the packets of each source. */
+      std::vector<uint32_t> base_dist, base_parents, base_next, base_hops;
+      std::vector<uint8_t> base_result;
+      greedy_stats base_st;
+      std::vector<uint32_t> stamp, next_stamp, next, hops;
+      std::vector<uint8_t> state;
+      std::vector<uint32_t> path;
+      uint32_t epoch;
+      greedy_stats st;
+    };
+    std::vector<scratch> per_thread;
+
+    void init(unsigned num_threads)
+    {
+      size_t num_nodes = e->is_host.size();
+      per_thread.resize(num_threads);
+      for (unsigned t = 0; t < num_threads; t++) {
+        scratch& s = per_thread[t];
+        s.down.assign(links->num_links(), 0);
+        s.dist.resize(num_nodes);
+        s.parents.resize(num_nodes);
+        s.base_next.resize(num_nodes);
+        s.base_hops.resize(e->endpoints.size());
+        s.base_result.resize(e->endpoints.size());
+        s.stamp.assign(num_nodes, 0);
+        s.next_stamp.assign(num_nodes, 0);
+        s.next.resize(num_nodes);
+        s.hops.resize(num_nodes);
+        s.state.resize(num_nodes);
+        s.epoch = 0;
+        s.st = greedy_stats();
+      }
+    }
+
+    /* The k-th set of 'num_failed' failable links, in lexicographic
+     * order. */
+    void scenario(uint64_t k, uint32_t *failed) const
+    {
+      uint64_t n = e->failable.size();
+      if (num_failed == 1) {
+        failed[0] = k;
+      } else if (num_failed == 2) {
+        // Sets starting with a come after a * n - a * (a + 1) / 2 others.
+        double b = 2.0 * n - 1;
+        uint64_t a = (uint64_t)std::max(0.0,
+                                        (b - sqrt(b * b - 8.0 * k)) / 2);
+        while (a > 0 && a * n - a * (a + 1) / 2 > k)
+          a--;
+        while ((a + 1) * n - (a + 1) * (a + 2) / 2 <= k)
+          a++;
+        failed[0] = a;
+        failed[1] = a + 1 + (k - (a * n - a * (a + 1) / 2));
+      }
+    }
+
+    void set_down(scratch& s, const uint32_t *failed, uint8_t value)
+    {
+      for (unsigned f = 0; f < num_failed; f++) {
+        uint32_t i = e->failable[failed[f]];
+        s.down[i] = value;
+        if (links->reverse(i) != adjacency::no_link)
+          s.down[links->reverse(i)] = value;
+      }
+    }
+
+    /* Hop distances to 'dst' over the links that are up, and the
+     * number of neighbors one hop closer.  Hosts do not forward. */
+    void shortest_paths(scratch& s, uint32_t dst)
+    {
+      std::fill(s.dist.begin(), s.dist.end(), none);
+      std::fill(s.parents.begin(), s.parents.end(), 0);
+      s.queue.clear();
+      s.queue.push_back(dst);
+      s.dist[dst] = 0;
+      for (size_t q = 0; q < s.queue.size(); q++) {
+        uint32_t u = s.queue[q];
+        if (u != dst && e->is_host[u])
+          continue;
+        for (uint32_t i = links->begin(u); i < links->end(u); i++) {
+          uint32_t v = links->neighbor(i);
+          if (s.down[i])
+            continue;
+          if (s.dist[v] == none) {
+            s.dist[v] = s.dist[u] + 1;
+            s.queue.push_back(v);
+          }
+          if (s.dist[v] == s.dist[u] + 1)
+            s.parents[v]++;
+        }
+      }
+    }
+
+    uint32_t next_hop(scratch& s, uint32_t u, uint32_t dst)
+    {
+      if (s.next_stamp[u] == s.epoch)
+        return s.next[u];
+      const std::vector<uint32_t>& xs = e->xs;
+      const std::vector<uint32_t>& ys = e->ys;
+      int64_t tx = xs[dst], ty = ys[dst];
+      uint64_t best_d = ~0ULL;
+      uint32_t best = none;
+      for (uint32_t i = links->begin(u); i < links->end(u); i++) {
+        if (s.down[i])
+          continue;
+        uint32_t v = links->neighbor(i);
+        int64_t dx = (int64_t)xs[v] - tx, dy = (int64_t)ys[v] - ty;
+        uint64_t d = dx * dx + dy * dy;
+        if (d < best_d) {
+          best_d = d;
+          best = v;
+        }
+      }
+      s.next_stamp[u] = s.epoch;
+      s.next[u] = best;
+      return best;
+    }
+
+    /* Fate of a packet at switch 'u' heading to 'dst', given that it
+     * did not come from the neighbor 'u' chooses.  Results and hop
+     * counts of the switches passed are remembered. */
+    uint8_t walk(scratch& s, uint32_t u, uint32_t dst, uint32_t& hops)
+    {
+      uint8_t result;
+      uint32_t tail = 0;
+      s.path.clear();
+      for (;;) {
+        if (u == dst) {
+          result = DELIVERED;
+          break;
+        }
+        if (s.stamp[u] == s.epoch) {
+          result = s.state[u] == IN_PROGRESS ? (uint8_t)LOOP : s.state[u];
+          tail = s.hops[u];
+          break;
+        }
+        s.stamp[u] = s.epoch;
+        s.state[u] = IN_PROGRESS;
+        s.path.push_back(u);
+        uint32_t v = next_hop(s, u, dst);
+        if (v == dst) {
+          result = DELIVERED;
+          break;
+        }
+        if (v == none) {
+          result = ISOLATED;
+          break;
+        }
+        if (e->is_host[v]) {
+          result = MISDELIVERED;
+          break;
+        }
+        if (next_hop(s, v, dst) == u) {
+          result = BOUNCED;
+          break;
+        }
+        u = v;
+      }
+      for (size_t i = s.path.size(); i-- > 0; ) {
+        s.state[s.path[i]] = result;
+        s.hops[s.path[i]] = ++tail;
+      }
+      hops = tail;
+      return result;
+    }
+
+    void count(greedy_stats& st, uint8_t result, uint32_t hops,
+               uint32_t shortest)
+    {
+      switch (result) {
+      case DELIVERED: {
+        double stretch = (double)hops / shortest;
+        st.delivered++;
+        st.hops += hops;
+        st.shortest += shortest;
+        st.sum_stretch += stretch;
+        st.max_stretch = std::max(st.max_stretch, stretch);
+        break;
+      }
+      case BOUNCED:      st.bounced++; break;
+      case MISDELIVERED: st.misdelivered++; break;
+      case LOOP:         st.loops++; break;
+      case ISOLATED:     st.isolated++; break;
+      }
+    }
+
+    void next_epoch(scratch& s)
+    {
+      if (++s.epoch == 0) {
+        std::fill(s.stamp.begin(), s.stamp.end(), 0);
+        std::fill(s.next_stamp.begin(), s.next_stamp.end(), 0);
+        s.epoch = 1;
+      }
+    }
+
+    /* Routes all sources to 'dst' with the current failures.  With
+     * 'keep' the fate of each packet is saved as the base. */
+    void route(scratch& s, uint32_t dst, const uint32_t *dist,
+               bool reroute, bool keep, greedy_stats& st)
+    {
+      for (size_t j = 0; j < e->endpoints.size(); j++) {
+        uint32_t src = e->endpoints[j];
+        uint32_t sw = e->first[j];
+        if (src == dst)
+          continue;
+        st.pairs++;
+        if (dist[src] == none) {
+          st.unreachable++;
+          continue;
+        }
+        uint32_t hops = s.base_hops[j];
+        uint8_t result = s.base_result[j];
+        if (reroute) {
+          hops = 0;
+          if (sw != src && next_hop(s, sw, dst) == src) {
+            result = BOUNCED;
+          } else {
+            result = walk(s, sw, dst, hops);
+            hops += sw != src;
+          }
+        }
+        if (keep) {
+          s.base_hops[j] = hops;
+          s.base_result[j] = result;
+        }
+        count(st, result, hops, dist[src]);
+      }
+    }
+
+    void operator()(unsigned t, size_t d)
+    {
+      scratch& s = per_thread[t];
+      uint32_t dst = dests[d];
+      uint64_t num_scenarios = e->num_scenarios(num_failed);
+
+      next_epoch(s);
+      shortest_paths(s, dst);
+      s.base_dist = s.dist;
+      s.base_parents = s.parents;
+      for (uint32_t u = 0; u < s.base_next.size(); u++)
+        s.base_next[u] = e->is_host[u] ? none : next_hop(s, u, dst);
+      s.base_st = greedy_stats();
+      std::fill(s.base_result.begin(), s.base_result.end(), (uint8_t)LOOP);
+      route(s, dst, &s.base_dist[0], true, true, s.base_st);
+
+      for (uint64_t k = 0; k < num_scenarios; k++) {
+        uint32_t failed[2];
+        uint32_t orphans[2];
+        unsigned num_orphans = 0;
+        bool reroute = false, new_dist = false;
+
+        scenario(k, failed);
+        for (unsigned f = 0; f < num_failed; f++) {
+          uint32_t i = e->failable[failed[f]];
+          uint32_t a = links->source(i), b = links->neighbor(i);
+          if (s.base_next[a] == b || s.base_next[b] == a)
+            reroute = true;
+          uint32_t da = s.base_dist[a], db = s.base_dist[b];
+          if (da != none && db == da + 1)
+            orphans[num_orphans++] = b;
+          else if (db != none && da == db + 1)
+            orphans[num_orphans++] = a;
+        }
+        for (unsigned o = 0; o < num_orphans; o++) {
+          unsigned lost = 1 + (num_orphans == 2 && o == 0
+                               && orphans[0] == orphans[1]);
+          if (s.base_parents[orphans[o]] <= lost)
+            new_dist = true;
+        }
+
+        if (d == 0)
+          s.st.scenarios++;
+        if (!reroute && !new_dist) {
+          greedy_stats b = s.base_st;
+          b.scenarios = 0;
+          s.st.add(b);
+          continue;
+        }
+
+        set_down(s, failed, 1);
+        next_epoch(s);
+        if (new_dist)
+          shortest_paths(s, dst);
+        route(s, dst, new_dist ? &s.dist[0] : &s.base_dist[0], reroute,
+              false, s.st);
+        set_down(s, failed, 0);
+      }
+    }
+  };
+
+  greedy_evaluator::greedy_evaluator(const adjacency& links,
+                                     const std::vector<uint32_t>& xs,
+                                     const std::vector<uint32_t>& ys)
+    : links(links), xs(xs), ys(ys)
+  {
+    size_t num_nodes = links.num_links() ? links.max_node() + 1 : 0;
+    is_host.assign(num_nodes, 0);
+    for (uint32_t n = 0; n < num_nodes; n++) {
+      if (links.degree(n) == 1
+          && links.degree(links.neighbor(links.begin(n))) > 1) {
+        is_host[n] = 1;
+        endpoints.push_back(n);
+        first.push_back(links.neighbor(links.begin(n)));
+      }
+    }
+    if (endpoints.empty()) {
+      for (uint32_t n = 0; n < num_nodes; n++) {
+        if (links.degree(n) > 0)
+          endpoints.push_back(n);
+      }
+      first = endpoints;
+    }
+    for (uint32_t i = 0; i < links.num_links(); i++) {
+      uint32_t r = links.reverse(i);
+      if (!is_host[links.source(i)] && !is_host[links.neighbor(i)]
+          && (r == adjacency::no_link || i < r))
+        failable.push_back(i);
+    }
+  }
+
+  uint64_t
+  greedy_evaluator::num_scenarios(unsigned num_failed) const
+  {
+    uint64_t n = failable.size();
+    switch (num_failed) {
+    case 0:  return 1;
+    case 1:  return n;
+    case 2:  return n * (n - 1) / 2;
+    default: return 0;
+    }
+  }
+
+  greedy_stats
+  greedy_evaluator::run(unsigned num_failed, unsigned num_threads,
+                        unsigned max_dests) const
+  {
+    greedy_stats total = greedy_stats();
+    uint64_t scenarios = num_scenarios(num_failed);
+    if (endpoints.empty() || scenarios == 0)
+      return total;
+
+    greedy_eval_job job;
+    job.e = this;
+    job.links = &links;
+    job.num_failed = num_failed;
+    size_t num = endpoints.size();
+    if (max_dests > 0)
+      num = std::min<size_t>(num, max_dests);
+    for (size_t i = 0; i < num; i++)
+      job.dests.push_back(endpoints[i * endpoints.size() / num]);
+    job.init(std::max(std::min<size_t>(num_threads, num), (size_t)1));
+
+    parallel_for(num_threads, num, job);
+    for (size_t t = 0; t < job.per_thread.size(); t++)
+      total.add(job.per_thread[t].st);
+    return total;
+  }
+} // vigil namespace
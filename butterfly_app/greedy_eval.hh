@@ -0,0 +1,96 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef greedy_eval_HH
+#define greedy_eval_HH
+
+#include <vector>
+#include <stdint.h>
+#include "topology.hh"
+
+namespace vigil
+{
+  /* Outcome of greedy forwarding over source/destination pairs. */
+  struct greedy_stats
+  {
+    uint64_t scenarios;     /* failure sets tried */
+    uint64_t pairs;
+    uint64_t unreachable;   /* no path left at all */
+    uint64_t delivered;
+    uint64_t bounced;       /* sent back to the in_port: dropped */
+    uint64_t misdelivered;  /* sent to another host */
+    uint64_t loops;
+    uint64_t isolated;      /* a switch with every link down */
+    uint64_t hops;          /* of delivered pairs */
+    uint64_t shortest;      /* shortest paths of delivered pairs */
+    double sum_stretch;     /* hops / shortest of delivered pairs */
+    double max_stretch;
+
+    uint64_t dead_ends() const
+    { return bounced + misdelivered + loops + isolated; }
+    void add(const greedy_stats& s);
+  };
+
+  /** \brief Greedy routing of a coordinate set, under link failures.
+   *
+   * A switch sends a packet to the neighbor closest to its
+   * destination, the first one of its links on a tie, as the chain
+   * of update_distance_in_metadata() actions of
+   * greedy_routing_join_handler() and output_by_metadata() do.  Links
+   * that are down are skipped.  The packet is lost if the chosen
+   * neighbor is where it came from, if it is a host other than the
+   * destination, or if it comes back to a switch it has visited.
+   *
+   * Hosts (nodes of degree one) are the sources and destinations, or
+   * every node if there are none.  run() tries every pair (at most
+   * 'max_dests' destinations if it is not zero) under every set of
+   * 'num_failed' failed links between switches, both directions of a
+   * link failing together.  Stretch is measured against the shortest
+   * path that survives.  'xs' and 'ys' are indexed by node id.
+   */
+  class greedy_evaluator
+  {
+  public:
+    greedy_evaluator(const adjacency& links,
+                     const std::vector<uint32_t>& xs,
+                     const std::vector<uint32_t>& ys);
+
+    greedy_stats run(unsigned num_failed, unsigned num_threads,
+                     unsigned max_dests = 0) const;
+
+    /* Links that may fail: one direction of each switch-switch link. */
+    size_t num_failable() const { return failable.size(); }
+    uint64_t num_scenarios(unsigned num_failed) const;
+
+  private:
+    const adjacency& links;
+    const std::vector<uint32_t>& xs;
+    const std::vector<uint32_t>& ys;
+    std::vector<uint8_t> is_host;
+    std::vector<uint32_t> endpoints;    /* sources and destinations */
+    std::vector<uint32_t> first;        /* first switch of endpoints */
+    std::vector<uint32_t> failable;
+
+    friend struct greedy_eval_job;
+  };
+} // vigil namespace
+
+#endif
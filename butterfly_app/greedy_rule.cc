@@ -0,0 +1,58 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "greedy_rule.hh"
+
+namespace vigil
+{
+  void
+  greedy_rule(b_flow_mod *b, const std::vector<greedy_neighbor>& nbrs)
+  {
+    b->write_metadata( 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL );
+
+    for (size_t i = 0; i < nbrs.size(); i++) {
+      b->apply_actions()
+            ->update_distance_in_metadata( nbrs[i].x, nbrs[i].y,
+                                           nbrs[i].port_no );
+    }
+    b->write_metadata( 0x0000000000000000ULL, 0xFFFFFFFFFFFF0000ULL );
+    b->apply_actions()->output_by_metadata();
+  }
+
+  uint32_t
+  greedy_next_hop(const std::vector<greedy_neighbor>& nbrs,
+                  uint32_t x, uint32_t y)
+  {
+    int64_t tx = x, ty = y;
+    uint64_t best_d = ~0ULL;
+    uint32_t port_no = 0;
+    for (size_t i = 0; i < nbrs.size(); i++) {
+      int64_t dx = nbrs[i].x - tx, dy = nbrs[i].y - ty;
+      uint64_t d = dx * dx + dy * dy;
+      if (d < best_d) {
+        best_d = d;
+        port_no = nbrs[i].port_no;
+      }
+    }
+
+    return port_no;
+  }
+} // vigil namespace
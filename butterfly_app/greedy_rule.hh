@@ -0,0 +1,49 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef greedy_rule_HH
+#define greedy_rule_HH
+
+#include <vector>
+#include <stdint.h>
+#include "ofp_builder.hh"
+
+namespace vigil
+{
+  struct greedy_neighbor
+  {
+    uint32_t x, y;
+    uint32_t port_no;
+  };
+
+  /* Turn 'b' into the greedy rule of a switch with neighbors 'nbrs':
+   * the distance of each neighbor from the destination coordinates
+   * (in the destination MAC) is compared in the metadata, and the
+   * packet leaves on the port of the closest one. */
+  void greedy_rule(b_flow_mod *b, const std::vector<greedy_neighbor>& nbrs);
+
+  /* Port greedy_rule() picks towards (x, y): the closest neighbor,
+   * the first one on a tie.  0 if there are no neighbors. */
+  uint32_t greedy_next_hop(const std::vector<greedy_neighbor>& nbrs,
+                           uint32_t x, uint32_t y);
+} // vigil namespace
+
+#endif
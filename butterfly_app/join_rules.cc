@@ -0,0 +1,292 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "join_rules.hh"
+#include <algorithm>
+#include <inttypes.h>
+#include "greedy_embedding.hh"
+#include "greedy_rule.hh"
+
+namespace vigil
+{
+  static Vlog_module lg("butterfly_app");
+
+  join_rules::join_rules(const adjacency& links, const coord_map_t& coords)
+    : links(links), coords(coords), greedy_next_tmpl(0), bloom_group(1)
+  {
+    b_flow_mod *b;
+
+    b = new b_flow_mod();
+    b->match_eth_dst( 0, 0 );
+    b->apply_actions()->output( 0 );
+    b->instructions()->goto_table( 0 );
+    bloom_fwd_tmpl = new b_flow_template(b);
+
+    b = new b_flow_mod();
+    b->match_eth_dst( 0, 0 );
+    b->apply_actions()->set_eth_dst( 0 )
+                      ->set_ipv4_destination( 0 );
+    b->apply_actions()->output( 0 );
+    b->instructions()->goto_table( 0 );
+    bloom_host_tmpl = new b_flow_template(b);
+
+    b = new b_flow_mod();
+    b->instructions()->goto_table( 0 );
+    bloom_miss_tmpl = new b_flow_template(b);
+  }
+
+  join_rules::~join_rules()
+  {
+    delete greedy_next_tmpl;
+    delete bloom_fwd_tmpl;
+    delete bloom_host_tmpl;
+    delete bloom_miss_tmpl;
+  }
+
+  void
+  join_rules::set_greedy_tables()
+  {
+    if (greedy_next_tmpl)
+      return;
+
+    b_flow_mod *b = new b_flow_mod();
+    b->priority( OFP_DEFAULT_PRIORITY + 1 );
+    b->match_eth_dst( 0, 0 );
+    b->apply_actions()->output( 0 );
+    greedy_next_tmpl = new b_flow_template(b);
+
+    for (uint32_t n = 0; links.num_links() && n <= links.max_node(); n++) {
+      if (links.degree(n) == 1 && coords.count(n))
+        greedy_dests.push_back(n);
+    }
+  }
+
+  bool
+  join_rules::greedy(uint32_t from, const std::vector<uint8_t> *down,
+                     b_batch *batch) const
+  {
+    b_arena arena;
+
+    // Several joins may run at once: links and coords are only read,
+    // never through operator[].
+    if (links.degree(from) == 0)
+      return false;
+
+    std::vector<greedy_neighbor> nbrs;
+    for (uint32_t i = links.begin(from); i < links.end(from); i++) {
+      uint32_t to_node = links.neighbor(i);
+      if (!link_up(down, i))
+        continue;
+
+      coord_t c(0, 0);
+      coord_map_t::const_iterator ci = coords.find( to_node );
+      if (ci != coords.end())
+        c = ci->second;
+      greedy_neighbor n = { std::get<0>(c), std::get<1>(c), links.port_no(i) };
+      nbrs.push_back(n);
+    }
+
+    b_flow_mod *b = new b_flow_mod(&arena);
+    greedy_rule(b, nbrs);
+    batch->add(b);
+
+    if (!greedy_next_tmpl)
+      return true;
+
+    // The same decision per destination: the closest neighbor, the
+    // first one on a tie.
+    const b_flow_template *t = greedy_next_tmpl;
+    for (size_t j = 0; j < greedy_dests.size(); j++) {
+      const coord_t& c = coords.find( greedy_dests[j] )->second;
+      uint32_t tx = std::get<0>(c), ty = std::get<1>(c);
+      uint32_t port_no = greedy_next_hop( nbrs, tx, ty );
+
+      struct ofp_header *oh = t->build();
+      if (oh == NULL)
+        break;
+      t->match_eth_dst( oh, greedy_eth_addr( tx, ty ), 0 );
+      t->output( oh, 0, port_no );
+      batch->add(oh);
+    }
+
+    return true;
+  }
+
+  void
+  join_rules::bloom_fill_table(b_batch *batch, int table_id, int port_no,
+                               uint64_t bloom_addr, uint64_t eth_dst_addr,
+                               uint32_t ip_dst_addr) const
+  {
+    const b_flow_template *t;
+    struct ofp_header *oh;
+
+    t = eth_dst_addr ? bloom_host_tmpl : bloom_fwd_tmpl;
+    oh = t->build();
+    if (oh == NULL)
+      return;
+    t->table( oh, table_id );
+    t->match_eth_dst( oh, bloom_addr, ~bloom_addr );
+    if (eth_dst_addr) {
+      t->set_eth_dst( oh, eth_dst_addr );
+      t->set_ipv4_destination( oh, ip_dst_addr );
+    }
+    t->output( oh, 0, port_no );
+    t->goto_table( oh, table_id + 1 );
+    batch->add(oh);
+
+    bloom_fill_miss(batch, table_id);
+  }
+
+  void
+  join_rules::bloom_fill_miss(b_batch *batch, int table_id) const
+  {
+    const b_flow_template *t = bloom_miss_tmpl;
+    struct ofp_header *oh = t->build();
+    if (oh == NULL)
+      return;
+    t->table( oh, table_id );
+    t->goto_table( oh, table_id + 1 );
+    batch->add(oh);
+  }
+
+  /* Compact variant of the per-link tables: the ports are tested
+   * 'bloom_group' at a time.  A table holds an entry for every subset
+   * of its ports, matching the union of their IDs at a priority that
+   * grows with the size of the subset, so the entry taken is the one
+   * of exactly the ports whose IDs the filter covers.  Ports towards
+   * hosts come last, because the later tables see their rewrite of the
+   * destination. */
+  void
+  join_rules::bloom_fill_compact(b_batch *batch, uint32_t from,
+                                 const std::vector<uint8_t> *down) const
+  {
+    b_arena arena;
+    b_flow_mod *b;
+    std::vector<uint32_t> order;
+
+    for (uint32_t i = links.begin(from); i < links.end(from); i++) {
+      if (links.degree( links.neighbor(i) ) != 1)
+        order.push_back(i);
+    }
+    for (uint32_t i = links.begin(from); i < links.end(from); i++) {
+      if (links.degree( links.neighbor(i) ) == 1)
+        order.push_back(i);
+    }
+
+    int table_id = 1;
+    for (size_t g = 0; g < order.size(); g += bloom_group, table_id++) {
+      if (table_id >= 0xff) {
+        lg.warn("node %u: %zu ports do not fit into the tables",
+                from, order.size() - g);
+        break;
+      }
+
+      size_t n = std::min(order.size() - g, (size_t)bloom_group);
+      uint32_t down_set = 0;
+      for (size_t j = 0; j < n; j++) {
+        if (!link_up( down, order[g + j] ))
+          down_set |= 1u << j;
+      }
+      // A packet for a down port is left to the entry of the others.
+      for (uint32_t set = 1; set < (1u << n); set++) {
+        if (set & down_set)
+          continue;
+        uint64_t addr = 0;
+        for (size_t j = 0; j < n; j++) {
+          if (set & (1u << j))
+            addr |= links.addr( order[g + j] );
+        }
+
+        b = new b_flow_mod(&arena);
+        b->table( table_id );
+        b->priority( OFP_DEFAULT_PRIORITY + __builtin_popcount(set) );
+        b->match_eth_dst( addr, ~addr );
+        b_actions *a = b->apply_actions();
+        for (size_t j = 0; j < n; j++) {
+          if (!(set & (1u << j)))
+            continue;
+          uint32_t to_node = links.neighbor( order[g + j] );
+          if (links.degree( to_node ) == 1) {
+            a->set_eth_dst( links.addr( links.begin( to_node ) ) )
+             ->set_ipv4_destination( 0x0a000000 + to_node );
+          }
+          a->output( links.port_no( order[g + j] ) );
+        }
+        b->instructions()->goto_table( table_id + 1 );
+        batch->add(b);
+      }
+
+      b = new b_flow_mod(&arena);
+      b->table( table_id );
+      b->instructions()->goto_table( table_id + 1 );
+      batch->add(b);
+      arena.release();
+    }
+  }
+
+  bool
+  join_rules::bloom(uint32_t from, const std::vector<uint8_t> *down,
+                    b_batch *batch) const
+  {
+    b_arena arena;
+
+    if (links.degree(from) == 0)
+      return false;
+
+    b_flow_mod *b = new b_flow_mod(&arena);
+    b->table( 0 );
+    b->apply_actions()->decrement_ipv4_ttl();
+    b->instructions()->goto_table( 1 );
+    batch->add(b);
+
+    if (bloom_group > 1) {
+      bloom_fill_compact(batch, from, down);
+      return true;
+    }
+
+    int num_links = 0;
+    for (uint32_t i = links.begin(from); i < links.end(from); i++) {
+      uint32_t to_node = links.neighbor(i);
+      uint32_t port_no = links.port_no(i);
+      uint64_t addr    = links.addr(i);
+
+      lg.dbg("flowmod: %d, %d, 0x%" PRIx64, to_node, port_no, addr);
+
+      // Tables keep their numbers while a link is down.
+      if (!link_up(down, i)) {
+        bloom_fill_miss( batch, ++num_links );
+        continue;
+      }
+
+      uint64_t host_eth = 0;
+      uint32_t host_ip  = 0;
+      if (links.degree( to_node ) == 1) {
+        host_eth = links.addr( links.begin( to_node ) );
+        host_ip  = 0x0a000000 + to_node;  // assuming: 10.0.0.id
+      }
+
+      bloom_fill_table( batch, ++num_links, port_no, addr, host_eth,
+                        host_ip );
+    }
+
+    return true;
+  }
+} // vigil namespace
@@ -0,0 +1,94 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef join_rules_HH
+#define join_rules_HH
+
+#include <vector>
+#include <stdint.h>
+#include "ofp_batch.hh"
+#include "ofp_builder.hh"
+#include "topology.hh"
+
+namespace vigil
+{
+  /** \brief Rules of a joining datapath in greedy and Bloom mode.
+   *
+   * The rules only depend on the adjacency (and on the coordinates
+   * of the nodes in greedy mode), so they are built here, apart from
+   * the NOX component, and offline tools like rule_bench build the
+   * same messages as the controller.  The rules of the MPLS and NC
+   * modes come from path_compiler.
+   *
+   * 'down' has a flag per link of the adjacency, or is NULL if every
+   * link is up.  Once set up, the object is only read: several
+   * threads may fill batches at once.
+   */
+  class join_rules
+  {
+  public:
+    join_rules(const adjacency& links, const coord_map_t& coords);
+    ~join_rules();
+
+    /* Add the decision of the greedy rule for each host as an exact
+     * match on its MAC, above the rule itself.  Hosts are the nodes
+     * with a single link and coordinates. */
+    void set_greedy_tables();
+    /* Test 'n' ports per Bloom table instead of one. */
+    void set_bloom_group(unsigned n) { bloom_group = n; }
+
+    size_t num_greedy_dests() const { return greedy_dests.size(); }
+
+    /* Queue the rules of 'node' into 'b'.  False if the node has no
+     * links. */
+    bool greedy(uint32_t node, const std::vector<uint8_t> *down,
+                b_batch *b) const;
+    bool bloom(uint32_t node, const std::vector<uint8_t> *down,
+               b_batch *b) const;
+
+  private:
+    const adjacency& links;
+    const coord_map_t& coords;
+
+    std::vector<uint32_t> greedy_dests;
+    b_flow_template *greedy_next_tmpl;
+
+    unsigned bloom_group;
+    b_flow_template *bloom_fwd_tmpl;
+    b_flow_template *bloom_host_tmpl;
+    b_flow_template *bloom_miss_tmpl;
+
+    static bool link_up(const std::vector<uint8_t> *down, uint32_t i)
+    { return !down || !(*down)[i]; }
+
+    void bloom_fill_table(b_batch *b, int table_id, int port_no,
+                          uint64_t bloom_addr, uint64_t eth_addr,
+                          uint32_t ip_addr) const;
+    void bloom_fill_miss(b_batch *b, int table_id) const;
+    void bloom_fill_compact(b_batch *b, uint32_t from,
+                            const std::vector<uint8_t> *down) const;
+
+    join_rules(const join_rules&);
+    join_rules& operator=(const join_rules&);
+  };
+} // vigil namespace
+
+#endif
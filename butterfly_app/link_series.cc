@@ -0,0 +1,179 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "link_series.hh"
+#include <algorithm>
+#include <cmath>
+
+namespace vigil
+{
+  link_series::link_series(const adjacency& links, unsigned depth,
+                           double alpha)
+    : links(links), ring_len(depth ? depth : 1), alpha(alpha)
+  {
+    link_state st = link_state();
+    series.assign(links.num_links(), st);
+    last.assign(series.size(), counters());
+    ring.resize(series.size() * ring_len);
+
+    for (uint32_t i = 0; i < links.num_links(); i++)
+      by_port[(uint64_t)links.source(i) << 32 | links.port_no(i)] = i;
+  }
+
+  bool
+  link_series::add(const port_stats_record& r)
+  {
+    if (r.dpid > adjacency::max_node_id)
+      return false;
+    std::unordered_map<uint64_t, uint32_t>::const_iterator it =
+      by_port.find(r.dpid << 32 | r.port_no);
+    if (it == by_port.end())
+      return false;
+
+    uint32_t i = it->second;
+    add_sample(i, r.time_ms, r.tx_packets, r.tx_bytes);
+
+    uint32_t j = links.reverse(i);
+    if (j != adjacency::no_link && links.degree( links.source(j) ) == 1)
+      add_sample(j, r.time_ms, r.rx_packets, r.rx_bytes);
+    return true;
+  }
+
+  void
+  link_series::add_sample(uint32_t link, uint64_t time_ms,
+                          uint64_t packets, uint64_t bytes)
+  {
+    link_state& st = series[link];
+    counters& c = last[link];
+
+    if (c.valid && time_ms <= c.time_ms)
+      return;                   // a late or repeated reply
+    if (c.valid && packets >= c.packets && bytes >= c.bytes) {
+      double dt = (time_ms - c.time_ms) / 1000.0;
+      rates r = { time_ms, (packets - c.packets) / dt,
+                  (bytes - c.bytes) / dt };
+
+      // Odd while the readers' part of the link is inconsistent.
+      __sync_add_and_fetch(&st.seq, 1);
+      ring[(size_t)link * ring_len + st.head] = r;
+      st.head = (st.head + 1) % ring_len;
+      if (st.count == 0) {
+        st.ewma_pps = r.pps;
+        st.ewma_bytes_ps = r.bytes_ps;
+      } else {
+        st.ewma_pps += alpha * (r.pps - st.ewma_pps);
+        st.ewma_bytes_ps += alpha * (r.bytes_ps - st.ewma_bytes_ps);
+      }
+      if (st.count < ring_len)
+        st.count++;
+      __sync_add_and_fetch(&st.seq, 1);
+    }
+
+    c.valid = true;
+    c.time_ms = time_ms;
+    c.packets = packets;
+    c.bytes = bytes;
+  }
+
+  /* Copy the state of a link and either its whole ring or only its
+   * newest slot, consistently with each other. */
+  bool
+  link_series::read(uint32_t link, link_state& st, rates *slots,
+                    bool all) const
+  {
+    if (link >= series.size())
+      return false;
+
+    const link_state& s = series[link];
+    const rates *r = &ring[(size_t)link * ring_len];
+    for (;;) {
+      uint32_t seq = *(volatile const uint32_t *)&s.seq;
+      if (seq & 1)
+        continue;
+      __sync_synchronize();
+      st.head = s.head;
+      st.count = s.count;
+      st.ewma_pps = s.ewma_pps;
+      st.ewma_bytes_ps = s.ewma_bytes_ps;
+      if (all)
+        std::copy(r, r + ring_len, slots);
+      else
+        slots[0] = r[(st.head + ring_len - 1) % ring_len];
+      __sync_synchronize();
+      if (*(volatile const uint32_t *)&s.seq == seq)
+        break;
+    }
+    return st.count != 0;
+  }
+
+  bool
+  link_series::get(uint32_t link, summary& s) const
+  {
+    link_state st;
+    if (!read(link, st, &s.last, false))
+      return false;
+    s.ewma_pps = st.ewma_pps;
+    s.ewma_bytes_ps = st.ewma_bytes_ps;
+    s.samples = st.count;
+    return true;
+  }
+
+  bool
+  link_series::percentile(uint32_t link, double p, rates& r) const
+  {
+    link_state st;
+    std::vector<rates> slots(ring_len);
+    if (!read(link, st, &slots[0], true))
+      return false;
+
+    std::vector<double> pps, bytes_ps;
+    for (uint32_t k = 0; k < st.count; k++) {
+      const rates& x = slots[(st.head + ring_len - 1 - k) % ring_len];
+      pps.push_back(x.pps);
+      bytes_ps.push_back(x.bytes_ps);
+    }
+
+    // Nearest rank.
+    size_t rank = p > 0 ? (size_t)std::ceil(p / 100 * st.count) : 0;
+    size_t n = rank ? std::min(rank, pps.size()) - 1 : 0;
+    std::nth_element(pps.begin(), pps.begin() + n, pps.end());
+    std::nth_element(bytes_ps.begin(), bytes_ps.begin() + n,
+                     bytes_ps.end());
+    r.time_ms = slots[(st.head + ring_len - 1) % ring_len].time_ms;
+    r.pps = pps[n];
+    r.bytes_ps = bytes_ps[n];
+    return true;
+  }
+
+  size_t
+  link_series::history(uint32_t link, rates *out, size_t max) const
+  {
+    link_state st;
+    std::vector<rates> slots(ring_len);
+    if (!read(link, st, &slots[0], true))
+      return 0;
+
+    size_t n = std::min((size_t)st.count, max);
+    for (size_t k = 0; k < n; k++)
+      out[k] = slots[(st.head + ring_len - 1 - k) % ring_len];
+    return n;
+  }
+} // vigil namespace
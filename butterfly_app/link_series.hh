@@ -0,0 +1,120 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef link_series_HH
+#define link_series_HH
+
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "port_stats.hh"
+#include "topology.hh"
+
+namespace vigil
+{
+  /** \brief Time series of the load of the links of an adjacency.
+   *
+   * The port counters of the datapaths (port_stats_record, the dpid
+   * being the node id) are turned into rates over the interval since
+   * the previous sample of the same port.  The transmit counters of a
+   * port belong to its link, the receive counters to the opposite
+   * direction if that starts at a host, since hosts report nothing.
+   * A counter going backwards (a reconnected switch) starts over.
+   *
+   * Each link keeps the rates of its last 'depth' intervals in a
+   * ring, and their exponentially weighted moving average with weight
+   * 'alpha' for the newest one.  One thread adds samples; any number
+   * of threads may read at the same time without blocking it: every
+   * link has a sequence number that is odd while the link is being
+   * written, and a reader copies the link again if it changed.
+   * get() costs O(1), percentile() and history() O(depth).
+   */
+  class link_series
+  {
+  public:
+    struct rates
+    {
+      uint64_t time_ms;         /* end of the interval */
+      double pps;               /* packets per second */
+      double bytes_ps;          /* bytes per second */
+    };
+
+    struct summary
+    {
+      rates last;
+      double ewma_pps;
+      double ewma_bytes_ps;
+      unsigned samples;         /* intervals in the ring */
+    };
+
+    link_series(const adjacency& links, unsigned depth = 60,
+                double alpha = 0.25);
+
+    /* Writer.  False if the port is not on a link. */
+    bool add(const port_stats_record& r);
+
+    /* Readers.  False while the link has no interval yet. */
+    bool get(uint32_t link, summary& s) const;
+    /* The 'p'th percentile (0-100) of the packet and of the byte
+     * rates in the ring, each on its own. */
+    bool percentile(uint32_t link, double p, rates& r) const;
+    /* Up to 'max' intervals, the newest first. */
+    size_t history(uint32_t link, rates *out, size_t max) const;
+
+    size_t num_links() const { return series.size(); }
+    unsigned depth() const { return ring_len; }
+
+  private:
+    struct counters
+    {
+      bool valid;
+      uint64_t time_ms;
+      uint64_t packets;
+      uint64_t bytes;
+    };
+
+    /* Written by the writer only, inside the odd window of 'seq'.
+     * Readers copy everything but 'seq', and the ring. */
+    struct link_state
+    {
+      uint32_t seq;
+      uint32_t head;            /* next slot of the ring */
+      uint32_t count;
+      double ewma_pps;
+      double ewma_bytes_ps;
+    };
+
+    const adjacency& links;
+    unsigned ring_len;
+    double alpha;
+    std::vector<link_state> series;
+    std::vector<counters> last; /* of each link, the writer's only */
+    std::vector<rates> ring;    /* ring_len slots per link */
+    std::unordered_map<uint64_t, uint32_t> by_port;
+
+    void add_sample(uint32_t link, uint64_t time_ms, uint64_t packets,
+                    uint64_t bytes);
+    bool read(uint32_t link, link_state& st, rates *slots,
+              bool all) const;
+  };
+} // vigil namespace
+
+#endif
@@ -0,0 +1,95 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Plan XOR network coding for multicast sessions:
+ *
+ *   nc_plan links sessions out.txt
+ *
+ * 'links' is a links file (CSV or binary, see topo_convert),
+ * 'sessions' a path spec whose sessions may be given by their hosts
+ * (see nc_planner).  The spec written to out.txt has the coding
+ * points, and can be given to the controller as paths= in nc mode.
+ * The expected throughput of each session is printed, as a share of
+ * a link, without and with coding.
+ */
+
+#include <stdio.h>
+#include <fstream>
+#include "nc_planner.hh"
+#include "topology.hh"
+
+using namespace vigil;
+
+int
+main(int argc, char **argv)
+{
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s links sessions out.txt\n", argv[0]);
+    return 1;
+  }
+
+  topo_file t;
+  adjacency links;
+  if (!t.load_links(argv[1])) {
+    fprintf(stderr, "%s\n", t.error().c_str());
+    return 1;
+  }
+  if (!links.build(t.links(), t.num_links())) {
+    fprintf(stderr, "%s: node ids exceed %u\n", argv[1],
+            adjacency::max_node_id);
+    return 1;
+  }
+
+  nc_planner planner(links);
+  if (!planner.load(argv[2])) {
+    fprintf(stderr, "%s\n", planner.error().c_str());
+    return 1;
+  }
+  planner.plan();
+
+  const std::vector<nc_planner::coding>& codes = planner.codings();
+  for (size_t i = 0; i < codes.size(); i++)
+    printf("coding at %u: sessions %u and %u, labels %u-%u\n",
+           codes[i].encoder, codes[i].a, codes[i].b, codes[i].coded,
+           codes[i].decoded_b);
+
+  const std::vector<nc_planner::session>& sess = planner.sessions();
+  double plain = 0, coded = 0;
+  for (size_t i = 0; i < sess.size(); i++) {
+    printf("session %u: %.3f -> %.3f, gain %.2f\n", sess[i].label,
+           sess[i].plain_rate, sess[i].rate,
+           sess[i].rate / sess[i].plain_rate);
+    plain += sess[i].plain_rate;
+    coded += sess[i].rate;
+  }
+  printf("total: %.3f -> %.3f, gain %.2f\n", plain, coded,
+         plain ? coded / plain : 1.0);
+
+  std::ofstream out(argv[3]);
+  planner.write(out);
+  out.close();
+  if (!out) {
+    fprintf(stderr, "cannot write %s\n", argv[3]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,393 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "nc_planner.hh"
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <tuple>
+#include <boost/bind.hpp>
+
+namespace vigil
+{
+  /* Largest label of a 20-bit MPLS label field. */
+  static const uint32_t max_mpls_label = 0xfffff;
+  /* Gains smaller than this are rounding errors. */
+  static const double min_gain = 1e-9;
+
+  static void
+  sort_unique(std::vector<uint32_t>& v)
+  {
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+  }
+
+  static double
+  sum(const std::vector<double>& v)
+  {
+    double s = 0;
+    for (size_t i = 0; i < v.size(); i++)
+      s += v[i];
+    return s;
+  }
+
+  nc_planner::nc_planner(const adjacency& links)
+    : links(links)
+  {
+  }
+
+  bool
+  nc_planner::load(const char *filename)
+  {
+    sess.clear();
+    returns.clear();
+    codes.clear();
+    err.clear();
+
+    std::ifstream stream(filename);
+    if (!stream) {
+      err = std::string("cannot open ") + filename;
+      return false;
+    }
+
+    std::set<uint32_t> labels;
+    return read_path_spec(stream, filename,
+                          boost::bind(&nc_planner::add_line, this,
+                                      boost::ref(labels), _1, _2, _3),
+                          err);
+  }
+
+  /* Coding points of the spec are ignored, plan() finds its own. */
+  bool
+  nc_planner::add_line(std::set<uint32_t>& labels, const path_spec_line& l,
+                       std::istream& rest, std::string& why)
+  {
+    if (l.keyword == "session") {
+      session s;
+      s.label = l.label;
+      s.paths = l.paths;
+      for (size_t j = 0; j < s.paths.size(); j++) {
+        const path_t& p = s.paths[j];
+        for (size_t i = 0; i + 1 < p.size(); i++) {
+          if (links.link_to(p[i], p[i + 1]) == adjacency::no_link)
+            return false;
+        }
+      }
+      if (!labels.insert(s.label).second)
+        return false;
+      sess.push_back(s);
+    } else if (l.keyword == "group") {
+      session s;
+      std::string word;
+      uint32_t source, receiver;
+      std::vector<uint32_t> receivers;
+      bool good = (rest >> s.label >> word) && s.label != 0
+        && parse_node(word, source);
+      while (good && (rest >> word)) {
+        good = parse_node(word, receiver);
+        receivers.push_back(receiver);
+      }
+      good = good && !receivers.empty() && labels.insert(s.label).second
+        && route(s.label, source, receivers, s, why);
+      if (!good)
+        return false;
+      sess.push_back(s);
+    } else if (l.keyword == "return") {
+      returns.push_back(l.paths[0]);
+    } else if (l.keyword != "code") {
+      return false;
+    }
+    return true;
+  }
+
+  /* Shortest paths from 'source' to 'receivers' that only cross
+   * switches, the first link of a node winning a tie. */
+  bool
+  nc_planner::route(uint32_t label, uint32_t source,
+                    const std::vector<uint32_t>& receivers, session& s,
+                    std::string& why)
+  {
+    if (source > links.max_node() || links.degree(source) != 1) {
+      why = "the source is not a host";
+      return false;
+    }
+
+    std::vector<uint32_t> parent(links.max_node() + 1, adjacency::no_link);
+    std::vector<uint8_t> seen(links.max_node() + 1, 0);
+    std::deque<uint32_t> queue(1, source);
+    seen[source] = 1;
+    while (!queue.empty()) {
+      uint32_t n = queue.front();
+      queue.pop_front();
+      if (n != source && links.degree(n) == 1)
+        continue;
+      for (uint32_t i = links.begin(n); i < links.end(n); i++) {
+        uint32_t m = links.neighbor(i);
+        if (!seen[m]) {
+          seen[m] = 1;
+          parent[m] = i;
+          queue.push_back(m);
+        }
+      }
+    }
+
+    s.label = label;
+    s.paths.clear();
+    for (size_t r = 0; r < receivers.size(); r++) {
+      uint32_t n = receivers[r];
+      if (n > links.max_node() || !seen[n] || n == source) {
+        why = "a receiver cannot be reached";
+        return false;
+      }
+      path_t p;
+      for (; n != source; n = links.source(parent[n]))
+        p.push_back(n);
+      p.push_back(source);
+      std::reverse(p.begin(), p.end());
+      if (p.size() < 4) {
+        why = "a receiver is behind the ingress switch";
+        return false;
+      }
+      s.paths.push_back(p);
+    }
+
+    return true;
+  }
+
+  /* Whether path_compiler::compile(true) can code sessions 'a' and
+   * 'b' at 'encoder'. */
+  bool
+  nc_planner::valid(uint32_t encoder, size_t a, size_t b) const
+  {
+    if (links.degree(encoder) < 2)
+      return false;
+
+    const size_t pair[] = { a, b };
+    for (int x = 0; x < 2; x++) {
+      const session& s = sess[pair[x]];
+      const session& other = sess[pair[1 - x]];
+      bool crosses = false;
+
+      for (size_t i = 0; i < s.paths.size(); i++) {
+        const path_t& p = s.paths[i];
+        size_t last = p.size() - 2;
+        size_t e = std::find(p.begin(), p.end(), encoder) - p.begin();
+        if (e == p.size())
+          continue;
+        // The ingress pushes the labels, the egress pops them.
+        if (e < 2 || e >= last)
+          return false;
+        crosses = true;
+
+        // The decoder needs the plain packet of the other session.
+        bool side = false;
+        for (size_t j = 0; !side && j < other.paths.size(); j++) {
+          const path_t& q = other.paths[j];
+          side = q[q.size() - 2] == p[last] && q.back() == p.back()
+            && std::find(q.begin(), q.end(), encoder) == q.end();
+        }
+        if (!side)
+          return false;
+      }
+      if (!crosses)
+        return false;
+    }
+
+    return true;
+  }
+
+  /* Links between switches that session 's' uses plain and those it
+   * shares as the coded flow after 'encoder', both sorted. */
+  void
+  nc_planner::session_links(size_t s, uint32_t encoder,
+                            std::vector<uint32_t>& plain,
+                            std::vector<uint32_t>& coded) const
+  {
+    plain.clear();
+    coded.clear();
+    for (size_t i = 0; i < sess[s].paths.size(); i++) {
+      const path_t& p = sess[s].paths[i];
+      size_t last = p.size() - 2;
+      size_t e = std::find(p.begin(), p.end(), encoder) - p.begin();
+      for (size_t h = 1; h < last; h++) {
+        uint32_t l = links.link_to(p[h], p[h + 1]);
+        (h >= e ? coded : plain).push_back(l);
+      }
+    }
+    sort_unique(plain);
+    sort_unique(coded);
+  }
+
+  /* Flows per link and rate per session with the coding points of
+   * 'pairs'. */
+  void
+  nc_planner::rates(const std::vector<code_pair>& pairs,
+                    std::vector<uint32_t>& load,
+                    std::vector<double>& rate) const
+  {
+    std::vector<uint32_t> encoder(sess.size(), adjacency::no_link);
+    for (size_t i = 0; i < pairs.size(); i++)
+      encoder[pairs[i].a] = encoder[pairs[i].b] = pairs[i].encoder;
+
+    std::vector<std::vector<uint32_t> > plain(sess.size());
+    std::vector<std::vector<uint32_t> > coded(sess.size());
+    load.assign(links.num_links(), 0);
+    for (size_t s = 0; s < sess.size(); s++) {
+      session_links(s, encoder[s], plain[s], coded[s]);
+      for (size_t i = 0; i < plain[s].size(); i++)
+        load[plain[s][i]]++;
+    }
+    for (size_t i = 0; i < pairs.size(); i++) {
+      const std::vector<uint32_t>& a = coded[pairs[i].a];
+      const std::vector<uint32_t>& b = coded[pairs[i].b];
+      std::vector<uint32_t> both;
+      std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+                     std::back_inserter(both));
+      for (size_t j = 0; j < both.size(); j++)
+        load[both[j]]++;
+    }
+
+    rate.assign(sess.size(), 1.0);
+    for (size_t s = 0; s < sess.size(); s++) {
+      for (size_t i = 0; i < plain[s].size(); i++)
+        rate[s] = std::min(rate[s], 1.0 / load[plain[s][i]]);
+      for (size_t i = 0; i < coded[s].size(); i++)
+        rate[s] = std::min(rate[s], 1.0 / load[coded[s][i]]);
+    }
+  }
+
+  size_t
+  nc_planner::plan()
+  {
+    std::vector<code_pair> pairs;
+    std::vector<uint32_t> load, trial_load;
+    std::vector<double> rate, trial_rate;
+    std::vector<uint8_t> paired(sess.size(), 0);
+    std::vector<std::vector<uint32_t> > used(sess.size());
+    std::vector<uint32_t> unused;
+    uint32_t next_label = 1;
+
+    codes.clear();
+    for (size_t s = 0; s < sess.size(); s++) {
+      session_links(s, adjacency::no_link, used[s], unused);
+      next_label = std::max(next_label, sess[s].label + 1);
+    }
+    rates(pairs, load, rate);
+    for (size_t s = 0; s < sess.size(); s++)
+      sess[s].plain_rate = rate[s];
+
+    while (next_label + 4 <= max_mpls_label) {
+      // Coding pays off where two sessions share a link.
+      std::vector<std::vector<size_t> > on_link(links.num_links());
+      for (size_t s = 0; s < sess.size(); s++) {
+        for (size_t i = 0; !paired[s] && i < used[s].size(); i++)
+          on_link[used[s][i]].push_back(s);
+      }
+
+      std::set<std::tuple<uint32_t, size_t, size_t> > tried;
+      double best_gain = min_gain;
+      code_pair best = { 0, 0, 0 };
+      bool found = false;
+      for (uint32_t l = 0; l < on_link.size(); l++) {
+        const std::vector<size_t>& on = on_link[l];
+        for (size_t i = 0; on.size() > 1 && i < on.size(); i++) {
+          for (size_t j = i + 1; j < on.size(); j++) {
+            code_pair c = { links.source(l), on[i], on[j] };
+            if (!tried.insert(std::make_tuple(c.encoder, c.a, c.b)).second
+                || !valid(c.encoder, c.a, c.b))
+              continue;
+
+            pairs.push_back(c);
+            rates(pairs, trial_load, trial_rate);
+            pairs.pop_back();
+            bool worse = false;
+            for (size_t s = 0; !worse && s < sess.size(); s++)
+              worse = trial_rate[s] < rate[s] - min_gain;
+            double gain = sum(trial_rate) - sum(rate);
+            if (!worse && gain > best_gain) {
+              best_gain = gain;
+              best = c;
+              found = true;
+            }
+          }
+        }
+      }
+      if (!found)
+        break;
+
+      pairs.push_back(best);
+      paired[best.a] = paired[best.b] = 1;
+      rates(pairs, load, rate);
+
+      coding c;
+      c.encoder   = best.encoder;
+      c.a         = sess[best.a].label;
+      c.b         = sess[best.b].label;
+      c.coded     = next_label;
+      c.plain_a   = next_label + 1;
+      c.plain_b   = next_label + 2;
+      c.decoded_a = next_label + 3;
+      c.decoded_b = next_label + 4;
+      next_label += 5;
+      codes.push_back(c);
+    }
+
+    for (size_t s = 0; s < sess.size(); s++)
+      sess[s].rate = rate[s];
+
+    return codes.size();
+  }
+
+  void
+  nc_planner::write_path(std::ostream& out, const path_t& p) const
+  {
+    for (size_t i = 0; i < p.size(); i++)
+      out << (i ? "-" : "") << (links.degree(p[i]) == 1 ? "h" : "s") << p[i];
+  }
+
+  void
+  nc_planner::write(std::ostream& out) const
+  {
+    out << "# " << sess.size() << " sessions, " << codes.size()
+        << " coding points planned by nc_planner\n";
+    for (size_t i = 0; i < sess.size(); i++) {
+      out << "session " << sess[i].label;
+      for (size_t j = 0; j < sess[i].paths.size(); j++) {
+        out << " ";
+        write_path(out, sess[i].paths[j]);
+      }
+      out << "\n";
+    }
+    for (size_t i = 0; i < returns.size(); i++) {
+      out << "return ";
+      write_path(out, returns[i]);
+      out << "\n";
+    }
+    for (size_t i = 0; i < codes.size(); i++) {
+      const coding& c = codes[i];
+      out << "code s" << c.encoder << " " << c.a << " " << c.b << " "
+          << c.coded << " " << c.plain_a << " " << c.plain_b << " "
+          << c.decoded_a << " " << c.decoded_b << "\n";
+    }
+  }
+} // vigil namespace
@@ -0,0 +1,121 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef nc_planner_HH
+#define nc_planner_HH
+
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "topology.hh"
+
+namespace vigil
+{
+  /** \brief Planner of XOR network coding for multicast sessions.
+   *
+   * The input is a path spec (see path_compiler) whose 'session'
+   * lines give the paths of the sessions.  A session may also be
+   * given by its hosts, and is then routed along the shortest path
+   * tree of its source:
+   *
+   *   group <label> <source> <receiver> [<receiver> ...]
+   *
+   * 'return' lines are kept, 'code' lines are replaced by the plan.
+   *
+   * Throughput is estimated by sharing the capacity of each link
+   * between switches equally among the flows crossing it; access
+   * links are not counted.  A session gets the smallest share along
+   * its paths.  A coding point pairs two sessions at an encoder
+   * switch, after which the two become one coded flow.  It is only
+   * valid if path_compiler::compile(true) can decode it: every path
+   * of either session through the encoder must end at an egress
+   * switch that the other session reaches without the encoder,
+   * towards the same host.
+   *
+   * plan() keeps adding the valid coding point that raises the total
+   * throughput the most, as long as no session loses by it.  Each
+   * coding point gets five fresh labels above those of the sessions.
+   * write() emits the planned path spec.  Errors are returned by
+   * error().
+   */
+  class nc_planner
+  {
+  public:
+    typedef std::vector<uint32_t> path_t;
+
+    struct session
+    {
+      uint32_t label;
+      std::vector<path_t> paths;
+      double plain_rate;        /* share of a link without coding */
+      double rate;              /* with the coding points planned */
+    };
+
+    struct coding
+    {
+      uint32_t encoder;
+      uint32_t a, b;            /* labels of the sessions */
+      uint32_t coded, plain_a, plain_b, decoded_a, decoded_b;
+    };
+
+    nc_planner(const adjacency& links);
+
+    bool load(const char *filename);
+    /* Number of coding points. */
+    size_t plan();
+    void write(std::ostream& out) const;
+
+    const std::vector<session>& sessions() const { return sess; }
+    const std::vector<coding>& codings() const { return codes; }
+    const std::string& error() const { return err; }
+
+  private:
+    /* A coding point by the indices of its sessions. */
+    struct code_pair
+    {
+      uint32_t encoder;
+      size_t a, b;
+    };
+
+    const adjacency& links;
+    std::vector<session> sess;
+    std::vector<path_t> returns;
+    std::vector<coding> codes;
+    std::string err;
+
+    bool add_line(std::set<uint32_t>& labels, const path_spec_line& l,
+                  std::istream& rest, std::string& why);
+    bool route(uint32_t label, uint32_t source,
+               const std::vector<uint32_t>& receivers, session& s,
+               std::string& why);
+    bool valid(uint32_t encoder, size_t a, size_t b) const;
+    void session_links(size_t s, uint32_t encoder,
+                       std::vector<uint32_t>& plain,
+                       std::vector<uint32_t>& coded) const;
+    void rates(const std::vector<code_pair>& pairs,
+               std::vector<uint32_t>& load, std::vector<double>& rate) const;
+    void write_path(std::ostream& out, const path_t& p) const;
+  };
+} // vigil namespace
+
+#endif
@@ -0,0 +1,131 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "ofp_batch.hh"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "packets.h"
+
+namespace vigil
+{
+  static uint64_t
+  now_ns()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+  b_batch::b_batch()
+    : len(0), sent_iov(0), timed(false), pack_ns(0),
+      started_us(0)
+  {
+    memset(&barrier, 0x00, sizeof barrier);
+  }
+
+  void
+  b_batch::push(const struct ofp_header *oh)
+  {
+    struct iovec v;
+    v.iov_base = (void*)oh;
+    v.iov_len  = ntohs(oh->length);
+    iov.push_back(v);
+    len += v.iov_len;
+  }
+
+  /* Pack 'b' into the batch.  'b' is deleted, its buffer is kept.
+   * Returns false if 'b' could not be packed. */
+  bool
+  b_batch::add(b_flow_mod *b)
+  {
+    uint64_t start = timed ? now_ns() : 0;
+    bool ok = b->build() != NULL;
+    if (timed)
+      pack_ns += now_ns() - start;
+    if (ok)
+      add((struct ofp_header*)b->release_buffer());
+    delete b;
+
+    return ok;
+  }
+
+  /* Queue a malloc()ed message, the batch frees it.  A NULL 'oh' (a
+   * failed b_flow_template::build()) is ignored. */
+  bool
+  b_batch::add(struct ofp_header *oh)
+  {
+    if (oh == NULL)
+      return false;
+    owned.push_back((uint8_t*)oh);
+    push(oh);
+
+    return true;
+  }
+
+  /* Append a barrier request and return its xid. */
+  uint32_t
+  b_batch::close()
+  {
+    uint32_t xid = b_flow_mod::get_new_xid();
+
+    barrier.version = OFP_VERSION;
+    barrier.type    = OFPT_BARRIER_REQUEST;
+    barrier.length  = htons(sizeof barrier);
+    barrier.xid     = htonl(xid);
+    push(&barrier);
+
+    return xid;
+  }
+
+  /* Pass the unsent messages to 's' in order.  Stops at the first
+   * non-zero return value (e.g., EAGAIN) and returns it, the message
+   * is tried again on the next call. */
+  int
+  b_batch::send(const sender &s)
+  {
+    for (; sent_iov < iov.size(); sent_iov++) {
+      int error = s((const struct ofp_header*)iov[sent_iov].iov_base);
+      if (error)
+        return error;
+    }
+
+    return 0;
+  }
+
+  void
+  b_batch::clear()
+  {
+    for (size_t i = 0; i < owned.size(); i++)
+      free(owned[i]);
+    owned.clear();
+    iov.clear();
+    len = 0;
+    sent_iov = 0;
+    barrier.xid = 0;
+    pack_ns = 0;
+  }
+
+  b_batch::~b_batch()
+  {
+    clear();
+  }
+} // vigil namespace
@@ -0,0 +1,91 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef ofp_batch_HH
+#define ofp_batch_HH
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <vector>
+#include <boost/function.hpp>
+#include "ofp_builder.hh"
+
+namespace vigil
+{
+  /** \brief Packed OpenFlow messages queued for one datapath.
+   *
+   * add() takes over the buffer packed by a b_flow_mod or built by a
+   * b_flow_template instead of copying it; msgs() lists the buffers
+   * with their lengths.  send() passes the messages one by one to a
+   * callback, in the app send_openflow_command(), as NOX has no
+   * vectored send.  It remembers how far it got and continues from
+   * there on the next call.  close() terminates the batch with an
+   * OFPT_BARRIER_REQUEST whose reply tells that the switch has
+   * processed everything before it.
+   * After time_packing(), the time add() spends in b_flow_mod::build()
+   * is summed up in packing_ns().  start_us() is a timestamp of the
+   * caller's choice, e.g., when the computation of the rules began.
+   */
+  class b_batch
+  {
+  public:
+    typedef boost::function<int(const struct ofp_header*)> sender;
+
+    b_batch();
+    ~b_batch();
+
+    bool add(b_flow_mod *b);
+    bool add(struct ofp_header *oh);
+    uint32_t close();
+    void clear();
+
+    void time_packing() { timed = true; }
+    uint64_t packing_ns() const { return pack_ns; }
+    void set_start_us(uint64_t us) { started_us = us; }
+    uint64_t start_us() const { return started_us; }
+
+    int send(const sender &s);
+    bool done() const { return sent_iov == iov.size(); }
+    uint32_t barrier_xid() const { return barrier.xid ? ntohl(barrier.xid) : 0; }
+
+    const struct iovec* msgs() const { return iov.empty() ? NULL : &iov[0]; }
+    size_t num_msgs() const { return iov.size(); }
+    size_t size() const { return len; }
+
+  private:
+    std::vector<struct iovec> iov;
+    std::vector<uint8_t*> owned;
+    struct ofp_header barrier;
+    size_t len;
+    size_t sent_iov;
+    bool timed;
+    uint64_t pack_ns;
+    uint64_t started_us;
+
+    void push(const struct ofp_header *oh);
+
+    b_batch(const b_batch&);
+    b_batch& operator=(const b_batch&);
+  };
+} // vigil namespace
+
+#endif
@@ -20,8 +20,13 @@
  */
 
 #include "ofp_builder.hh"
+#include <algorithm>
+#include <new>
+#include <pthread.h>
+#include <stdio.h>
 #include "../oflib/ofl.h"
 #include "../oflib/ofl-packets.h"
+#include "../oflib/ofl-utils.h"
 #include <openflow/bme-ext.h>
 #include "../oflib-exp/ofl-exp.h"
 #include "../oflib-exp/ofl-exp-bme.h"
@@ -36,19 +41,126 @@ namespace vigil
   static struct ofl_exp_msg  b_exp_msg_callbacks;
   static struct ofl_exp      b_ofl_exp;
 
-  static struct ofl_exp*
-  get_ofl_exp()
+  static pthread_once_t b_ofl_exp_once = PTHREAD_ONCE_INIT;
+
+  static bool
+  is_rlnc(struct ofl_action_header *act)
+  {
+    struct ofl_bme_action_header *a = (struct ofl_bme_action_header*)act;
+    return a->experimenter_id == BME_EXPERIMENTER_ID
+      && a->type == BME_RLNC_ENCODE;
+  }
+
+  static size_t
+  rlnc_len(const struct ofl_bme_rlnc_encode *a)
+  {
+    return (sizeof(struct bme_action_rlnc_encode) + a->num_coeffs + 7) & ~7;
+  }
+
+  /* The actions oflib-exp does not know are packed here. */
+  static int
+  b_exp_act_pack(struct ofl_action_header *src, struct ofp_action_header *dst)
+  {
+    if (!is_rlnc(src))
+      return ofl_exp_act_pack(src, dst);
+
+    struct ofl_bme_rlnc_encode *a = (struct ofl_bme_rlnc_encode*)src;
+    struct bme_action_rlnc_encode *w = (struct bme_action_rlnc_encode*)dst;
+    size_t len = rlnc_len(a);
+    memset(w, 0x00, len);
+    w->type         = htons(OFPAT_EXPERIMENTER);
+    w->len          = htons(len);
+    w->experimenter = htonl(BME_EXPERIMENTER_ID);
+    w->subtype      = htonl(BME_RLNC_ENCODE);
+    w->generation   = htonl(a->generation);
+    w->symbol_size  = htons(a->symbol_size);
+    w->num_coeffs   = htons(a->num_coeffs);
+    memcpy(w->coeffs, a->coeffs, a->num_coeffs);
+
+    return len;
+  }
+
+  static int
+  b_exp_act_unpack(struct ofp_action_header *src, size_t *len,
+                   struct ofl_action_header **dst)
+  {
+    struct bme_action_rlnc_encode *w = (struct bme_action_rlnc_encode*)src;
+    if (*len < sizeof *w
+        || ntohl(w->experimenter) != BME_EXPERIMENTER_ID
+        || ntohl(w->subtype) != BME_RLNC_ENCODE)
+      return ofl_exp_act_unpack(src, len, dst);
+
+    size_t w_len = ntohs(w->len);
+    uint16_t num = ntohs(w->num_coeffs);
+    if (w_len > *len || w_len < sizeof *w + num)
+      return ofl_error(OFPET_BAD_ACTION, OFPBAC_BAD_LEN);
+
+    // OpenFlow 1.1 has no error for running out of memory, the
+    // closest is that the switch cannot handle the action.
+    struct ofl_bme_rlnc_encode *a =
+      (struct ofl_bme_rlnc_encode*)malloc(sizeof *a);
+    if (a == NULL)
+      return ofl_error(OFPET_BAD_ACTION, OFPBAC_TOO_MANY);
+    a->coeffs = (uint8_t*)malloc(num ? num : 1);
+    if (a->coeffs == NULL) {
+      free(a);
+      return ofl_error(OFPET_BAD_ACTION, OFPBAC_TOO_MANY);
+    }
+    a->header.type     = OFPAT_EXPERIMENTER;
+    a->experimenter_id = BME_EXPERIMENTER_ID;
+    a->type            = BME_RLNC_ENCODE;
+    a->generation      = ntohl(w->generation);
+    a->symbol_size     = ntohs(w->symbol_size);
+    a->num_coeffs      = num;
+    memcpy(a->coeffs, w->coeffs, num);
+
+    *len -= w_len;
+    *dst = &a->header;
+    return 0;
+  }
+
+  static int
+  b_exp_act_free(struct ofl_action_header *act)
   {
-    static int init = 0;
+    if (!is_rlnc(act))
+      return ofl_exp_act_free(act);
+
+    free(((struct ofl_bme_rlnc_encode*)act)->coeffs);
+    free(act);
+    return 0;
+  }
+
+  static size_t
+  b_exp_act_ofp_len(struct ofl_action_header *act)
+  {
+    if (!is_rlnc(act))
+      return ofl_exp_act_ofp_len(act);
+
+    return rlnc_len((struct ofl_bme_rlnc_encode*)act);
+  }
 
-    if (init)
-      return &b_ofl_exp;
+  static char*
+  b_exp_act_to_string(struct ofl_action_header *act)
+  {
+    if (!is_rlnc(act))
+      return ofl_exp_act_to_string(act);
+
+    struct ofl_bme_rlnc_encode *a = (struct ofl_bme_rlnc_encode*)act;
+    char *str = (char*)malloc(64);
+    if (str)
+      snprintf(str, 64, "rlnc_encode{gen=\"%u\", k=\"%u\", size=\"%u\"}",
+               a->generation, a->num_coeffs, a->symbol_size);
+    return str;
+  }
 
-    b_exp_act_callbacks.pack      = ofl_exp_act_pack;
-    b_exp_act_callbacks.unpack    = ofl_exp_act_unpack;
-    b_exp_act_callbacks.free      = ofl_exp_act_free;
-    b_exp_act_callbacks.ofp_len   = ofl_exp_act_ofp_len;
-    b_exp_act_callbacks.to_string = ofl_exp_act_to_string;
+  static void
+  init_ofl_exp()
+  {
+    b_exp_act_callbacks.pack      = b_exp_act_pack;
+    b_exp_act_callbacks.unpack    = b_exp_act_unpack;
+    b_exp_act_callbacks.free      = b_exp_act_free;
+    b_exp_act_callbacks.ofp_len   = b_exp_act_ofp_len;
+    b_exp_act_callbacks.to_string = b_exp_act_to_string;
 
     b_exp_inst_callbacks.pack      = ofl_exp_inst_pack;
     b_exp_inst_callbacks.unpack    = ofl_exp_inst_unpack;
@@ -66,8 +178,14 @@ namespace vigil
     b_ofl_exp.match = NULL;
     b_ofl_exp.stats = NULL;
     b_ofl_exp.msg   = &b_exp_msg_callbacks;
-    
-    init++;
+  }
+
+  /* Join handlers pack messages on several threads, hence the
+   * pthread_once(). */
+  static struct ofl_exp*
+  get_ofl_exp()
+  {
+    pthread_once(&b_ofl_exp_once, init_ofl_exp);
 
     return &b_ofl_exp;
   }
@@ -81,8 +199,98 @@ namespace vigil
     return n;
   }
 
-  b_flow_mod::b_flow_mod()
-    : instr(0), buffer(0)
+  // ----------------------------------------------------------------------
+
+  /* Heap chunks hold at least this many bytes. */
+  static const size_t b_arena_chunk_size = 4096;
+  /* Allocations are aligned to 8 bytes, so is the chunk header. */
+  static const size_t b_arena_align = 8;
+
+  static inline size_t
+  b_arena_round(size_t size)
+  {
+    return (size + b_arena_align - 1) & ~(b_arena_align - 1);
+  }
+
+  b_arena::b_arena()
+    : chunks(0), cur((uint8_t*)inline_buf), left(sizeof inline_buf)
+  {
+  }
+
+  void*
+  b_arena::alloc(size_t size)
+  {
+    size = b_arena_round(size);
+    if (size > left) {
+      size_t hdr  = b_arena_round(sizeof(chunk));
+      size_t data = std::max(size, b_arena_chunk_size);
+      chunk *c = (chunk*)malloc(hdr + data);
+      if (c == NULL)
+        throw std::bad_alloc();
+
+      c->next = chunks;
+      chunks = c;
+      cur  = (uint8_t*)c + hdr;
+      left = data;
+    }
+
+    void *p = cur;
+    cur  += size;
+    left -= size;
+    memset(p, 0x00, size);
+
+    return p;
+  }
+
+  void
+  b_arena::release()
+  {
+    while (chunks) {
+      chunk *next = chunks->next;
+      free(chunks);
+      chunks = next;
+    }
+    cur  = (uint8_t*)inline_buf;
+    left = sizeof inline_buf;
+  }
+
+  b_arena::~b_arena()
+  {
+    release();
+  }
+
+  /* Double the capacity of an arena-allocated pointer array.  The old
+   * array is left in the arena. */
+  template <typename T> static T**
+  b_arena_grow(b_arena *arena, T **list, size_t num, size_t *cap)
+  {
+    size_t new_cap = *cap ? *cap * 2 : 4;
+    T **new_list = (T**)arena->alloc(new_cap * sizeof(T*));
+    if (num)
+      memcpy(new_list, list, num * sizeof(T*));
+    *cap = new_cap;
+
+    return new_list;
+  }
+
+  // ----------------------------------------------------------------------
+
+  /* A standard match of every packet. */
+  static void
+  match_all(struct ofl_match_standard *match)
+  {
+    memset(match, 0x00, sizeof *match);
+    match->header.type = OFPMT_STANDARD;
+    match->wildcards = OFPFW_ALL;
+    memset(&match->dl_src_mask, 0xFF, ETH_ADDR_LEN);
+    memset(&match->dl_dst_mask, 0xFF, ETH_ADDR_LEN);
+    match->nw_src_mask = 0xFFFFFFFF; /* IP source address mask. */
+    match->nw_dst_mask = 0xFFFFFFFF; /* IP destination address mask. */
+  }
+
+  b_flow_mod::b_flow_mod(b_arena *arena)
+    : own_arena(arena ? 0 : new b_arena()),
+      arena(arena ? arena : own_arena), instr(0), buffer(0)
   {
     memset(&ofl, 0x00, sizeof ofl);
     ofl.header.type = OFPT_FLOW_MOD;
@@ -95,13 +303,7 @@ namespace vigil
     ofl.out_group = OFPG_ANY;
     ofl.match = (ofl_match_header*)&match;
 
-    memset(&match, 0x00, sizeof match);
-    match.header.type = OFPMT_STANDARD;
-    match.wildcards = OFPFW_ALL;
-    memset(&match.dl_src_mask, 0xFF, ETH_ADDR_LEN);
-    memset(&match.dl_dst_mask, 0xFF, ETH_ADDR_LEN);
-    match.nw_src_mask = 0xFFFFFFFF; /* IP source address mask. */
-    match.nw_dst_mask = 0xFFFFFFFF; /* IP destination address mask. */
+    match_all(&match);
   }
 
   b_flow_mod*
@@ -182,7 +384,8 @@ namespace vigil
   b_flow_mod::instructions()
   {
     if (instr == NULL) {
-      instr = new b_instructions(this);
+      instr = new (arena->alloc(sizeof(b_instructions)))
+        b_instructions(this, arena);
     }
     return instr;
   }
@@ -205,62 +408,200 @@ namespace vigil
     return this->instructions()->write_actions();
   }
 
-  struct ofp_header*
-  b_flow_mod::build()
+  const struct ofl_msg_flow_mod*
+  b_flow_mod::msg()
   {
     if (instr) {
       ofl.instructions_num = instr->get_num();
       ofl.instructions = instr->build();
     }
 
+    return &ofl;
+  }
+
+  struct ofp_header*
+  b_flow_mod::build()
+  {
+    msg();
+
+    free(buffer);
+    buffer = NULL;
+
     size_t buf_size;
     int error = ofl_msg_pack((ofl_msg_header*)&ofl,
 			     get_new_xid(), &buffer, &buf_size, get_ofl_exp());
     if (error) {
-      lg.err("Error packing request.");
-      exit(0);
+      lg.err("Error packing flow-mod (%d).", error);
+      buffer = NULL;
+      return NULL;
     }
 
     return (struct ofp_header*)buffer;
   }
 
+  uint8_t*
+  b_flow_mod::release_buffer()
+  {
+    uint8_t *b = buffer;
+    buffer = NULL;
+
+    return b;
+  }
+
+  /* Instructions and actions go away with the arena. */
   b_flow_mod::~b_flow_mod()
   {
-    delete instr;
-    ofl_msg_free((struct ofl_msg_header *)buffer, get_ofl_exp());
+    free(buffer);
+    delete own_arena;
   }
 
   // ----------------------------------------------------------------------
 
-  b_instructions::b_instructions(b_flow_mod *parent)
-    : ofl(0), next(0), last(this), actions(0), parent(parent)
+  struct ofp_header*
+  b_flow_stats_request(uint32_t xid)
   {
+    struct ofl_match_standard match;
+    match_all(&match);
+
+    struct ofl_msg_stats_request_flow req;
+    memset(&req, 0x00, sizeof req);
+    req.header.header.type = OFPT_STATS_REQUEST;
+    req.header.type = OFPST_FLOW;
+    req.table_id = OFPTT_ALL;
+    req.out_port = OFPP_ANY;
+    req.out_group = OFPG_ANY;
+    req.match = (ofl_match_header*)&match;
+
+    uint8_t *buf;
+    size_t buf_size;
+    int error = ofl_msg_pack((ofl_msg_header*)&req, xid, &buf, &buf_size,
+                             get_ofl_exp());
+    if (error) {
+      lg.err("Error packing flow stats request (%d).", error);
+      return NULL;
+    }
+
+    return (struct ofp_header*)buf;
   }
 
-  b_instructions*
-  b_instructions::New(int type) {
-    if (ofl == NULL)
-      return this;
-
-    b_instructions *old_last = this->last;
-    if (type == OFPIT_APPLY_ACTIONS || type == OFPIT_WRITE_ACTIONS) {
-      if (old_last->ofl->type == type)
-	return old_last;
+  struct ofp_header*
+  b_port_stats_request(uint32_t xid)
+  {
+    struct ofl_msg_stats_request_port req;
+    memset(&req, 0x00, sizeof req);
+    req.header.header.type = OFPT_STATS_REQUEST;
+    req.header.type = OFPST_PORT;
+    req.port_no = OFPP_ANY;
+
+    uint8_t *buf;
+    size_t buf_size;
+    int error = ofl_msg_pack((ofl_msg_header*)&req, xid, &buf, &buf_size,
+                             get_ofl_exp());
+    if (error) {
+      lg.err("Error packing port stats request (%d).", error);
+      return NULL;
     }
 
-    this->last =  new b_instructions(parent);
-    old_last->next = this->last;
+    return (struct ofp_header*)buf;
+  }
+
+  struct ofp_header*
+  b_flow_stats_to_mod(const struct ofl_flow_stats *fs)
+  {
+    struct ofl_msg_flow_mod ofl;
+    memset(&ofl, 0x00, sizeof ofl);
+    ofl.header.type = OFPT_FLOW_MOD;
+    ofl.cookie = fs->cookie;
+    ofl.table_id = fs->table_id;
+    ofl.command = OFPFC_ADD;
+    ofl.idle_timeout = fs->idle_timeout;
+    ofl.hard_timeout = fs->hard_timeout;
+    ofl.priority = fs->priority;
+    ofl.buffer_id = -1;
+    ofl.out_port = OFPP_ANY;
+    ofl.out_group = OFPG_ANY;
+    ofl.match = fs->match;
+    ofl.instructions_num = fs->instructions_num;
+    ofl.instructions = fs->instructions;
+
+    uint8_t *buf;
+    size_t buf_size;
+    int error = ofl_msg_pack((ofl_msg_header*)&ofl, 0, &buf, &buf_size,
+                             get_ofl_exp());
+    if (error) {
+      lg.err("Error packing flow entry (%d).", error);
+      return NULL;
+    }
+
+    return (struct ofp_header*)buf;
+  }
+
+  struct ofl_msg_header*
+  b_msg_unpack(const struct ofp_header *oh)
+  {
+    struct ofl_msg_header *msg;
+    uint32_t xid;
+    int error = ofl_msg_unpack((uint8_t*)oh, ntohs(oh->length), &msg, &xid,
+                               get_ofl_exp());
+    if (error) {
+      lg.err("Error unpacking message (%d).", error);
+      return NULL;
+    }
+
+    return msg;
+  }
+
+  void
+  b_msg_free(struct ofl_msg_header *msg)
+  {
+    ofl_msg_free(msg, get_ofl_exp());
+  }
+
+  // ----------------------------------------------------------------------
+
+  b_instructions::b_instructions(b_flow_mod *parent, b_arena *arena)
+    : list(0), num(0), cap(0), last_actions(0), parent(parent), arena(arena)
+  {
+  }
+
+  template <typename T> T*
+  b_instructions::New()
+  {
+    if (num == cap)
+      list = b_arena_grow(arena, list, num, &cap);
+
+    T *ofl = arena->make<T>();
+    list[num++] = (struct ofl_instruction_header*)ofl;
+    last_actions = NULL;
+
+    return ofl;
+  }
+
+  /* Consecutive apply (or write) actions are merged into one
+   * instruction. */
+  b_actions*
+  b_instructions::actions(enum ofp_instruction_type type)
+  {
+    typedef struct ofl_instruction_actions ofl_t;
+    if (last_actions && list[num - 1]->type == type)
+      return last_actions;
+
+    ofl_t *ofl = New<ofl_t>();
+    ofl->header.type = type;
+    ofl->actions_num = 0;
+    ofl->actions = NULL;
+
+    last_actions = new (arena->alloc(sizeof(b_actions)))
+      b_actions(this, arena, ofl);
 
-    return this->last;
+    return last_actions;
   }
 
   b_instructions*
   b_instructions::goto_table(uint8_t table_id)
   {
     typedef struct ofl_instruction_goto_table ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_instruction_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t *)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPIT_GOTO_TABLE;
     ofl->table_id = table_id;
@@ -271,9 +612,7 @@ namespace vigil
   b_instructions*
   b_instructions::write_metadata(uint64_t metadata, uint64_t mask) {
     typedef struct ofl_instruction_write_metadata ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_instruction_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type   = OFPIT_WRITE_METADATA;
     ofl->metadata      = metadata;
@@ -285,41 +624,24 @@ namespace vigil
   b_actions*
   b_instructions::apply_actions()
   {
-    typedef struct ofl_instruction_actions ofl_t;
-    last = this->New(OFPIT_APPLY_ACTIONS);
-    if (last->ofl)
-      return last->actions;
-
-    last->ofl = (struct ofl_instruction_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t *)last->ofl;
-
-    ofl->header.type = OFPIT_APPLY_ACTIONS;
-    ofl->actions_num = 0;
-    ofl->actions = NULL;
-
-    last->actions = new b_actions(this);
-
-    return last->actions;
+    return actions(OFPIT_APPLY_ACTIONS);
   }
 
   b_actions*
   b_instructions::write_actions()
   {
-    typedef struct ofl_instruction_actions ofl_t;
-    last = this->New(OFPIT_WRITE_ACTIONS);
-    if (last->ofl)
-      return last->actions;
-
-    last->ofl = (struct ofl_instruction_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t *)last->ofl;
+    return actions(OFPIT_WRITE_ACTIONS);
+  }
 
-    ofl->header.type = OFPIT_WRITE_ACTIONS;
-    ofl->actions_num = 0;
-    ofl->actions = NULL;
+  b_instructions*
+  b_instructions::clear_actions()
+  {
+    typedef struct ofl_instruction_header ofl_t;
+    ofl_t *ofl = New<ofl_t>();
 
-    last->actions = new b_actions(this);
+    ofl->type = OFPIT_CLEAR_ACTIONS;
 
-    return last->actions;
+    return this;
   }
 
   b_flow_mod*
@@ -328,71 +650,31 @@ namespace vigil
     return parent;
   }
 
-  int
-  b_instructions::get_num()
-  {
-    int i = 0;
-    for (b_instructions *b = this; b; b = b->next) {
-      i ++;
-    }
-    return i;
-  }
-
-  struct ofl_instruction_header **
-  b_instructions::build()
-  {
-    for (b_instructions *b = this; b; b = b->next) {
-      if (b->actions) {
-	typedef struct ofl_instruction_actions ofl_t;
-	ofl_t *ofl = (ofl_t *)b->ofl;
-	ofl->actions_num = b->actions->get_num();
-	ofl->actions     = b->actions->build();
-      }
-    }
-
-    int i = 0;
-    int num = get_num();
-    struct ofl_instruction_header ** list;
-    list = new struct ofl_instruction_header*[num];
-    for (b_instructions *b = this; b; b = b->next, i++) {
-      list[i] = b->ofl;
-    }
-
-    return list;
-  }
-
-  b_instructions::~b_instructions()
-  {
-    delete next;
-    delete actions;
-    delete ofl;
-  }
-
   // ----------------------------------------------------------------------
 
-  b_actions::b_actions(b_instructions *parent)
-    : ofl(0), next(0), last(this), parent(parent)
+  b_actions::b_actions(b_instructions *parent, b_arena *arena,
+                       struct ofl_instruction_actions *instr)
+    : instr(instr), cap(0), parent(parent), arena(arena)
   {
   }
 
-  b_actions*
-  b_actions::New() {
-    if (ofl == NULL)
-      return this;
+  template <typename T> T*
+  b_actions::New()
+  {
+    if (instr->actions_num == cap)
+      instr->actions = b_arena_grow(arena, instr->actions,
+                                    instr->actions_num, &cap);
 
-    b_actions *old_last = this->last;
-    this->last =  new b_actions(parent);
-    old_last->next = this->last;
+    T *ofl = arena->make<T>();
+    instr->actions[instr->actions_num++] = (struct ofl_action_header*)ofl;
 
-    return this->last;
+    return ofl;
   }
 
   b_actions*
   b_actions::output(int port_no) {
     typedef struct ofl_action_output ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t *)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_OUTPUT;
     ofl->port = port_no;
@@ -404,9 +686,7 @@ namespace vigil
   b_actions*
   b_actions::set_mpls_label(uint32_t label) {
     typedef struct ofl_action_mpls_label ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_SET_MPLS_LABEL;
     ofl->mpls_label = label;
@@ -417,9 +697,7 @@ namespace vigil
   b_actions*
   b_actions::decrement_mpls_ttl() {
     typedef struct ofl_action_header ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->type = OFPAT_DEC_MPLS_TTL;
 
@@ -429,9 +707,7 @@ namespace vigil
   b_actions*
   b_actions::decrement_ipv4_ttl() {
     typedef struct ofl_action_header ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->type = OFPAT_DEC_NW_TTL;
 
@@ -441,9 +717,7 @@ namespace vigil
   b_actions*
   b_actions::set_field_from_metadata(uint32_t field, uint8_t offset) {
     typedef struct ofl_bme_set_metadata ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_EXPERIMENTER;
     ofl->experimenter_id = BME_EXPERIMENTER_ID;
@@ -457,9 +731,7 @@ namespace vigil
   b_actions*
   b_actions::set_metadata_from_packet(uint32_t field, uint8_t offset) {
     typedef struct ofl_bme_set_metadata ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_EXPERIMENTER;
     ofl->experimenter_id = BME_EXPERIMENTER_ID;
@@ -473,9 +745,7 @@ namespace vigil
   b_actions*
   b_actions::set_metadata_from_counter(uint32_t max_num) {
     typedef struct ofl_bme_set_metadata_from_counter ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_EXPERIMENTER;
     ofl->experimenter_id = BME_EXPERIMENTER_ID;
@@ -488,9 +758,7 @@ namespace vigil
   b_actions*
   b_actions::set_mpls_label_from_counter() {
     typedef struct ofl_bme_set_mpls_label ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_EXPERIMENTER;
     ofl->experimenter_id = BME_EXPERIMENTER_ID;
@@ -502,9 +770,7 @@ namespace vigil
   b_actions*
   b_actions::push_mpls_header() {
     typedef struct ofl_action_push ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_PUSH_MPLS;
     ofl->ethertype = ETH_TYPE_MPLS;  /* or ETH_TYPE_MPLS_MCAST? */
@@ -516,9 +782,7 @@ namespace vigil
   b_actions::pop_mpls_header(uint16_t ethertype) 
   {
     typedef struct ofl_action_pop_mpls ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_POP_MPLS;
     ofl->ethertype = ethertype;
@@ -530,9 +794,7 @@ namespace vigil
   b_actions::set_eth_dst(uint64_t addr)
   {
     typedef struct ofl_action_dl_addr ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     addr = hton_48(addr);
     ofl->header.type = OFPAT_SET_DL_DST;
@@ -545,9 +807,7 @@ namespace vigil
   b_actions::set_ipv4_destination(uint32_t addr)
   {
     typedef struct ofl_action_nw_addr ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_SET_NW_DST;
     ofl->nw_addr = htonl(addr); // XXX
@@ -559,9 +819,7 @@ namespace vigil
   b_actions::output_by_metadata()
   {
     typedef struct ofl_bme_action_header ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_EXPERIMENTER;
     ofl->experimenter_id = BME_EXPERIMENTER_ID;
@@ -573,9 +831,7 @@ namespace vigil
   b_actions*
   b_actions::xor_encode(uint32_t label_a, uint32_t label_b) {
     typedef struct ofl_bme_xor_packet ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_EXPERIMENTER;
     ofl->experimenter_id = BME_EXPERIMENTER_ID;
@@ -589,9 +845,7 @@ namespace vigil
   b_actions*
   b_actions::xor_decode(uint32_t label_a, uint32_t label_b) {
     typedef struct ofl_bme_xor_packet ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_EXPERIMENTER;
     ofl->experimenter_id = BME_EXPERIMENTER_ID;
@@ -607,9 +861,7 @@ namespace vigil
 					 uint32_t port)
   {
     typedef struct ofl_bme_update_distance ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_EXPERIMENTER;
     ofl->experimenter_id = BME_EXPERIMENTER_ID;
@@ -625,9 +877,7 @@ namespace vigil
   b_actions::serialize(uint32_t mpls_label, uint32_t timeout)
   {
     typedef struct ofl_bme_serialize ofl_t;
-    last = this->New();
-    last->ofl = (struct ofl_action_header*) new ofl_t;
-    ofl_t *ofl = (ofl_t*)last->ofl;
+    ofl_t *ofl = New<ofl_t>();
 
     ofl->header.type = OFPAT_EXPERIMENTER;
     ofl->experimenter_id = BME_EXPERIMENTER_ID;
@@ -638,40 +888,219 @@ namespace vigil
     return this;
   }
 
+  b_actions*
+  b_actions::rlnc_encode(uint32_t generation, const uint8_t *coeffs,
+                         uint16_t num_coeffs, uint16_t symbol_size)
+  {
+    typedef struct ofl_bme_rlnc_encode ofl_t;
+    ofl_t *ofl = New<ofl_t>();
+
+    ofl->header.type = OFPAT_EXPERIMENTER;
+    ofl->experimenter_id = BME_EXPERIMENTER_ID;
+    ofl->type = BME_RLNC_ENCODE;
+    ofl->generation = generation;
+    ofl->symbol_size = symbol_size;
+    ofl->num_coeffs = num_coeffs;
+    ofl->coeffs = (uint8_t*)arena->alloc(num_coeffs);
+    memcpy(ofl->coeffs, coeffs, num_coeffs);
+
+    return this;
+  }
+
   b_instructions*
   b_actions::end()
   {
     return parent;
   }
 
-  int
-  b_actions::get_num()
+  // ----------------------------------------------------------------------
+
+  static inline void
+  put_32(uint8_t *p, uint32_t v)
+  {
+    v = htonl(v);
+    memcpy(p, &v, sizeof v);
+  }
+
+  b_flow_template::b_flow_template(b_flow_mod *b)
+    : wire(0), len(0), goto_table_off(0), eth_dst_off(0), ipv4_dst_off(0)
+  {
+    struct ofp_header *oh = b->build();
+    if (oh == NULL) {
+      delete b;
+      return;
+    }
+    len = ntohs(oh->length);
+    wire = b->release_buffer();
+    delete b;
+
+    // Walk the packed message once and remember where the fields
+    // live.  The layout is the one produced by ofl_msg_pack():
+    // ofp_flow_mod, a standard match, then the instructions.
+    size_t off = offsetof(struct ofp_flow_mod, match);
+    struct ofp_match *m = (struct ofp_match*)(wire + off);
+    off += ntohs(m->length);
+
+    while (off + sizeof(struct ofp_instruction) <= len) {
+      struct ofp_instruction *i = (struct ofp_instruction*)(wire + off);
+      uint16_t i_len = ntohs(i->len);
+      if (i_len < sizeof(struct ofp_instruction) || off + i_len > len) {
+        lg.err("Malformed instruction in flow-mod template.");
+        break;
+      }
+
+      switch (ntohs(i->type)) {
+      case OFPIT_GOTO_TABLE:
+        goto_table_off = off + offsetof(struct ofp_instruction_goto_table,
+                                        table_id);
+        break;
+      case OFPIT_WRITE_ACTIONS:
+      case OFPIT_APPLY_ACTIONS:
+        scan_actions(off + sizeof(struct ofp_instruction_actions),
+                     off + i_len);
+        break;
+      default:
+        break;
+      }
+      off += i_len;
+    }
+  }
+
+  void
+  b_flow_template::scan_actions(size_t off, size_t end)
   {
-    int i = 0;
-    for (b_actions *b = this; b; b = b->next) {
-      i ++;
+    while (off + sizeof(struct ofp_action_header) <= end) {
+      struct ofp_action_header *a = (struct ofp_action_header*)(wire + off);
+      uint16_t a_len = ntohs(a->len);
+      if (a_len < sizeof(struct ofp_action_header) || off + a_len > end) {
+        lg.err("Malformed action in flow-mod template.");
+        return;
+      }
+
+      switch (ntohs(a->type)) {
+      case OFPAT_OUTPUT:
+        output_offs.push_back(off + offsetof(struct ofp_action_output,
+                                             port));
+        break;
+      case OFPAT_SET_MPLS_LABEL:
+        mpls_label_offs.push_back(off + offsetof(struct ofp_action_mpls_label,
+                                                 mpls_label));
+        break;
+      case OFPAT_SET_DL_DST:
+        if (eth_dst_off == 0)
+          eth_dst_off = off + offsetof(struct ofp_action_dl_addr, dl_addr);
+        break;
+      case OFPAT_SET_NW_DST:
+        if (ipv4_dst_off == 0)
+          ipv4_dst_off = off + offsetof(struct ofp_action_nw_addr, nw_addr);
+        break;
+      default:
+        break;
+      }
+      off += a_len;
     }
-    return i;
   }
 
-  struct ofl_action_header **
-  b_actions::build()
+  struct ofp_header*
+  b_flow_template::build(uint8_t *dst) const
   {
-    int i = 0;
-    int num = get_num();
-    struct ofl_action_header ** list;
-    list = new struct ofl_action_header*[num];
-    for (b_actions *b = this; b; b = b->next, i++) {
-      list[i] = b->ofl;
+    if (wire == NULL)
+      return NULL;
+    if (dst == NULL) {
+      dst = (uint8_t*)malloc(len);
+      if (dst == NULL)
+        return NULL;
     }
+    memcpy(dst, wire, len);
 
-    return list;
+    struct ofp_header *oh = (struct ofp_header*)dst;
+    oh->xid = htonl(b_flow_mod::get_new_xid());
+
+    return oh;
+  }
+
+  void
+  b_flow_template::table(struct ofp_header *oh, uint8_t table_id) const
+  {
+    ((struct ofp_flow_mod*)oh)->table_id = table_id;
+  }
+
+  void
+  b_flow_template::match_mpls_label(struct ofp_header *oh,
+                                    uint32_t label) const
+  {
+    put_32((uint8_t*)&((struct ofp_flow_mod*)oh)->match.mpls_label, label);
+  }
+
+  void
+  b_flow_template::match_eth_dst(struct ofp_header *oh,
+                                 uint64_t addr, uint64_t mask) const
+  {
+    struct ofp_match *m = &((struct ofp_flow_mod*)oh)->match;
+
+    addr = hton_48(addr);
+    mask = hton_48(mask);
+    memcpy(&m->dl_dst,      &addr, 6);
+    memcpy(&m->dl_dst_mask, &mask, 6);
+  }
+
+  void
+  b_flow_template::goto_table(struct ofp_header *oh, uint8_t table_id) const
+  {
+    if (goto_table_off == 0) {
+      lg.err("Flow-mod template has no goto_table instruction.");
+      return;
+    }
+    ((uint8_t*)oh)[goto_table_off] = table_id;
+  }
+
+  void
+  b_flow_template::output(struct ofp_header *oh, size_t i,
+                          uint32_t port_no) const
+  {
+    if (i >= output_offs.size()) {
+      lg.err("Flow-mod template has no output #%zu.", i);
+      return;
+    }
+    put_32((uint8_t*)oh + output_offs[i], port_no);
+  }
+
+  void
+  b_flow_template::set_mpls_label(struct ofp_header *oh, size_t i,
+                                  uint32_t label) const
+  {
+    if (i >= mpls_label_offs.size()) {
+      lg.err("Flow-mod template has no set_mpls_label #%zu.", i);
+      return;
+    }
+    put_32((uint8_t*)oh + mpls_label_offs[i], label);
+  }
+
+  void
+  b_flow_template::set_eth_dst(struct ofp_header *oh, uint64_t addr) const
+  {
+    if (eth_dst_off == 0) {
+      lg.err("Flow-mod template has no set_eth_dst action.");
+      return;
+    }
+    addr = hton_48(addr);
+    memcpy((uint8_t*)oh + eth_dst_off, &addr, 6);
+  }
+
+  void
+  b_flow_template::set_ipv4_destination(struct ofp_header *oh,
+                                        uint32_t addr) const
+  {
+    if (ipv4_dst_off == 0) {
+      lg.err("Flow-mod template has no set_ipv4_destination action.");
+      return;
+    }
+    addr = htonl(addr); // XXX
+    memcpy((uint8_t*)oh + ipv4_dst_off, &addr, sizeof addr);
   }
 
-  b_actions::~b_actions()
+  b_flow_template::~b_flow_template()
   {
-    delete next;
-    delete ofl;
+    free(wire);
   }
-}
- // vigil namespace
+} // vigil namespace
@@ -23,6 +23,7 @@
 #define opf_builder_HH
 
 #include <ostream>
+#include <vector>
 #include "netinet++/datapathid.hh"
 #include "../oflib/ofl-messages.h"
 #include "packets.h"
@@ -36,14 +37,88 @@
 
 namespace vigil
 {
+  /* Experimenter action coding a generation of random linear network
+   * coding (see rlnc.hh): the packets of 'generation' are combined
+   * with the coefficients, one per packet, into a coded packet of
+   * 'symbol_size' bytes.  It is packed by the builder itself, outside
+   * the range of the BME action types of oflib-exp. */
+  enum { BME_RLNC_ENCODE = 0x100 };
+
+  struct ofl_bme_rlnc_encode
+  {
+    struct ofl_action_header header;
+    uint32_t experimenter_id;
+    uint32_t type;
+    uint32_t generation;
+    uint16_t symbol_size;
+    uint16_t num_coeffs;
+    uint8_t *coeffs;
+  };
+
+  /* Wire layout, padded to a multiple of 8 bytes. */
+  struct bme_action_rlnc_encode
+  {
+    uint16_t type;              /* OFPAT_EXPERIMENTER */
+    uint16_t len;
+    uint32_t experimenter;      /* BME_EXPERIMENTER_ID */
+    uint32_t subtype;           /* BME_RLNC_ENCODE */
+    uint32_t generation;
+    uint16_t symbol_size;
+    uint16_t num_coeffs;
+    uint8_t coeffs[0];
+  };
+
   class b_instructions;
-  class b_apply_actions;
   class b_actions;
+  class b_flow_template;
+
+  /** \brief Bump allocator for the ofl structures of the builder.
+   *
+   * Memory is handed out from an inline buffer first, then from
+   * chunks on the heap.  Nothing is freed individually: release()
+   * (or the destructor) gives back everything at once.  Objects
+   * placed into the arena must have trivial destructors.  Like new,
+   * alloc() never returns NULL: it throws std::bad_alloc when a chunk
+   * cannot be allocated, so the builder never dereferences NULL.
+   */
+  class b_arena
+  {
+  public:
+    b_arena();
+    ~b_arena();
+
+    void* alloc(size_t size);
+    void release();
+
+    /* Zeroed storage for a T. */
+    template <typename T> T* make() { return (T*)alloc(sizeof(T)); }
+
+  private:
+    struct chunk { chunk *next; };
+
+    uint64_t inline_buf[64];
+    chunk *chunks;
+    uint8_t *cur;
+    size_t left;
+
+    b_arena(const b_arena&);
+    b_arena& operator=(const b_arena&);
+  };
 
+  /** \brief Builder of an OFPT_FLOW_MOD message.
+   *
+   * Instructions and actions live in an arena, either the flow-mod's
+   * own or one shared by the caller (e.g., for every rule of a
+   * datapath join).  In the latter case the arena must outlive the
+   * b_flow_mod.  The buffer returned by build() belongs to the
+   * b_flow_mod unless release_buffer() takes it over, then it must
+   * be freed with free().  build() returns NULL if the message
+   * cannot be packed.
+   */
   class b_flow_mod
   {
   public:
-    b_flow_mod();
+    b_flow_mod(b_arena *arena = NULL);
     ~b_flow_mod();
 
     b_flow_mod* table(uint8_t table_id);
@@ -58,25 +133,54 @@ namespace vigil
     b_instructions* write_metadata(uint64_t metadata, uint64_t mask);
     b_actions* apply_actions();
     b_actions* write_actions();
+    /* The message build() packs, valid as long as the b_flow_mod
+     * and its arena. */
+    const struct ofl_msg_flow_mod* msg();
     struct ofp_header* build();
+    uint8_t* release_buffer();
+
+    /* Safe to call from any thread. */
+    static uint32_t get_new_xid() { return __sync_add_and_fetch(&xid, 1); }
 
   private:
     static uint32_t xid;
     struct ofl_msg_flow_mod ofl;
     struct ofl_match_standard match;
+    b_arena *own_arena;         /* only without a shared one */
+    b_arena *arena;
     b_instructions *instr;
     uint8_t *buffer;
 
-    uint32_t get_new_xid() { return ++xid; }
+    b_flow_mod(const b_flow_mod&);
+    b_flow_mod& operator=(const b_flow_mod&);
   };
 
+  /** \brief Messages reading back the flow tables of a datapath.
+   *
+   * b_flow_stats_request() asks for every entry of every table.
+   * b_flow_stats_to_mod() turns an entry of the reply into the
+   * OFPFC_ADD that b_flow_mod::build() packs for the same rule, so
+   * the two can be compared byte by byte (xid aside).  Both return a
+   * buffer to be freed with free(), or NULL if it cannot be packed.
+   */
+  struct ofp_header* b_flow_stats_request(uint32_t xid);
+  struct ofp_header* b_flow_stats_to_mod(const struct ofl_flow_stats *fs);
+
+  /* Request of the counters of every port of a datapath, to be freed
+   * with free(), or NULL if it cannot be packed. */
+  struct ofp_header* b_port_stats_request(uint32_t xid);
+
+  /* Unpack a message with the experimenter actions of the builder
+   * (see b_pipeline), NULL if it is malformed.  The result must be
+   * freed with b_msg_free(). */
+  struct ofl_msg_header* b_msg_unpack(const struct ofp_header *oh);
+  void b_msg_free(struct ofl_msg_header *msg);
+
   class b_instructions
   {
   public:
-    b_instructions(b_flow_mod *parent);
-    ~b_instructions();
+    b_instructions(b_flow_mod *parent, b_arena *arena);
 
-    b_instructions* New(int type = 0);
     b_instructions* goto_table(uint8_t table_id);
     b_instructions* write_metadata(uint64_t metadata, uint64_t mask);
     b_actions*      write_actions();
@@ -84,23 +188,26 @@ namespace vigil
     b_instructions* clear_actions();
     b_flow_mod*     end();
 
-    int get_num();
-    struct ofl_instruction_header **build();
+    int get_num() { return num; }
+    struct ofl_instruction_header **build() { return list; }
 
   private:
-    ofl_instruction_header *ofl;
-    b_instructions *next, *last;
-    b_actions *actions;
+    struct ofl_instruction_header **list;
+    size_t num, cap;
+    b_actions *last_actions;
     b_flow_mod *parent;
+    b_arena *arena;
+
+    template <typename T> T* New();
+    b_actions* actions(enum ofp_instruction_type type);
   };
 
   class b_actions
   {
   public:
-    b_actions(b_instructions* parent);
-    ~b_actions();
+    b_actions(b_instructions* parent, b_arena *arena,
+              struct ofl_instruction_actions *instr);
 
-    b_actions* New();
     b_actions* output(int port_no);
     b_actions* set_mpls_label(uint32_t label);
     b_actions* decrement_mpls_ttl();
@@ -119,15 +226,69 @@ namespace vigil
     b_actions* update_distance_in_metadata(uint32_t x, uint32_t y,
 					   uint32_t port);
     b_actions* serialize(uint32_t mpls_label, uint32_t timeout);
+    b_actions* rlnc_encode(uint32_t generation, const uint8_t *coeffs,
+                           uint16_t num_coeffs, uint16_t symbol_size);
 
     b_instructions* end();
 
-    int get_num();
-    struct ofl_action_header **build();
+    int get_num() { return instr->actions_num; }
+    struct ofl_action_header **build() { return instr->actions; }
   private:
-    ofl_action_header *ofl;
-    b_actions *next, *last;
+    struct ofl_instruction_actions *instr;
+    size_t cap;
     b_instructions *parent;
+    b_arena *arena;
+
+    template <typename T> T* New();
+  };
+
+  /** \brief Packed flow-mod that can be re-sent with a few fields changed.
+   *
+   * The b_flow_mod given to the constructor is packed once, and the
+   * wire offsets of the patchable fields are recorded.  build()
+   * returns a copy of the packed message with a fresh xid (or NULL if
+   * the b_flow_mod could not be packed or the copy not allocated),
+   * the patch functions change a field of such a copy in place.
+   * Outputs and MPLS labels are numbered in the order they were added
+   * to the b_flow_mod, set_eth_dst() and set_ipv4_destination() patch
+   * the first such action.  The template takes over the b_flow_mod,
+   * which must have been allocated with new, and deletes it once
+   * packed.
+   */
+  class b_flow_template
+  {
+  public:
+    /* Deletes 'b'. */
+    explicit b_flow_template(b_flow_mod *b);
+    ~b_flow_template();
+
+    size_t size() const { return len; }
+    size_t num_outputs() const { return output_offs.size(); }
+    size_t num_mpls_labels() const { return mpls_label_offs.size(); }
+
+    struct ofp_header* build(uint8_t *dst = NULL) const;
+
+    void table(struct ofp_header *oh, uint8_t table_id) const;
+    void match_mpls_label(struct ofp_header *oh, uint32_t label) const;
+    void match_eth_dst(struct ofp_header *oh,
+                       uint64_t addr, uint64_t mask) const;
+    void goto_table(struct ofp_header *oh, uint8_t table_id) const;
+    void output(struct ofp_header *oh, size_t i, uint32_t port_no) const;
+    void set_mpls_label(struct ofp_header *oh, size_t i,
+                        uint32_t label) const;
+    void set_eth_dst(struct ofp_header *oh, uint64_t addr) const;
+    void set_ipv4_destination(struct ofp_header *oh, uint32_t addr) const;
+
+  private:
+    uint8_t *wire;
+    size_t len;
+    size_t goto_table_off;
+    size_t eth_dst_off;
+    size_t ipv4_dst_off;
+    std::vector<size_t> output_offs;
+    std::vector<size_t> mpls_label_offs;
+
+    void scan_actions(size_t off, size_t end);
   };
 } // vigil namespace
 
@@ -0,0 +1,213 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "ofp_metrics.hh"
+#include <algorithm>
+#include <errno.h>
+#include <fstream>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+namespace vigil
+{
+  const uint64_t b_histogram::bounds[num_bounds] = {
+    1000ULL, 2500ULL, 5000ULL,
+    10000ULL, 25000ULL, 50000ULL,
+    100000ULL, 250000ULL, 500000ULL,
+    1000000ULL, 2500000ULL, 5000000ULL,
+    10000000ULL, 25000000ULL, 50000000ULL,
+    100000000ULL, 250000000ULL, 500000000ULL,
+    1000000000ULL, 2500000000ULL, 5000000000ULL,
+    10000000000ULL,
+  };
+
+  b_histogram::b_histogram()
+    : n(0), sum_ns(0)
+  {
+    memset(buckets, 0x00, sizeof buckets);
+  }
+
+  void
+  b_histogram::add(uint64_t ns)
+  {
+    const uint64_t *b = std::lower_bound(bounds, bounds + num_bounds, ns);
+    buckets[b - bounds]++;
+    n++;
+    sum_ns += ns;
+  }
+
+  void
+  b_histogram::write(std::ostream& out, const char *name,
+                     const std::string& labels) const
+  {
+    const char *sep = labels.empty() ? "" : ",";
+    uint64_t cum = 0;
+    char le[32];
+
+    for (int i = 0; i <= num_bounds; i++) {
+      cum += buckets[i];
+      if (i < num_bounds)
+        snprintf(le, sizeof le, "%g", bounds[i] / 1e9);
+      else
+        strcpy(le, "+Inf");
+      out << name << "_bucket{" << labels << sep << "le=\"" << le
+          << "\"} " << cum << "\n";
+    }
+    snprintf(le, sizeof le, "%.9f", sum_ns / 1e9);
+    out << name << "_sum{" << labels << "} " << le << "\n";
+    out << name << "_count{" << labels << "} " << n << "\n";
+  }
+
+  b_dp_metrics::b_dp_metrics()
+    : joins(0), updates(0), programmed(0), msgs_sent(0), flow_mods_sent(0),
+      bytes_sent(0), send_errors(0), rejected(0), given_up(0)
+  {
+  }
+
+  b_dp_metrics*
+  b_metrics::get(uint64_t dpid)
+  {
+    return &dps[dpid];
+  }
+
+  void
+  b_metrics::set_gauge(const char *name, const char *help, double value)
+  {
+    gauge& g = gauges[name];
+    g.help  = help;
+    g.value = value;
+  }
+
+  /* Counters of b_dp_metrics by name. */
+  static const struct
+  {
+    const char *name;
+    const char *help;
+    uint64_t b_dp_metrics::*field;
+  } counters[] = {
+    { "butterfly_joins_total", "Joins started.",
+      &b_dp_metrics::joins },
+    { "butterfly_updates_total", "Updates started after a link change.",
+      &b_dp_metrics::updates },
+    { "butterfly_programmed_total", "Joins acknowledged by a barrier.",
+      &b_dp_metrics::programmed },
+    { "butterfly_messages_sent_total", "Messages sent.",
+      &b_dp_metrics::msgs_sent },
+    { "butterfly_flow_mods_sent_total", "Flow-mods sent.",
+      &b_dp_metrics::flow_mods_sent },
+    { "butterfly_bytes_sent_total", "Bytes of the messages sent.",
+      &b_dp_metrics::bytes_sent },
+    { "butterfly_send_errors_total", "Messages the connection refused.",
+      &b_dp_metrics::send_errors },
+    { "butterfly_rejected_total", "Messages answered by an error.",
+      &b_dp_metrics::rejected },
+    { "butterfly_given_up_total", "Messages rejected too many times.",
+      &b_dp_metrics::given_up },
+  };
+
+  static const struct
+  {
+    const char *name;
+    const char *help;
+    b_histogram b_dp_metrics::*field;
+  } histograms[] = {
+    { "butterfly_compute_seconds", "Time of computing the rules of a join.",
+      &b_dp_metrics::compute },
+    { "butterfly_pack_seconds", "Time of packing the flow-mods of a join.",
+      &b_dp_metrics::pack },
+    { "butterfly_send_seconds", "Time of a pass over the send queue.",
+      &b_dp_metrics::send },
+    { "butterfly_join_programmed_seconds",
+      "Time from the start of a join to its barrier reply.",
+      &b_dp_metrics::programmed_in },
+  };
+
+  void
+  b_metrics::write(std::ostream& out) const
+  {
+    std::map<std::string, gauge>::const_iterator g;
+    for (g = gauges.begin(); g != gauges.end(); g++) {
+      out << "# HELP " << g->first << " " << g->second.help << "\n"
+          << "# TYPE " << g->first << " gauge\n"
+          << g->first << " " << g->second.value << "\n";
+    }
+
+    std::vector<uint64_t> ids;
+    std::unordered_map<uint64_t, b_dp_metrics>::const_iterator i;
+    for (i = dps.begin(); i != dps.end(); i++)
+      ids.push_back(i->first);
+    std::sort(ids.begin(), ids.end());
+    std::vector<std::string> labels(ids.size());
+    for (size_t j = 0; j < ids.size(); j++) {
+      char buf[32];
+      snprintf(buf, sizeof buf, "dpid=\"%016" PRIx64 "\"", ids[j]);
+      labels[j] = buf;
+    }
+
+    for (size_t c = 0; c < sizeof counters / sizeof counters[0]; c++) {
+      out << "# HELP " << counters[c].name << " " << counters[c].help
+          << "\n# TYPE " << counters[c].name << " counter\n";
+      for (size_t j = 0; j < ids.size(); j++) {
+        const b_dp_metrics& m = dps.find(ids[j])->second;
+        out << counters[c].name << "{" << labels[j] << "} "
+            << m.*counters[c].field << "\n";
+      }
+    }
+    for (size_t h = 0; h < sizeof histograms / sizeof histograms[0]; h++) {
+      out << "# HELP " << histograms[h].name << " " << histograms[h].help
+          << "\n# TYPE " << histograms[h].name << " histogram\n";
+      for (size_t j = 0; j < ids.size(); j++) {
+        const b_dp_metrics& m = dps.find(ids[j])->second;
+        (m.*histograms[h].field).write(out, histograms[h].name, labels[j]);
+      }
+    }
+  }
+
+  /* Write into a temporary file next to 'filename', then rename it,
+   * so a reader never sees half of it. */
+  bool
+  b_metrics::write(const char *filename)
+  {
+    std::string tmp = std::string(filename) + ".tmp";
+    std::ofstream out(tmp.c_str());
+    if (!out) {
+      err = "cannot create " + tmp;
+      return false;
+    }
+    write(out);
+    out.close();
+    if (!out) {
+      err = "cannot write " + tmp;
+      unlink(tmp.c_str());
+      return false;
+    }
+    if (rename(tmp.c_str(), filename) != 0) {
+      err = std::string("cannot rename ") + tmp + ": " + strerror(errno);
+      unlink(tmp.c_str());
+      return false;
+    }
+
+    return true;
+  }
+} // vigil namespace
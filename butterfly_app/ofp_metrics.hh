@@ -0,0 +1,117 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef ofp_metrics_HH
+#define ofp_metrics_HH
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+
+namespace vigil
+{
+  /** \brief Histogram of durations.
+   *
+   * Buckets are bounded by 1, 2.5 and 5 times the powers of ten from
+   * 1 us to 10 s, the last one takes the rest.
+   */
+  class b_histogram
+  {
+  public:
+    static const int num_bounds = 22;
+
+    b_histogram();
+
+    void add(uint64_t ns);
+    uint64_t count() const { return n; }
+
+    /* Lines of a histogram in the text format of Prometheus, in
+     * seconds.  'labels' is put inside the braces as it is. */
+    void write(std::ostream& out, const char *name,
+               const std::string& labels) const;
+
+  private:
+    static const uint64_t bounds[num_bounds];
+    uint64_t buckets[num_bounds + 1];
+    uint64_t n;
+    uint64_t sum_ns;
+  };
+
+  /* What happened to one datapath.  A join is counted when it is
+   * started, its compute and pack times when the worker is done with
+   * it.  Updates are timed like joins. */
+  struct b_dp_metrics
+  {
+    b_dp_metrics();
+
+    uint64_t joins;             /* full joins */
+    uint64_t updates;           /* after a link change */
+    uint64_t programmed;        /* barrier replies closing a join */
+    uint64_t msgs_sent;
+    uint64_t flow_mods_sent;
+    uint64_t bytes_sent;
+    uint64_t send_errors;       /* failed sends, EAGAIN aside */
+    uint64_t rejected;          /* OFPT_ERROR replies to our messages */
+    uint64_t given_up;          /* rejected max_send_tries times */
+
+    b_histogram compute;        /* rules of a join, on a worker */
+    b_histogram pack;           /* b_flow_mod::build() of a join */
+    b_histogram send;           /* a drain() of the queue */
+    b_histogram programmed_in;  /* join started to barrier reply */
+  };
+
+  /** \brief Metrics of the datapaths, written in the text format of
+   * Prometheus.
+   *
+   * Datapaths are labelled by their dpid in hex.  A datapath keeps
+   * its entry after it leaves, so the counters only grow.  write()
+   * replaces the file atomically (node_exporter's textfile collector
+   * can pick it up); errors are returned by error().  The object is
+   * not locked, it belongs to one thread.
+   */
+  class b_metrics
+  {
+  public:
+    /* The entry of 'dpid', created on the first call.  It stays at
+     * the same address. */
+    b_dp_metrics* get(uint64_t dpid);
+    void set_gauge(const char *name, const char *help, double value);
+
+    void write(std::ostream& out) const;
+    bool write(const char *filename);
+    const std::string& error() const { return err; }
+
+  private:
+    struct gauge
+    {
+      std::string help;
+      double value;
+    };
+
+    std::unordered_map<uint64_t, b_dp_metrics> dps;
+    std::map<std::string, gauge> gauges;
+    std::string err;
+  };
+} // vigil namespace
+
+#endif
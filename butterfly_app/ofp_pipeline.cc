@@ -0,0 +1,1105 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "ofp_pipeline.hh"
+#include <algorithm>
+#include <string.h>
+#include <openflow/bme-ext.h>
+#include "../oflib-exp/ofl-exp-bme.h"
+#include "packets.h"
+
+namespace vigil
+{
+  /* Largest distance update_distance_in_metadata() stores, below the
+   * all-ones the greedy rule starts from. */
+  static const uint64_t max_distance = (1ULL << 48) - 2;
+  static const uint64_t mac_mask = (1ULL << 48) - 1;
+  static const size_t max_kept = 65536;
+
+  /* Kinds of packets xor_decode() keeps. */
+  enum { PLAIN_A, PLAIN_B, CODED_A, CODED_B };
+
+  static inline uint64_t
+  decode_key(uint32_t label_a, unsigned kind, uint32_t counter)
+  {
+    return (uint64_t)label_a << 32 | kind << 20 | (counter & 0xfffff);
+  }
+
+  static inline uint64_t
+  mac_to_host(const uint8_t *addr)
+  {
+    uint64_t v = 0;
+    for (int i = 0; i < ETH_ADDR_LEN; i++)
+      v = v << 8 | addr[i];
+    return v;
+  }
+
+  /* Inverse of greedy_eth_addr(). */
+  static inline void
+  mac_coords(uint64_t addr, int64_t& x, int64_t& y)
+  {
+    x = (addr >> 40 & 0xff) | (addr >> 24 & 0xff00) | (addr >> 8 & 0xff0000);
+    y = (addr >> 16 & 0xff) | (addr & 0xff00) | (addr << 16 & 0xff0000);
+  }
+
+  static inline bool
+  masked_eq(uint64_t value, uint64_t mask, uint64_t v)
+  {
+    return ((value ^ v) & ~mask) == 0;
+  }
+
+  /* Xor everything of 'src' under the top label into 'dst'. */
+  static void
+  xor_packet(b_packet& dst, const b_packet& src)
+  {
+    size_t n = std::min(dst.num_labels, src.num_labels);
+    for (size_t i = 1; i < n; i++)
+      dst.labels[i] ^= src.labels[i];
+    dst.ipv4_src ^= src.ipv4_src;
+    dst.ipv4_dst ^= src.ipv4_dst;
+    dst.tp_src ^= src.tp_src;
+    dst.tp_dst ^= src.tp_dst;
+
+    if (dst.payload.size() < src.payload.size())
+      dst.payload.resize(src.payload.size(), 0);
+    for (size_t i = 0; i < src.payload.size(); i++)
+      dst.payload[i] ^= src.payload[i];
+  }
+
+  b_packet::b_packet()
+    : in_port(0), eth_src(0), eth_dst(0), eth_type(ETH_TYPE_IP),
+      num_labels(0), ipv4_src(0), ipv4_dst(0), nw_proto(IP_TYPE_UDP),
+      nw_ttl(64), tp_src(0), tp_dst(0)
+  {
+    memset(labels, 0x00, sizeof labels);
+  }
+
+  void
+  b_pipeline_stats::add(const b_pipeline_stats& s)
+  {
+    packets     += s.packets;
+    lookups     += s.lookups;
+    misses      += s.misses;
+    outputs     += s.outputs;
+    dropped     += s.dropped;
+    unsupported += s.unsupported;
+    encoded     += s.encoded;
+    decoded     += s.decoded;
+  }
+
+  b_pipeline::b_pipeline(uint32_t hold_ms, uint32_t decode_ms)
+    : depth(0), hold_ms(hold_ms), decode_ms(decode_ms), now(0), counter(0),
+      metadata_counter(0)
+  {
+    memset(&st, 0x00, sizeof st);
+  }
+
+  // ----------------------------------------------------------------------
+
+  bool
+  b_pipeline::matches(const match& m, const b_packet& p, uint64_t metadata)
+  {
+    uint32_t w = m.wildcards;
+    if (!(w & OFPFW_IN_PORT) && m.in_port != p.in_port)
+      return false;
+    if (!(w & OFPFW_DL_VLAN) && m.dl_vlan != OFPVID_NONE)
+      return false;
+    if (!masked_eq(m.dl_src, m.dl_src_mask, p.eth_src)
+        || !masked_eq(m.dl_dst, m.dl_dst_mask, p.eth_dst))
+      return false;
+
+    uint16_t dl_type = p.dl_type();
+    if (!(w & OFPFW_DL_TYPE) && m.dl_type != dl_type)
+      return false;
+    if (dl_type == ETH_TYPE_IP) {
+      if (!masked_eq(m.nw_src, m.nw_src_mask, p.ipv4_src)
+          || !masked_eq(m.nw_dst, m.nw_dst_mask, p.ipv4_dst))
+        return false;
+      if (!(w & OFPFW_NW_TOS) && m.nw_tos != 0)
+        return false;
+      if (!(w & OFPFW_NW_PROTO) && m.nw_proto != p.nw_proto)
+        return false;
+      if (p.nw_proto == IP_TYPE_UDP || p.nw_proto == IP_TYPE_TCP) {
+        if (!(w & OFPFW_TP_SRC) && m.tp_src != p.tp_src)
+          return false;
+        if (!(w & OFPFW_TP_DST) && m.tp_dst != p.tp_dst)
+          return false;
+      }
+    } else if (dl_type == ETH_TYPE_MPLS) {
+      if (!(w & OFPFW_MPLS_LABEL) && m.mpls_label != p.labels[0])
+        return false;
+      if (!(w & OFPFW_MPLS_TC) && m.mpls_tc != 0)
+        return false;
+    }
+
+    return masked_eq(m.metadata, m.metadata_mask, metadata);
+  }
+
+  static inline bool
+  fixed_covers(uint32_t gw, uint32_t w, uint32_t flag, uint64_t gv,
+               uint64_t v)
+  {
+    return (gw & flag) || (!(w & flag) && gv == v);
+  }
+
+  static inline bool
+  mask_covers(uint64_t gv, uint64_t gmask, uint64_t v, uint64_t mask)
+  {
+    return (mask & ~gmask) == 0 && ((gv ^ v) & ~gmask) == 0;
+  }
+
+  /* True if every packet 'm' matches is matched by 'general' too, the
+   * test of non-strict OFPFC_MODIFY and OFPFC_DELETE. */
+  bool
+  b_pipeline::covers(const match& g, const match& m)
+  {
+    uint32_t gw = g.wildcards, w = m.wildcards;
+    return fixed_covers(gw, w, OFPFW_IN_PORT, g.in_port, m.in_port)
+      && fixed_covers(gw, w, OFPFW_DL_VLAN, g.dl_vlan, m.dl_vlan)
+      && fixed_covers(gw, w, OFPFW_DL_VLAN_PCP, g.dl_vlan_pcp, m.dl_vlan_pcp)
+      && fixed_covers(gw, w, OFPFW_DL_TYPE, g.dl_type, m.dl_type)
+      && fixed_covers(gw, w, OFPFW_NW_TOS, g.nw_tos, m.nw_tos)
+      && fixed_covers(gw, w, OFPFW_NW_PROTO, g.nw_proto, m.nw_proto)
+      && fixed_covers(gw, w, OFPFW_TP_SRC, g.tp_src, m.tp_src)
+      && fixed_covers(gw, w, OFPFW_TP_DST, g.tp_dst, m.tp_dst)
+      && fixed_covers(gw, w, OFPFW_MPLS_LABEL, g.mpls_label, m.mpls_label)
+      && fixed_covers(gw, w, OFPFW_MPLS_TC, g.mpls_tc, m.mpls_tc)
+      && mask_covers(g.dl_src, g.dl_src_mask, m.dl_src, m.dl_src_mask)
+      && mask_covers(g.dl_dst, g.dl_dst_mask, m.dl_dst, m.dl_dst_mask)
+      && mask_covers(g.nw_src, g.nw_src_mask, m.nw_src, m.nw_src_mask)
+      && mask_covers(g.nw_dst, g.nw_dst_mask, m.nw_dst, m.nw_dst_mask)
+      && mask_covers(g.metadata, g.metadata_mask,
+                     m.metadata, m.metadata_mask);
+  }
+
+  bool
+  b_pipeline::same(const match& a, const match& b)
+  {
+    return a.wildcards == b.wildcards && a.in_port == b.in_port
+      && a.dl_src == b.dl_src && a.dl_src_mask == b.dl_src_mask
+      && a.dl_dst == b.dl_dst && a.dl_dst_mask == b.dl_dst_mask
+      && a.dl_vlan == b.dl_vlan && a.dl_vlan_pcp == b.dl_vlan_pcp
+      && a.dl_type == b.dl_type && a.nw_tos == b.nw_tos
+      && a.nw_proto == b.nw_proto
+      && a.nw_src == b.nw_src && a.nw_src_mask == b.nw_src_mask
+      && a.nw_dst == b.nw_dst && a.nw_dst_mask == b.nw_dst_mask
+      && a.tp_src == b.tp_src && a.tp_dst == b.tp_dst
+      && a.mpls_label == b.mpls_label && a.mpls_tc == b.mpls_tc
+      && a.metadata == b.metadata && a.metadata_mask == b.metadata_mask;
+  }
+
+  /* Position of an action in the action set, OpenFlow 1.1 5.10. */
+  static int
+  set_rank(uint16_t type, uint32_t subtype)
+  {
+    switch (type) {
+    case OFPAT_COPY_TTL_IN:   return 0;
+    case OFPAT_POP_VLAN:
+    case OFPAT_POP_MPLS:      return 1;
+    case OFPAT_PUSH_MPLS:
+    case OFPAT_PUSH_VLAN:     return 2;
+    case OFPAT_COPY_TTL_OUT:  return 3;
+    case OFPAT_DEC_MPLS_TTL:
+    case OFPAT_DEC_NW_TTL:    return 4;
+    case OFPAT_SET_QUEUE:     return 6;
+    case OFPAT_GROUP:         return 7;
+    case OFPAT_OUTPUT:        return 8;
+    case OFPAT_EXPERIMENTER:
+      return subtype == BME_OUTPUT_BY_METADATA ? 8 : 5;
+    default:                  return 5;       /* set a field */
+    }
+  }
+
+  bool
+  b_pipeline::set_order(const action& a, const action& b)
+  {
+    return set_rank(a.type, a.subtype) < set_rank(b.type, b.subtype);
+  }
+
+  // ----------------------------------------------------------------------
+
+  bool
+  b_pipeline::convert(const struct ofl_match_header *src, match& m)
+  {
+    if (src == NULL || src->type != OFPMT_STANDARD) {
+      err = "only standard matches are supported";
+      return false;
+    }
+
+    const struct ofl_match_standard *s =
+      (const struct ofl_match_standard*)src;
+    uint32_t w = s->wildcards & OFPFW_ALL;
+    memset(&m, 0x00, sizeof m);
+    m.wildcards = w;
+    if (!(w & OFPFW_IN_PORT))
+      m.in_port = s->in_port;
+    if (!(w & OFPFW_DL_VLAN))
+      m.dl_vlan = s->dl_vlan;
+    if (!(w & OFPFW_DL_VLAN_PCP))
+      m.dl_vlan_pcp = s->dl_vlan_pcp;
+    if (!(w & OFPFW_DL_TYPE))
+      m.dl_type = s->dl_type;
+    if (!(w & OFPFW_NW_TOS))
+      m.nw_tos = s->nw_tos;
+    if (!(w & OFPFW_NW_PROTO))
+      m.nw_proto = s->nw_proto;
+    if (!(w & OFPFW_TP_SRC))
+      m.tp_src = s->tp_src;
+    if (!(w & OFPFW_TP_DST))
+      m.tp_dst = s->tp_dst;
+    if (!(w & OFPFW_MPLS_LABEL))
+      m.mpls_label = s->mpls_label;
+    if (!(w & OFPFW_MPLS_TC))
+      m.mpls_tc = s->mpls_tc;
+
+    /* The builder keeps the IPv4 addresses in network byte order. */
+    m.dl_src_mask = mac_to_host(s->dl_src_mask);
+    m.dl_src = mac_to_host(s->dl_src) & ~m.dl_src_mask & mac_mask;
+    m.dl_dst_mask = mac_to_host(s->dl_dst_mask);
+    m.dl_dst = mac_to_host(s->dl_dst) & ~m.dl_dst_mask & mac_mask;
+    m.nw_src_mask = ntohl(s->nw_src_mask);
+    m.nw_src = ntohl(s->nw_src) & ~m.nw_src_mask;
+    m.nw_dst_mask = ntohl(s->nw_dst_mask);
+    m.nw_dst = ntohl(s->nw_dst) & ~m.nw_dst_mask;
+    m.metadata_mask = s->metadata_mask;
+    m.metadata = s->metadata & ~m.metadata_mask;
+
+    return true;
+  }
+
+  bool
+  b_pipeline::convert(const struct ofl_instruction_header *src,
+                      uint8_t table_id, instruction& i)
+  {
+    i.type = src->type;
+    i.table_id = 0;
+    i.metadata = i.mask = 0;
+
+    switch (src->type) {
+    case OFPIT_GOTO_TABLE:
+      i.table_id = ((const struct ofl_instruction_goto_table*)src)->table_id;
+      if (i.table_id <= table_id) {
+        err = "goto_table must lead to a later table";
+        return false;
+      }
+      return true;
+    case OFPIT_WRITE_METADATA: {
+      const struct ofl_instruction_write_metadata *wm =
+        (const struct ofl_instruction_write_metadata*)src;
+      i.metadata = wm->metadata;
+      i.mask = wm->metadata_mask;
+      return true;
+    }
+    case OFPIT_WRITE_ACTIONS:
+    case OFPIT_APPLY_ACTIONS: {
+      const struct ofl_instruction_actions *ia =
+        (const struct ofl_instruction_actions*)src;
+      i.actions.resize(ia->actions_num);
+      for (size_t j = 0; j < ia->actions_num; j++) {
+        if (!convert(ia->actions[j], i.actions[j]))
+          return false;
+      }
+      return true;
+    }
+    case OFPIT_CLEAR_ACTIONS:
+      return true;
+    default:
+      err = "unsupported instruction";
+      return false;
+    }
+  }
+
+  /* Actions the emulator lacks are kept, and drop the packets they
+   * are executed on. */
+  bool
+  b_pipeline::convert(const struct ofl_action_header *src, action& a)
+  {
+    memset(&a, 0x00, sizeof a);
+    a.type = src->type;
+
+    switch (src->type) {
+    case OFPAT_OUTPUT:
+      a.arg[0] = ((const struct ofl_action_output*)src)->port;
+      break;
+    case OFPAT_SET_DL_SRC:
+    case OFPAT_SET_DL_DST:
+      a.addr = mac_to_host(((const struct ofl_action_dl_addr*)src)->dl_addr);
+      break;
+    case OFPAT_SET_NW_SRC:
+    case OFPAT_SET_NW_DST:
+      a.arg[0] = ntohl(((const struct ofl_action_nw_addr*)src)->nw_addr);
+      break;
+    case OFPAT_SET_MPLS_LABEL:
+      a.arg[0] = ((const struct ofl_action_mpls_label*)src)->mpls_label;
+      break;
+    case OFPAT_PUSH_MPLS:
+      a.arg[0] = ((const struct ofl_action_push*)src)->ethertype;
+      break;
+    case OFPAT_POP_MPLS:
+      a.arg[0] = ((const struct ofl_action_pop_mpls*)src)->ethertype;
+      break;
+    case OFPAT_EXPERIMENTER: {
+      const struct ofl_bme_action_header *h =
+        (const struct ofl_bme_action_header*)src;
+      if (h->experimenter_id != BME_EXPERIMENTER_ID) {
+        a.subtype = ~0U;
+        break;
+      }
+      a.subtype = h->type;
+      switch (h->type) {
+      case BME_SET_METADATA_FROM_COUNTER:
+        a.arg[0] = ((const struct ofl_bme_set_metadata_from_counter*)src)
+          ->max_num;
+        break;
+      case BME_XOR_ENCODE:
+      case BME_XOR_DECODE: {
+        const struct ofl_bme_xor_packet *x =
+          (const struct ofl_bme_xor_packet*)src;
+        a.arg[0] = x->label_a;
+        a.arg[1] = x->label_b;
+        break;
+      }
+      case BME_UPDATE_DISTANCE_IN_METADATA: {
+        const struct ofl_bme_update_distance *u =
+          (const struct ofl_bme_update_distance*)src;
+        a.arg[0] = u->port;
+        a.addr = mac_to_host(u->hw_addr);
+        break;
+      }
+      case BME_SERIALIZE: {
+        const struct ofl_bme_serialize *s =
+          (const struct ofl_bme_serialize*)src;
+        a.arg[0] = s->mpls_label;
+        a.arg[1] = s->timeout;
+        break;
+      }
+      default:
+        break;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+
+    return true;
+  }
+
+  bool
+  b_pipeline::flow_mod(const struct ofl_msg_flow_mod *fm)
+  {
+    match m;
+    if (!convert(fm->match, m))
+      return false;
+    bool all_tables = fm->table_id == OFPTT_ALL;
+    if (all_tables && fm->command != OFPFC_DELETE
+        && fm->command != OFPFC_DELETE_STRICT) {
+      err = "only a delete may refer to every table";
+      return false;
+    }
+
+    std::vector<instruction> instrs(fm->instructions_num);
+    for (size_t i = 0; i < fm->instructions_num; i++) {
+      if (!convert(fm->instructions[i], fm->table_id, instrs[i]))
+        return false;
+    }
+
+    switch (fm->command) {
+    case OFPFC_ADD: {
+      entry e;
+      e.priority = fm->priority;
+      e.cookie = fm->cookie;
+      e.m = m;
+      e.instructions.swap(instrs);
+      e.packet_count = 0;
+      add(fm->table_id, e);
+      break;
+    }
+    case OFPFC_MODIFY:
+    case OFPFC_MODIFY_STRICT:
+      modify(fm, m, instrs, fm->command == OFPFC_MODIFY_STRICT);
+      break;
+    case OFPFC_DELETE:
+    case OFPFC_DELETE_STRICT:
+      remove(fm, m, fm->command == OFPFC_DELETE_STRICT);
+      break;
+    default:
+      err = "unknown flow-mod command";
+      return false;
+    }
+
+    return true;
+  }
+
+  bool
+  b_pipeline::message(const struct ofp_header *oh)
+  {
+    if (oh->type == OFPT_BARRIER_REQUEST)
+      return true;
+    if (oh->type != OFPT_FLOW_MOD) {
+      err = "only flow-mods and barriers are supported";
+      return false;
+    }
+
+    struct ofl_msg_header *msg = b_msg_unpack(oh);
+    if (msg == NULL) {
+      err = "malformed flow-mod";
+      return false;
+    }
+    bool ok = flow_mod((const struct ofl_msg_flow_mod*)msg);
+    b_msg_free(msg);
+
+    return ok;
+  }
+
+  /* An entry of the same priority and match is replaced, otherwise
+   * the new one goes after those of its priority. */
+  void
+  b_pipeline::add(uint8_t table_id, entry& e)
+  {
+    if (table_id >= tables.size())
+      tables.resize(table_id + 1);
+    std::vector<entry>& t = tables[table_id];
+
+    std::vector<entry>::iterator i = t.begin();
+    for (; i != t.end() && i->priority >= e.priority; i++) {
+      if (i->priority == e.priority && same(i->m, e.m)) {
+        i->cookie = e.cookie;
+        i->instructions.swap(e.instructions);
+        i->packet_count = 0;
+        return;
+      }
+    }
+    t.insert(i, e);
+  }
+
+  void
+  b_pipeline::modify(const struct ofl_msg_flow_mod *fm, const match& m,
+                     const std::vector<instruction>& instrs, bool strict)
+  {
+    bool found = false;
+    if (fm->table_id < tables.size()) {
+      std::vector<entry>& t = tables[fm->table_id];
+      for (size_t i = 0; i < t.size(); i++) {
+        entry& e = t[i];
+        if (strict ? e.priority != fm->priority || !same(m, e.m)
+                   : !covers(m, e.m))
+          continue;
+        if ((e.cookie ^ fm->cookie) & fm->cookie_mask)
+          continue;
+        e.instructions = instrs;
+        found = true;
+      }
+    }
+    if (found)
+      return;
+
+    /* A modify of nothing is an add in OpenFlow 1.1. */
+    entry e;
+    e.priority = fm->priority;
+    e.cookie = fm->cookie;
+    e.m = m;
+    e.instructions = instrs;
+    e.packet_count = 0;
+    add(fm->table_id, e);
+  }
+
+  void
+  b_pipeline::remove(const struct ofl_msg_flow_mod *fm, const match& m,
+                     bool strict)
+  {
+    size_t first = fm->table_id, last = fm->table_id;
+    if (fm->table_id == OFPTT_ALL) {
+      first = 0;
+      last = tables.size() - 1;
+    }
+
+    for (size_t t = first; t <= last && t < tables.size(); t++) {
+      std::vector<entry>& tbl = tables[t];
+      std::vector<entry>::iterator i = tbl.begin();
+      while (i != tbl.end()) {
+        bool hit = strict ? i->priority == fm->priority && same(m, i->m)
+                          : covers(m, i->m);
+        hit = hit && !((i->cookie ^ fm->cookie) & fm->cookie_mask);
+        if (hit && fm->out_port != OFPP_ANY) {
+          hit = false;
+          for (size_t j = 0; !hit && j < i->instructions.size(); j++) {
+            const std::vector<action>& acts = i->instructions[j].actions;
+            for (size_t k = 0; !hit && k < acts.size(); k++)
+              hit = acts[k].type == OFPAT_OUTPUT
+                && acts[k].arg[0] == fm->out_port;
+          }
+        }
+        if (hit)
+          i = tbl.erase(i);
+        else
+          i++;
+      }
+    }
+  }
+
+  size_t
+  b_pipeline::num_entries() const
+  {
+    size_t n = 0;
+    for (size_t t = 0; t < tables.size(); t++)
+      n += tables[t].size();
+    return n;
+  }
+
+  // ----------------------------------------------------------------------
+
+  void
+  b_pipeline::process(const b_packet& p, std::vector<b_output>& out)
+  {
+    pending.push_back(std::make_pair(p, 0U));
+    run(out);
+  }
+
+  void
+  b_pipeline::tick(uint32_t ms, std::vector<b_output>& out)
+  {
+    now += ms;
+    depth = 0;
+
+    std::unordered_map<uint32_t, held>::iterator e = encode_buf.begin();
+    while (e != encode_buf.end()) {
+      if (e->second.expires <= now) {
+        release(e->second.packet, e->second.label);
+        e = encode_buf.erase(e);
+      } else {
+        e++;
+      }
+    }
+
+    std::unordered_map<uint64_t, held>::iterator d = decode_buf.begin();
+    while (d != decode_buf.end()) {
+      if (d->second.expires <= now)
+        d = decode_buf.erase(d);
+      else
+        d++;
+    }
+
+    /* An expired packet leaves with everything before it. */
+    std::unordered_map<uint32_t, reorder>::iterator s;
+    for (s = serial.begin(); s != serial.end(); s++) {
+      reorder& r = s->second;
+      for (;;) {
+        std::map<uint32_t, held>::const_iterator w = r.waiting.begin();
+        while (w != r.waiting.end() && w->second.expires > now)
+          w++;
+        if (w == r.waiting.end())
+          break;
+        r.next = r.waiting.begin()->first;
+        drain(r);
+      }
+    }
+
+    run(out);
+  }
+
+  void
+  b_pipeline::run(std::vector<b_output>& out)
+  {
+    while (!pending.empty()) {
+      b_packet p(std::move(pending.front().first));
+      depth = pending.front().second;
+      pending.pop_front();
+      pass(p, out);
+    }
+  }
+
+  void
+  b_pipeline::pass(b_packet& p, std::vector<b_output>& out)
+  {
+    uint64_t metadata = 0;
+    uint64_t outputs = st.outputs;
+    uint8_t table_id = 0;
+    verdict v = GO_ON;
+
+    st.packets++;
+    action_set.clear();
+    for (;;) {
+      entry *e = lookup(table_id, p, metadata);
+      if (e == NULL) {
+        st.misses++;
+        return;
+      }
+
+      int next = -1;
+      std::vector<instruction>::const_iterator i;
+      for (i = e->instructions.begin();
+           v == GO_ON && i != e->instructions.end(); i++) {
+        std::vector<action>::const_iterator a;
+        switch (i->type) {
+        case OFPIT_GOTO_TABLE:
+          next = i->table_id;
+          break;
+        case OFPIT_WRITE_METADATA:
+          metadata = (metadata & ~i->mask) | (i->metadata & i->mask);
+          break;
+        case OFPIT_WRITE_ACTIONS:
+          for (a = i->actions.begin(); a != i->actions.end(); a++)
+            write_action(*a);
+          break;
+        case OFPIT_APPLY_ACTIONS:
+          for (a = i->actions.begin();
+               v == GO_ON && a != i->actions.end(); a++)
+            v = execute(*a, p, metadata, out);
+          break;
+        case OFPIT_CLEAR_ACTIONS:
+          action_set.clear();
+          break;
+        }
+      }
+      if (v != GO_ON || next < 0)
+        break;
+      table_id = next;
+    }
+
+    if (v == GO_ON && !action_set.empty()) {
+      std::stable_sort(action_set.begin(), action_set.end(), set_order);
+      std::vector<action>::const_iterator a;
+      for (a = action_set.begin(); v == GO_ON && a != action_set.end(); a++)
+        v = execute(*a, p, metadata, out);
+    }
+    if (v != TAKEN && st.outputs == outputs)
+      st.dropped++;
+  }
+
+  b_pipeline::entry*
+  b_pipeline::lookup(uint8_t table_id, const b_packet& p, uint64_t metadata)
+  {
+    if (table_id >= tables.size())
+      return NULL;
+
+    st.lookups++;
+    std::vector<entry>& t = tables[table_id];
+    for (size_t i = 0; i < t.size(); i++) {
+      if (matches(t[i].m, p, metadata)) {
+        t[i].packet_count++;
+        return &t[i];
+      }
+    }
+    return NULL;
+  }
+
+  /* The action set holds one action of a type. */
+  void
+  b_pipeline::write_action(const action& a)
+  {
+    for (size_t i = 0; i < action_set.size(); i++) {
+      if (action_set[i].type == a.type && action_set[i].subtype == a.subtype) {
+        action_set[i] = a;
+        return;
+      }
+    }
+    action_set.push_back(a);
+  }
+
+  b_pipeline::verdict
+  b_pipeline::execute(const action& a, b_packet& p, uint64_t& metadata,
+                      std::vector<b_output>& out)
+  {
+    switch (a.type) {
+    case OFPAT_OUTPUT:
+      output(a.arg[0], p, out);
+      return GO_ON;
+    case OFPAT_SET_DL_SRC:
+      p.eth_src = a.addr;
+      return GO_ON;
+    case OFPAT_SET_DL_DST:
+      p.eth_dst = a.addr;
+      return GO_ON;
+    case OFPAT_SET_NW_SRC:
+      p.ipv4_src = a.arg[0];
+      return GO_ON;
+    case OFPAT_SET_NW_DST:
+      p.ipv4_dst = a.arg[0];
+      return GO_ON;
+    case OFPAT_SET_MPLS_LABEL:
+      if (p.num_labels == 0)
+        return DROP;
+      p.labels[0] = a.arg[0] & 0xfffff;
+      return GO_ON;
+    case OFPAT_DEC_MPLS_TTL:
+      /* The TTLs of the labels are not modelled. */
+      return p.num_labels ? GO_ON : DROP;
+    case OFPAT_DEC_NW_TTL:
+      if (p.dl_type() != ETH_TYPE_IP || p.nw_ttl <= 1)
+        return DROP;
+      p.nw_ttl--;
+      return GO_ON;
+    case OFPAT_PUSH_MPLS:
+      if (p.num_labels == b_packet::max_labels)
+        return DROP;
+      memmove(p.labels + 1, p.labels, p.num_labels * sizeof p.labels[0]);
+      p.labels[0] = p.num_labels ? p.labels[1] : 0;
+      p.num_labels++;
+      return GO_ON;
+    case OFPAT_POP_MPLS:
+      if (p.num_labels == 0)
+        return DROP;
+      p.num_labels--;
+      memmove(p.labels, p.labels + 1, p.num_labels * sizeof p.labels[0]);
+      p.labels[p.num_labels] = 0;
+      if (p.num_labels == 0)
+        p.eth_type = a.arg[0];
+      return GO_ON;
+    case OFPAT_EXPERIMENTER:
+      return experimenter(a, p, metadata, out);
+    default:
+      st.unsupported++;
+      return DROP;
+    }
+  }
+
+  b_pipeline::verdict
+  b_pipeline::experimenter(const action& a, b_packet& p, uint64_t& metadata,
+                           std::vector<b_output>& out)
+  {
+    switch (a.subtype) {
+    case BME_SET_MPLS_LABEL_FROM_COUNTER:
+      if (p.num_labels == 0)
+        return DROP;
+      counter = counter % 0xfffff + 1;
+      p.labels[0] = counter;
+      return GO_ON;
+    case BME_SET_METADATA_FROM_COUNTER:
+      metadata = a.arg[0] ? metadata_counter % a.arg[0] : metadata_counter;
+      metadata_counter++;
+      return GO_ON;
+    case BME_UPDATE_DISTANCE_IN_METADATA: {
+      int64_t x, y, tx, ty;
+      mac_coords(a.addr, x, y);
+      mac_coords(p.eth_dst, tx, ty);
+      uint64_t d = (x - tx) * (x - tx) + (y - ty) * (y - ty);
+      d = std::min(d, max_distance);
+      if (d < metadata >> 16)
+        metadata = d << 16 | (a.arg[0] & 0xffff);
+      return GO_ON;
+    }
+    case BME_OUTPUT_BY_METADATA:
+      output(metadata & 0xffff, p, out);
+      return GO_ON;
+    case BME_XOR_ENCODE:
+      return xor_encode(p, a.arg[0], a.arg[1]);
+    case BME_XOR_DECODE:
+      return xor_decode(p, a.arg[0], a.arg[1]);
+    case BME_SERIALIZE:
+      return serialize(p, a.arg[0], a.arg[1]);
+    default:
+      st.unsupported++;
+      return DROP;
+    }
+  }
+
+  void
+  b_pipeline::output(uint32_t port_no, const b_packet& p,
+                     std::vector<b_output>& out)
+  {
+    if (port_no == OFPP_IN_PORT)
+      port_no = p.in_port;
+    else if (port_no == p.in_port)
+      return;
+
+    st.outputs++;
+    out.push_back(b_output());
+    out.back().port_no = port_no;
+    out.back().packet = p;
+  }
+
+  void
+  b_pipeline::resubmit(const b_packet& p)
+  {
+    if (depth >= max_resubmits) {
+      st.dropped++;
+      return;
+    }
+    pending.push_back(std::make_pair(p, depth + 1));
+  }
+
+  void
+  b_pipeline::release(b_packet& p, uint32_t label)
+  {
+    if (p.num_labels)
+      p.labels[0] = label;
+    resubmit(p);
+  }
+
+  // ----------------------------------------------------------------------
+
+  b_pipeline::verdict
+  b_pipeline::xor_encode(b_packet& p, uint32_t label_a, uint32_t label_b)
+  {
+    if (p.num_labels == 0)
+      return DROP;
+
+    std::unordered_map<uint32_t, held>::iterator h;
+    h = encode_buf.find(label_a);
+    if (h == encode_buf.end()) {
+      held& n = encode_buf[label_a];
+      n.packet = p;
+      n.label = label_b;
+      n.expires = now + hold_ms;
+      return TAKEN;
+    }
+
+    if (h->second.label == label_b) {
+      /* Another one of the same session: the first leaves alone. */
+      release(h->second.packet, label_b);
+      h->second.packet = p;
+      h->second.expires = now + hold_ms;
+      return TAKEN;
+    }
+
+    xor_packet(p, h->second.packet);
+    encode_buf.erase(h);
+    st.encoded += 2;
+    release(p, label_a);
+    return TAKEN;
+  }
+
+  /* A plain packet of the first session has its counter in the second
+   * label and 0 in the third, the other session the other way round,
+   * and a coded packet has both counters.  Plain packets go on with
+   * the actions, coded ones end here. */
+  b_pipeline::verdict
+  b_pipeline::xor_decode(b_packet& p, uint32_t label_a, uint32_t label_b)
+  {
+    if (p.num_labels < 3)
+      return DROP;
+
+    uint32_t ctr_a = p.labels[1], ctr_b = p.labels[2];
+    if (ctr_a && ctr_b) {
+      if (!recover(p, label_a, PLAIN_A, ctr_a, label_b)
+          && !recover(p, label_a, PLAIN_B, ctr_b, label_a)) {
+        keep(p, decode_key(label_a, CODED_A, ctr_a));
+        keep(p, decode_key(label_a, CODED_B, ctr_b));
+      }
+      return TAKEN;
+    } else if (ctr_a) {
+      if (!recover(p, label_a, CODED_A, ctr_a, label_b))
+        keep(p, decode_key(label_a, PLAIN_A, ctr_a));
+    } else if (ctr_b) {
+      if (!recover(p, label_a, CODED_B, ctr_b, label_a))
+        keep(p, decode_key(label_a, PLAIN_B, ctr_b));
+    }
+
+    return GO_ON;
+  }
+
+  void
+  b_pipeline::keep(const b_packet& p, uint64_t key)
+  {
+    if (decode_buf.size() >= max_kept)
+      return;
+
+    held& h = decode_buf[key];
+    h.packet = p;
+    h.label = 0;
+    h.expires = now + decode_ms;
+  }
+
+  /* Xor 'p' with the packet kept as 'kind' and 'counter', if any, and
+   * send the result on with 'label'. */
+  bool
+  b_pipeline::recover(const b_packet& p, uint32_t label_a, unsigned kind,
+                      uint32_t counter, uint32_t label)
+  {
+    std::unordered_map<uint64_t, held>::iterator h;
+    h = decode_buf.find(decode_key(label_a, kind, counter));
+    if (h == decode_buf.end())
+      return false;
+
+    b_packet r(p);
+    const b_packet& k = h->second.packet;
+    xor_packet(r, k);
+    if (kind == CODED_A)
+      decode_buf.erase(decode_key(label_a, CODED_B, k.labels[2]));
+    else if (kind == CODED_B)
+      decode_buf.erase(decode_key(label_a, CODED_A, k.labels[1]));
+    decode_buf.erase(h);
+
+    st.decoded++;
+    release(r, label);
+    return true;
+  }
+
+  b_pipeline::verdict
+  b_pipeline::serialize(b_packet& p, uint32_t label, uint32_t timeout)
+  {
+    if (p.num_labels == 0)
+      return DROP;
+
+    reorder& r = serial[label];
+    uint32_t seq = p.labels[0];
+    if (!r.started) {
+      r.started = true;
+      r.next = seq;
+    }
+
+    if (seq < r.next) {
+      /* Too late to be put in order. */
+      release(p, label);
+    } else if (seq > r.next) {
+      held& h = r.waiting[seq];
+      h.packet = p;
+      h.label = label;
+      h.expires = now + timeout;
+    } else {
+      release(p, label);
+      r.next++;
+      drain(r);
+    }
+
+    return TAKEN;
+  }
+
+  void
+  b_pipeline::drain(reorder& r)
+  {
+    std::map<uint32_t, held>::iterator w = r.waiting.begin();
+    while (w != r.waiting.end() && w->first == r.next) {
+      release(w->second.packet, w->second.label);
+      r.waiting.erase(w++);
+      r.next++;
+    }
+  }
+
+  // ----------------------------------------------------------------------
+
+  b_network::b_network(const adjacency& links)
+    : links(links), n_lost(0)
+  {
+  }
+
+  b_network::~b_network()
+  {
+    for (size_t i = 0; i < switches.size(); i++)
+      delete switches[i];
+  }
+
+  b_pipeline*
+  b_network::add_switch(uint32_t node, uint32_t hold_ms)
+  {
+    if (node >= switches.size())
+      switches.resize(node + 1, 0);
+    if (switches[node] == NULL)
+      switches[node] = new b_pipeline(hold_ms);
+
+    return switches[node];
+  }
+
+  void
+  b_network::send(uint32_t host, const b_packet& p)
+  {
+    if (links.degree(host) == 0) {
+      n_lost++;
+      return;
+    }
+    cross(links.begin(host), 0, p);
+    run();
+  }
+
+  void
+  b_network::tick(uint32_t ms)
+  {
+    for (uint32_t node = 0; node < switches.size(); node++) {
+      if (switches[node] == NULL)
+        continue;
+      out.clear();
+      switches[node]->tick(ms, out);
+      for (size_t i = 0; i < out.size(); i++)
+        forward(node, 0, out[i]);
+    }
+    run();
+  }
+
+  b_pipeline_stats
+  b_network::stats() const
+  {
+    b_pipeline_stats s;
+    memset(&s, 0x00, sizeof s);
+    for (size_t i = 0; i < switches.size(); i++) {
+      if (switches[i])
+        s.add(switches[i]->stats());
+    }
+    return s;
+  }
+
+  void
+  b_network::run()
+  {
+    while (!queue.empty()) {
+      hop h(std::move(queue.front()));
+      queue.pop_front();
+
+      out.clear();
+      switches[h.node]->process(h.packet, out);
+      for (size_t i = 0; i < out.size(); i++)
+        forward(h.node, h.hops, out[i]);
+    }
+  }
+
+  void
+  b_network::forward(uint32_t node, unsigned hops, const b_output& o)
+  {
+    bool flood = o.port_no == OFPP_ALL || o.port_no == OFPP_FLOOD;
+    for (uint32_t i = links.begin(node); i < links.end(node); i++) {
+      uint32_t port_no = links.port_no(i);
+      if (flood ? port_no == o.packet.in_port : port_no != o.port_no)
+        continue;
+      cross(i, hops, o.packet);
+      if (!flood)
+        return;
+    }
+    if (!flood)
+      n_lost++;
+  }
+
+  /* Send 'p' over link 'i'. */
+  void
+  b_network::cross(uint32_t i, unsigned hops, const b_packet& p)
+  {
+    if (hops >= max_hops) {
+      n_lost++;
+      return;
+    }
+
+    uint32_t to = links.neighbor(i);
+    if (get_switch(to) == NULL) {
+      delivered.push_back(b_delivery());
+      delivered.back().host = to;
+      delivered.back().packet = p;
+      return;
+    }
+
+    uint32_t r = links.reverse(i);
+    queue.push_back(hop());
+    hop& h = queue.back();
+    h.node = to;
+    h.hops = hops + 1;
+    h.packet = p;
+    h.packet.in_port = r != adjacency::no_link
+      ? links.port_no(r) : links.port_to(to, links.source(i));
+  }
+} // vigil namespace
@@ -0,0 +1,337 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef ofp_pipeline_HH
+#define ofp_pipeline_HH
+
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "ofp_builder.hh"
+#include "topology.hh"
+
+namespace vigil
+{
+  /* A packet of the emulator: Ethernet, at most max_labels MPLS
+   * headers, IPv4 and UDP.  Addresses are in host byte order, MACs
+   * as greedy_eth_addr() returns them. */
+  struct b_packet
+  {
+    static const size_t max_labels = 8;
+
+    b_packet();
+
+    uint16_t dl_type() const
+    { return num_labels ? ETH_TYPE_MPLS : eth_type; }
+
+    uint32_t in_port;
+    uint64_t eth_src;
+    uint64_t eth_dst;
+    uint16_t eth_type;                  /* under the MPLS headers */
+    uint8_t num_labels;
+    uint32_t labels[max_labels];        /* labels[0] is the outermost */
+    uint32_t ipv4_src;
+    uint32_t ipv4_dst;
+    uint8_t nw_proto;
+    uint8_t nw_ttl;
+    uint16_t tp_src;
+    uint16_t tp_dst;
+    std::vector<uint8_t> payload;
+  };
+
+  struct b_output
+  {
+    uint32_t port_no;
+    b_packet packet;
+  };
+
+  struct b_pipeline_stats
+  {
+    uint64_t packets;       /* passes through table 0, resubmits too */
+    uint64_t lookups;
+    uint64_t misses;        /* table misses, dropped */
+    uint64_t outputs;
+    uint64_t dropped;       /* passes without an output */
+    uint64_t unsupported;   /* actions the emulator lacks, dropped */
+    uint64_t encoded;       /* packets coded by xor_encode */
+    uint64_t decoded;       /* packets recovered by xor_decode */
+
+    void add(const b_pipeline_stats& s);
+  };
+
+  /** \brief Software model of an OpenFlow 1.1 switch of the BME
+   * softswitch, to run the rules of the builder without a switch.
+   *
+   * Flow-mods are taken either as the ofl structures of
+   * b_flow_mod::msg(), or packed, as b_flow_template and b_batch
+   * hold them.  A packet is looked up from table 0, the entries of a
+   * table are scanned in priority order (the earlier one wins a tie)
+   * and a miss drops the packet.  Instructions are executed in the
+   * order of their list, as the BME switch does; the greedy rule
+   * depends on it, it writes the metadata twice.  Apply actions run
+   * at once, write actions fill the action set, which runs in the
+   * order of OpenFlow 1.1 after the last table.  A packet is not sent
+   * back to its in_port unless to OFPP_IN_PORT.
+   *
+   * The experimenter actions work as the app expects them to:
+   *
+   *   set_mpls_label_from_counter  top label := the next value of the
+   *                                switch's counter, 1 to 2^20 - 1
+   *   update_distance_in_metadata  the squared distance of the
+   *                                neighbor from the coordinates of
+   *                                eth_dst replaces the upper 48 bits
+   *                                of the metadata, and the port the
+   *                                lower 16 bits, if it is smaller
+   *   output_by_metadata           output to the lower 16 bits
+   *   xor_encode(a, b)             the packet is held until a packet
+   *                                of the other session reaches the
+   *                                same action (same a, another b),
+   *                                then the two are xored into one
+   *                                labelled a; one left alone for
+   *                                hold_ms leaves labelled b
+   *   xor_decode(a, b)             packets are kept for decode_ms and
+   *                                matched by counters with the coded
+   *                                ones, which go no further: the
+   *                                packet recovered gets label a if
+   *                                it is of the first session (its
+   *                                counter is the second label), b
+   *                                otherwise
+   *   serialize(label, timeout)    packets leave in the order of their
+   *                                top label, the sequence number,
+   *                                labelled 'label'; a gap is waited
+   *                                for at most 'timeout' ms
+   *
+   * Xoring covers everything under the top label: the other labels,
+   * the IPv4 addresses, the ports and the payload, the shorter one
+   * padded with zeros.  Packets made by these actions enter table 0
+   * again, as through OFPP_TABLE.  Time is emulated: held packets
+   * only age by tick().  A pipeline must not be used by several
+   * threads at once.
+   */
+  class b_pipeline
+  {
+  public:
+    static const unsigned max_resubmits = 16;
+
+    b_pipeline(uint32_t hold_ms = 10, uint32_t decode_ms = 1000);
+
+    /* False with error() set if the flow-mod is rejected. */
+    bool flow_mod(const struct ofl_msg_flow_mod *fm);
+    /* Flow-mods are applied, barriers ignored, the rest rejected. */
+    bool message(const struct ofp_header *oh);
+
+    /* Run 'p' through the tables, append the copies sent out. */
+    void process(const b_packet& p, std::vector<b_output>& out);
+    /* Let 'ms' pass, append the copies of released packets. */
+    void tick(uint32_t ms, std::vector<b_output>& out);
+
+    size_t num_entries() const;
+    const b_pipeline_stats& stats() const { return st; }
+    const std::string& error() const { return err; }
+
+  private:
+    /* Fields the emulator compares, in host byte order.  Wildcarded
+     * fields and wildcarded bits (1 in a mask) are zeroed, so equal
+     * matches are equal field by field. */
+    struct match
+    {
+      uint32_t wildcards;
+      uint32_t in_port;
+      uint64_t dl_src, dl_src_mask;
+      uint64_t dl_dst, dl_dst_mask;
+      uint16_t dl_vlan;
+      uint8_t dl_vlan_pcp;
+      uint16_t dl_type;
+      uint8_t nw_tos;
+      uint8_t nw_proto;
+      uint32_t nw_src, nw_src_mask;
+      uint32_t nw_dst, nw_dst_mask;
+      uint16_t tp_src, tp_dst;
+      uint32_t mpls_label;
+      uint8_t mpls_tc;
+      uint64_t metadata, metadata_mask;
+    };
+
+    struct action
+    {
+      uint16_t type;            /* OFPAT_* */
+      uint32_t subtype;         /* BME_* of OFPAT_EXPERIMENTER */
+      uint32_t arg[2];
+      uint64_t addr;
+    };
+
+    struct instruction
+    {
+      uint16_t type;            /* OFPIT_* */
+      uint8_t table_id;
+      uint64_t metadata, mask;
+      std::vector<action> actions;
+    };
+
+    struct entry
+    {
+      uint16_t priority;
+      uint64_t cookie;
+      match m;
+      std::vector<instruction> instructions;
+      uint64_t packet_count;
+    };
+
+    enum verdict { GO_ON, TAKEN, DROP };
+
+    struct held
+    {
+      b_packet packet;
+      uint32_t label;           /* to leave with */
+      uint64_t expires;
+    };
+
+    struct reorder
+    {
+      reorder() : started(false), next(0) {}
+
+      bool started;
+      uint32_t next;
+      std::map<uint32_t, held> waiting;     /* by sequence number */
+    };
+
+    std::vector<std::vector<entry> > tables;
+    std::deque<std::pair<b_packet, unsigned> > pending;
+    unsigned depth;             /* resubmits of the packet at hand */
+    std::vector<action> action_set;
+    b_pipeline_stats st;
+    std::string err;
+
+    uint32_t hold_ms;
+    uint32_t decode_ms;
+    uint64_t now;
+    uint32_t counter;
+    uint64_t metadata_counter;
+    std::unordered_map<uint32_t, held> encode_buf;  /* by label a */
+    std::unordered_map<uint64_t, held> decode_buf;  /* see decode_key() */
+    std::unordered_map<uint32_t, reorder> serial;   /* by label */
+
+    static bool matches(const match& m, const b_packet& p,
+                        uint64_t metadata);
+    static bool covers(const match& general, const match& m);
+    static bool same(const match& a, const match& b);
+    static bool set_order(const action& a, const action& b);
+
+    bool convert(const struct ofl_match_header *src, match& m);
+    bool convert(const struct ofl_instruction_header *src,
+                 uint8_t table_id, instruction& i);
+    bool convert(const struct ofl_action_header *src, action& a);
+    void add(uint8_t table_id, entry& e);
+    void modify(const struct ofl_msg_flow_mod *fm, const match& m,
+                const std::vector<instruction>& instrs, bool strict);
+    void remove(const struct ofl_msg_flow_mod *fm, const match& m,
+                bool strict);
+
+    void run(std::vector<b_output>& out);
+    void pass(b_packet& p, std::vector<b_output>& out);
+    entry* lookup(uint8_t table_id, const b_packet& p, uint64_t metadata);
+    void write_action(const action& a);
+    verdict execute(const action& a, b_packet& p, uint64_t& metadata,
+                    std::vector<b_output>& out);
+    verdict experimenter(const action& a, b_packet& p, uint64_t& metadata,
+                         std::vector<b_output>& out);
+    void output(uint32_t port_no, const b_packet& p,
+                std::vector<b_output>& out);
+    void resubmit(const b_packet& p);
+    void release(b_packet& p, uint32_t label);
+    void keep(const b_packet& p, uint64_t key);
+    bool recover(const b_packet& p, uint32_t label_a, unsigned kind,
+                 uint32_t counter, uint32_t label);
+
+    verdict xor_encode(b_packet& p, uint32_t label_a, uint32_t label_b);
+    verdict xor_decode(b_packet& p, uint32_t label_a, uint32_t label_b);
+    verdict serialize(b_packet& p, uint32_t label, uint32_t timeout);
+    void drain(reorder& r);
+  };
+
+  /* A copy of a packet that reached a host. */
+  struct b_delivery
+  {
+    uint32_t host;
+    b_packet packet;
+  };
+
+  /** \brief Switches of a topology, each running a b_pipeline.
+   *
+   * Nodes without a pipeline are hosts, a packet reaching one of them
+   * is delivered.  Ports are those of the links; OFPP_ALL and
+   * OFPP_FLOOD send to every link but the in_port.  A packet is lost
+   * if it is sent to a port without a link, to the controller, or
+   * across more than max_hops links (a loop).
+   */
+  class b_network
+  {
+  public:
+    static const unsigned max_hops = 64;
+
+    b_network(const adjacency& links);
+    ~b_network();
+
+    /* The pipeline of 'node', created on the first call. */
+    b_pipeline* add_switch(uint32_t node, uint32_t hold_ms = 10);
+    /* NULL if 'node' is a host. */
+    b_pipeline* get_switch(uint32_t node) const
+    { return node < switches.size() ? switches[node] : 0; }
+
+    /* Send 'p' from 'host' over its first link, and forward every
+     * copy until it is delivered, lost or held by a switch. */
+    void send(uint32_t host, const b_packet& p);
+    /* Let 'ms' pass on every switch, and forward what they release. */
+    void tick(uint32_t ms);
+
+    std::vector<b_delivery>& deliveries() { return delivered; }
+    uint64_t lost() const { return n_lost; }
+    /* Sum of the switches' stats. */
+    b_pipeline_stats stats() const;
+
+  private:
+    struct hop
+    {
+      uint32_t node;
+      unsigned hops;
+      b_packet packet;
+    };
+
+    const adjacency& links;
+    std::vector<b_pipeline*> switches;
+    std::deque<hop> queue;
+    std::vector<b_output> out;
+    std::vector<b_delivery> delivered;
+    uint64_t n_lost;
+
+    void forward(uint32_t node, unsigned hops, const b_output& o);
+    void cross(uint32_t i, unsigned hops, const b_packet& p);
+    void run();
+
+    b_network(const b_network&);
+    b_network& operator=(const b_network&);
+  };
+} // vigil namespace
+
+#endif
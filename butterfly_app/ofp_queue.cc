@@ -0,0 +1,168 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "ofp_queue.hh"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "packets.h"
+
+namespace vigil
+{
+  b_dp_queue::b_dp_queue(size_t high_water, size_t *total_queued)
+    : drain_scheduled(false), high_water(high_water), queued(0),
+      total_queued(total_queued)
+  {
+  }
+
+  /* Queue a closed batch.  The queue owns it from now on.  'tries' is
+   * recorded for each of its messages. */
+  void
+  b_dp_queue::push(b_batch *batch, int tries)
+  {
+    const struct iovec *msgs = batch->msgs();
+    for (size_t i = 0; i < batch->num_msgs(); i++) {
+      sent_msg m;
+      m.oh = (const struct ofp_header*)msgs[i].iov_base;
+      m.tries = tries;
+      by_xid[ntohl(m.oh->xid)] = m;
+    }
+
+    queued += batch->size();
+    if (total_queued)
+      *total_queued += batch->size();
+    waiting.push_back(batch);
+  }
+
+  /* Send as much as 'send' accepts.  On EAGAIN the batch is tried
+   * again on the next call and EAGAIN is returned.  A batch failing
+   * with any other error is dropped, so it neither blocks the batches
+   * behind it nor stays counted as queued; the last such error is
+   * returned once the queue is empty, 0 if there was none. */
+  int
+  b_dp_queue::drain(const b_batch::sender &send)
+  {
+    int dropped = 0;
+
+    while (!waiting.empty()) {
+      b_batch *batch = waiting.front();
+      int error = batch->send(send);
+      if (error == EAGAIN)
+        return error;
+
+      queued -= batch->size();
+      if (total_queued)
+        *total_queued -= batch->size();
+      waiting.pop_front();
+      if (error) {
+        forget(batch);
+        dropped = error;
+        continue;
+      }
+      in_flight.push_back(batch);
+    }
+
+    return dropped;
+  }
+
+  void
+  b_dp_queue::forget(b_batch *batch)
+  {
+    const struct iovec *msgs = batch->msgs();
+    for (size_t i = 0; i < batch->num_msgs(); i++) {
+      const struct ofp_header *oh = (const struct ofp_header*)msgs[i].iov_base;
+      by_xid.erase(ntohl(oh->xid));
+    }
+    delete batch;
+  }
+
+  /* The switch has processed everything up to 'barrier_xid'.  Barriers
+   * are answered in order, so the batches before it are done too.
+   * Returns false if no batch of this queue ends with 'barrier_xid'. */
+  bool
+  b_dp_queue::ack(uint32_t barrier_xid)
+  {
+    std::deque<b_batch*>::iterator i;
+    for (i = in_flight.begin(); i != in_flight.end(); i++) {
+      if ((*i)->barrier_xid() == barrier_xid)
+        break;
+    }
+    if (i == in_flight.end())
+      return false;
+
+    ++i;
+    for (std::deque<b_batch*>::iterator j = in_flight.begin(); j != i; j++)
+      forget(*j);
+    in_flight.erase(in_flight.begin(), i);
+
+    return true;
+  }
+
+  /* The message sent with 'xid', or NULL if it is not known (any
+   * more). */
+  const struct ofp_header*
+  b_dp_queue::lookup(uint32_t xid) const
+  {
+    std::unordered_map<uint32_t, sent_msg>::const_iterator i;
+    i = by_xid.find(xid);
+
+    return i == by_xid.end() ? NULL : i->second.oh;
+  }
+
+  /* Queue a copy of the message sent with 'xid' under a fresh xid,
+   * followed by a barrier.  Returns false if the message is unknown,
+   * has been sent 'max_tries' times already or cannot be copied. */
+  bool
+  b_dp_queue::retry(uint32_t xid, int max_tries)
+  {
+    std::unordered_map<uint32_t, sent_msg>::iterator i = by_xid.find(xid);
+    if (i == by_xid.end() || i->second.tries + 1 >= max_tries)
+      return false;
+
+    size_t len = ntohs(i->second.oh->length);
+    struct ofp_header *oh = (struct ofp_header*)malloc(len);
+    if (oh == NULL)
+      return false;
+    memcpy(oh, i->second.oh, len);
+    oh->xid = htonl(b_flow_mod::get_new_xid());
+
+    b_batch *batch = new b_batch();
+    batch->add(oh);
+    batch->close();
+    push(batch, i->second.tries + 1);
+
+    return true;
+  }
+
+  b_dp_queue::~b_dp_queue()
+  {
+    if (total_queued)
+      *total_queued -= queued;
+    while (!waiting.empty()) {
+      delete waiting.front();
+      waiting.pop_front();
+    }
+    while (!in_flight.empty()) {
+      delete in_flight.front();
+      in_flight.pop_front();
+    }
+  }
+} // vigil namespace
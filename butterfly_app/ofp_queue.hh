@@ -0,0 +1,84 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef ofp_queue_HH
+#define ofp_queue_HH
+
+#include <deque>
+#include <unordered_map>
+#include "ofp_batch.hh"
+
+namespace vigil
+{
+  /** \brief Outbound queue of one datapath.
+   *
+   * Closed batches wait here until the connection accepts them, then
+   * stay until the switch answers their barrier request.  Until then
+   * every message can be looked up by its xid, so an OFPT_ERROR can
+   * be traced back to the rule that caused it and the rule can be
+   * sent again.  Nothing here blocks: drain() stops when the sender
+   * reports EAGAIN and is expected to be called again later, a batch
+   * the sender fails with another error is dropped.  If
+   * 'total_queued' is given, the queue keeps its bytes waiting to be
+   * sent added to it, so several queues can share a backlog counter.
+   */
+  class b_dp_queue
+  {
+  public:
+    b_dp_queue(size_t high_water, size_t *total_queued = NULL);
+    ~b_dp_queue();
+
+    void push(b_batch *batch, int tries = 0);
+    int drain(const b_batch::sender &send);
+    bool ack(uint32_t barrier_xid);
+
+    const struct ofp_header* lookup(uint32_t xid) const;
+    bool retry(uint32_t xid, int max_tries);
+
+    /* Bytes waiting to be sent. */
+    size_t queued_bytes() const { return queued; }
+    bool congested() const { return queued >= high_water; }
+    bool empty() const { return waiting.empty(); }
+
+    /* Set while a drain() is scheduled for later. */
+    bool drain_scheduled;
+
+  private:
+    struct sent_msg {
+      const struct ofp_header *oh;
+      int tries;
+    };
+
+    size_t high_water;
+    size_t queued;
+    size_t *total_queued;
+    std::deque<b_batch*> waiting;
+    std::deque<b_batch*> in_flight;
+    std::unordered_map<uint32_t, sent_msg> by_xid;
+
+    void forget(b_batch *batch);
+
+    b_dp_queue(const b_dp_queue&);
+    b_dp_queue& operator=(const b_dp_queue&);
+  };
+} // vigil namespace
+
+#endif
@@ -0,0 +1,149 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "ofp_rules.hh"
+#include <stdlib.h>
+#include <string.h>
+
+namespace vigil
+{
+  static const size_t key_off = offsetof(struct ofp_flow_mod, table_id);
+  static const size_t match_end =
+    offsetof(struct ofp_flow_mod, match) + sizeof(struct ofp_match);
+
+  /* Table, priority and match of a flow-mod of at least match_end
+   * bytes. */
+  static std::string
+  rule_key(const uint8_t *p)
+  {
+    const struct ofp_flow_mod *fm = (const struct ofp_flow_mod*)p;
+    std::string key;
+    key.reserve(3 + sizeof(struct ofp_match));
+    key.push_back(fm->table_id);
+    key.append((const char*)&fm->priority, sizeof fm->priority);
+    key.append((const char*)&fm->match, sizeof(struct ofp_match));
+    return key;
+  }
+
+  void
+  b_rule_set::insert(const struct ofp_header *oh)
+  {
+    size_t len = ntohs(oh->length);
+    if (oh->type != OFPT_FLOW_MOD || len < match_end)
+      return;
+
+    const uint8_t *p = (const uint8_t*)oh;
+    std::string key = rule_key(p);
+    switch (p[key_off + 1]) {
+    case OFPFC_ADD:
+    case OFPFC_MODIFY:
+    case OFPFC_MODIFY_STRICT: {
+      std::string& msg = rules[key];
+      msg.assign((const char*)p, len);
+      ((struct ofp_header*)&msg[0])->xid = 0;
+      break;
+    }
+    case OFPFC_DELETE:
+    case OFPFC_DELETE_STRICT:
+      rules.erase(key);
+      break;
+    }
+  }
+
+  void
+  b_rule_set::insert(const b_batch& batch)
+  {
+    const struct iovec *iov = batch.msgs();
+    for (size_t i = 0; i < batch.num_msgs(); i++)
+      insert((const struct ofp_header*)iov[i].iov_base);
+  }
+
+  void
+  b_rule_set::insert(const struct ofl_flow_stats *fs)
+  {
+    struct ofp_header *oh = b_flow_stats_to_mod(fs);
+    if (oh == NULL)
+      return;
+    insert(oh);
+    free(oh);
+  }
+
+  /* OFPFC_MODIFY_STRICT only changes the instructions of an entry,
+   * another cookie or timeout needs an OFPFC_ADD replacing it. */
+  static bool
+  modifiable(const std::string& from, const std::string& to)
+  {
+    const struct ofp_flow_mod *a = (const struct ofp_flow_mod*)from.data();
+    const struct ofp_flow_mod *b = (const struct ofp_flow_mod*)to.data();
+    return a->cookie == b->cookie && a->idle_timeout == b->idle_timeout
+      && a->hard_timeout == b->hard_timeout;
+  }
+
+  /* A copy of 'msg' as a 'command' with a fresh xid, 'len' bytes
+   * long. */
+  static struct ofp_header*
+  delta(const std::string& msg, uint8_t command, size_t len)
+  {
+    struct ofp_header *oh = (struct ofp_header*)malloc(len);
+    if (oh == NULL)
+      return NULL;
+    memcpy(oh, msg.data(), len);
+    oh->length = htons(len);
+    oh->xid = htonl(b_flow_mod::get_new_xid());
+    ((struct ofp_flow_mod*)oh)->command = command;
+    return oh;
+  }
+
+  size_t
+  b_rule_set::diff(const b_rule_set& next, b_batch *out) const
+  {
+    size_t num = 0;
+    std::unordered_map<std::string, std::string>::const_iterator i, j;
+
+    for (i = rules.begin(); i != rules.end(); i++) {
+      if (next.rules.count(i->first))
+        continue;
+      // The instructions are not needed, any out_port and out_group
+      // will do.
+      struct ofp_header *oh = delta(i->second, OFPFC_DELETE_STRICT,
+                                    match_end);
+      if (oh == NULL)
+        continue;
+      struct ofp_flow_mod *fm = (struct ofp_flow_mod*)oh;
+      fm->cookie_mask = 0;
+      fm->out_port = htonl(OFPP_ANY);
+      fm->out_group = htonl(OFPG_ANY);
+      num += out->add(oh);
+    }
+
+    for (j = next.rules.begin(); j != next.rules.end(); j++) {
+      i = rules.find(j->first);
+      if (i != rules.end() && i->second == j->second)
+        continue;
+      uint8_t command = OFPFC_ADD;
+      if (i != rules.end() && modifiable(i->second, j->second))
+        command = OFPFC_MODIFY_STRICT;
+      num += out->add(delta(j->second, command, j->second.size()));
+    }
+
+    return num;
+  }
+} // vigil namespace
@@ -0,0 +1,69 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef ofp_rules_HH
+#define ofp_rules_HH
+
+#include <string>
+#include <unordered_map>
+#include "ofp_batch.hh"
+#include "ofp_builder.hh"
+
+namespace vigil
+{
+  /** \brief Flow entries of a datapath as the controller sent them.
+   *
+   * Entries are OFPT_FLOW_MOD messages kept by the key the switch
+   * tells them apart with in OFPFC_MODIFY_STRICT and
+   * OFPFC_DELETE_STRICT: table, priority and match.  A later message
+   * with the same key replaces the earlier one, a delete removes it.
+   * Other messages are ignored.
+   *
+   * Entries read back from a datapath can be inserted from a flow
+   * stats reply.
+   *
+   * diff() turns the entries into those of another set with as few
+   * messages as it can: OFPFC_ADD for new keys and for entries whose
+   * cookie or timeouts changed, OFPFC_MODIFY_STRICT for entries
+   * whose instructions changed, and OFPFC_DELETE_STRICT for keys
+   * that are gone.
+   */
+  class b_rule_set
+  {
+  public:
+    void insert(const struct ofp_header *oh);
+    void insert(const b_batch& batch);
+    void insert(const struct ofl_flow_stats *fs);
+    void clear() { rules.clear(); }
+    void swap(b_rule_set& other) { rules.swap(other.rules); }
+    size_t size() const { return rules.size(); }
+
+    /* Add the messages turning this set into 'next' to 'out', return
+     * their number. */
+    size_t diff(const b_rule_set& next, b_batch *out) const;
+
+  private:
+    /* Key -> the message, its xid zeroed. */
+    std::unordered_map<std::string, std::string> rules;
+  };
+} // vigil namespace
+
+#endif
@@ -0,0 +1,443 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "path_compiler.hh"
+#include <algorithm>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <set>
+#include <boost/bind.hpp>
+#include "../oflib/ofl-packets.h"
+#include "packets.h"
+
+namespace vigil
+{
+  static Vlog_module lg("butterfly_app");
+
+  typedef std::vector<uint32_t> port_vec_t;
+  typedef std::pair<uint32_t, uint32_t> node_label_t;
+  typedef std::pair<uint32_t, uint32_t> host_port_t;
+
+  static inline uint32_t
+  host_ip(uint32_t host)
+  {
+    return 0x0a000000 + host;  // assuming: 10.0.0.id
+  }
+
+  static void
+  add_port(port_vec_t& ports, uint32_t port_no)
+  {
+    if (std::find(ports.begin(), ports.end(), port_no) == ports.end())
+      ports.push_back(port_no);
+  }
+
+  /* Relabel the packet if 'label' is not 0, and send it to 'ports'.
+   * The action set holds a single output, so more outputs than one
+   * are applied. */
+  static void
+  forward(b_flow_mod *b, const port_vec_t& ports, uint32_t label = 0)
+  {
+    b_actions *a = ports.size() == 1 ? b->write_actions()
+                                     : b->apply_actions();
+    if (label)
+      a->set_mpls_label( label );
+    for (size_t i = 0; i < ports.size(); i++)
+      a->output( ports[i] );
+  }
+
+  /* Strip the three MPLS headers of a coded session. */
+  static b_actions*
+  pop_coding_headers(b_actions *a)
+  {
+    return a->pop_mpls_header( ETH_TYPE_MPLS )
+            ->pop_mpls_header( ETH_TYPE_MPLS )
+            ->pop_mpls_header( ETH_TYPE_IP );
+  }
+
+  path_compiler::path_compiler(const adjacency& links)
+    : links(links), total(0)
+  {
+  }
+
+  path_compiler::~path_compiler()
+  {
+    clear();
+  }
+
+  void
+  path_compiler::clear()
+  {
+    std::unordered_map<uint32_t, rule_list_t>::iterator i;
+    for (i = node_rules.begin(); i != node_rules.end(); i++) {
+      for (size_t j = 0; j < i->second.size(); j++)
+        delete i->second[j];
+    }
+    node_rules.clear();
+    total = 0;
+  }
+
+  /* Pack 'b' into a template of 'node'.  'b' is deleted. */
+  bool
+  path_compiler::add(uint32_t node, b_flow_mod *b)
+  {
+    b_flow_template *t = new b_flow_template(b);
+    if (t->size() == 0) {
+      lg.err("cannot pack rule %zu of node %u",
+             node_rules[node].size(), node);
+      delete t;
+      return false;
+    }
+    node_rules[node].push_back(t);
+    total++;
+    return true;
+  }
+
+  const path_compiler::rule_list_t*
+  path_compiler::rules(uint32_t node) const
+  {
+    std::unordered_map<uint32_t, rule_list_t>::const_iterator i;
+    i = node_rules.find(node);
+
+    return i == node_rules.end() ? NULL : &i->second;
+  }
+
+  const path_compiler::coding*
+  path_compiler::find_coding(uint32_t label) const
+  {
+    for (size_t i = 0; i < codings.size(); i++) {
+      if (codings[i].a == label || codings[i].b == label)
+        return &codings[i];
+    }
+    return NULL;
+  }
+
+  bool
+  path_compiler::load(const char *filename)
+  {
+    std::ifstream stream(filename);
+    if (!stream) {
+      lg.err(" error opening: %s ", filename);
+      return false;
+    }
+
+    return load(stream, filename);
+  }
+
+  bool
+  path_compiler::load(std::istream& stream, const char *filename)
+  {
+    sessions.clear();
+    returns.clear();
+    codings.clear();
+
+    std::string err;
+    bool ok = read_path_spec(stream, filename,
+                             boost::bind(&path_compiler::add_line, this,
+                                         _1, _2, _3), err);
+    if (!ok)
+      lg.err("%s", err.c_str());
+    lg.dbg(" %zu sessions, %zu return paths, %zu coding points ",
+           sessions.size(), returns.size(), codings.size());
+
+    return ok;
+  }
+
+  bool
+  path_compiler::add_line(const path_spec_line& l, std::istream& rest,
+                          std::string& why)
+  {
+    if (l.keyword == "session") {
+      session s;
+      s.label = l.label;
+      s.paths = l.paths;
+      sessions.push_back(s);
+    } else if (l.keyword == "return") {
+      returns.push_back(l.paths[0]);
+    } else if (l.keyword == "code") {
+      codings.push_back(l.coding);
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  bool
+  path_compiler::compile(bool network_coding)
+  {
+    std::map<node_label_t, port_vec_t> transit;
+    std::map<node_label_t, host_port_t> egress;
+    std::map<uint32_t, port_vec_t> catch_all;
+    std::map<uint32_t, uint32_t> session_dst;
+    b_flow_mod *b;
+    bool ok = true;
+
+    clear();
+
+    std::vector<const path_t*> all;
+    for (size_t i = 0; i < sessions.size(); i++) {
+      for (size_t j = 0; j < sessions[i].paths.size(); j++)
+        all.push_back(&sessions[i].paths[j]);
+    }
+    for (size_t i = 0; i < returns.size(); i++)
+      all.push_back(&returns[i]);
+    for (size_t i = 0; i < all.size(); i++) {
+      const path_t& p = *all[i];
+      for (size_t j = 0; j + 1 < p.size(); j++) {
+        if (links.port_to(p[j], p[j + 1]) < 0) {
+          lg.err("no link from %u to %u", p[j], p[j + 1]);
+          ok = false;
+        }
+      }
+    }
+    if (!ok)
+      return false;
+
+    /* Ingress: push the labels of the session and send the packet
+     * towards the first hops of its paths.  Collect the rest of the
+     * hops meanwhile. */
+    for (size_t i = 0; i < sessions.size(); i++) {
+      const session& s = sessions[i];
+      const coding *c = network_coding ? find_coding(s.label) : NULL;
+      uint32_t src = s.paths[0][0];
+      uint32_t dst = s.paths[0].back();
+      uint32_t ingress = s.paths[0][1];
+      port_vec_t ports;
+
+      session_dst[s.label] = dst;
+      for (size_t j = 0; j < s.paths.size(); j++) {
+        const path_t& p = s.paths[j];
+        size_t last = p.size() - 2;
+
+        add_port(ports, links.port_to(ingress, p[2]));
+        for (size_t k = 2; k < last; k++)
+          add_port(transit[node_label_t(p[k], s.label)],
+                   links.port_to(p[k], p[k + 1]));
+
+        host_port_t hp(p.back(), links.port_to(p[last], p.back()));
+        node_label_t nl(p[last], s.label);
+        if (egress.find(nl) != egress.end() && egress[nl] != hp) {
+          lg.err("session %u leaves %u towards more hosts", s.label, p[last]);
+          ok = false;
+        }
+        egress[nl] = hp;
+      }
+
+      b = new b_flow_mod();
+      b->match_src( host_ip(src) );
+      b->match_dst( host_ip(dst) );
+      b_actions *a = b->apply_actions();
+      if (c == NULL) {
+        a->push_mpls_header()->set_mpls_label( s.label );
+      } else if (c->a == s.label) {
+        a->push_mpls_header()->set_mpls_label( 0 )
+         ->push_mpls_header()->set_mpls_label_from_counter()
+         ->push_mpls_header()->set_mpls_label( s.label );
+      } else {
+        a->push_mpls_header()->set_mpls_label_from_counter()
+         ->push_mpls_header()->set_mpls_label( 0 )
+         ->push_mpls_header()->set_mpls_label( s.label );
+      }
+      for (size_t j = 0; j < ports.size(); j++)
+        a->output( ports[j] );
+      ok = add(ingress, b) && ok;
+    }
+
+    /* Coding points: the encoder xors the packets of the two
+     * sessions, the switches after it forward the coded packets
+     * along both sessions, and the egress switches reached by them
+     * decode. */
+    for (size_t i = 0; network_coding && i < codings.size(); i++) {
+      const coding& c = codings[i];
+      uint32_t enc = c.encoder;
+      port_vec_t out;
+
+      if (session_dst.find(c.a) == session_dst.end()
+          || session_dst.find(c.b) == session_dst.end()) {
+        lg.err("coding at %u refers to unknown sessions %u and %u",
+               enc, c.a, c.b);
+        ok = false;
+        continue;
+      }
+
+      const uint32_t labels[] = { c.a, c.b };
+      std::set<uint32_t> decoders;
+      for (int l = 0; l < 2; l++) {
+        std::map<node_label_t, port_vec_t>::iterator t;
+        t = transit.find(node_label_t(enc, labels[l]));
+        if (t == transit.end())
+          continue;
+        for (size_t j = 0; j < t->second.size(); j++)
+          add_port(out, t->second[j]);
+        transit.erase(t);
+
+        for (size_t j = 0; j < sessions.size(); j++) {
+          if (sessions[j].label != labels[l])
+            continue;
+          for (size_t k = 0; k < sessions[j].paths.size(); k++) {
+            const path_t& p = sessions[j].paths[k];
+            size_t last = p.size() - 2;
+            size_t e = std::find(p.begin(), p.end(), enc) - p.begin();
+            if (e < 2 || e >= last)
+              continue;
+            for (size_t h = e + 1; h < last; h++)
+              add_port(transit[node_label_t(p[h], c.coded)],
+                       links.port_to(p[h], p[h + 1]));
+            decoders.insert(p[last]);
+          }
+        }
+      }
+      if (out.empty()) {
+        lg.err("encoder %u is not inside the paths of sessions %u and %u",
+               enc, c.a, c.b);
+        ok = false;
+        continue;
+      }
+
+      b = new b_flow_mod();
+      b->match_mpls_label( c.a );
+      b->apply_actions()->set_mpls_label( c.coded )
+                        ->xor_encode( c.coded, c.plain_a );
+      ok = add(enc, b) && ok;
+
+      b = new b_flow_mod();
+      b->match_mpls_label( c.b );
+      b->apply_actions()->set_mpls_label( c.coded )
+                        ->xor_encode( c.coded, c.plain_b );
+      ok = add(enc, b) && ok;
+
+      b = new b_flow_mod();
+      b->match_mpls_label( c.coded );
+      forward(b, out);
+      ok = add(enc, b) && ok;
+
+      b = new b_flow_mod();
+      b->match_mpls_label( c.plain_a );
+      forward(b, out, c.a);
+      ok = add(enc, b) && ok;
+
+      b = new b_flow_mod();
+      b->match_mpls_label( c.plain_b );
+      forward(b, out, c.b);
+      ok = add(enc, b) && ok;
+
+      /* for debugging purposes */
+      bool has_return = false;
+      for (size_t j = 0; j < returns.size(); j++) {
+        const path_t& p = returns[j];
+        has_return = has_return
+          || std::find(p.begin() + 1, p.end() - 1, enc) != p.end() - 1;
+      }
+      if (!has_return)
+        catch_all[enc] = out;
+
+      std::map<uint32_t, host_port_t> decoder_host;
+      std::map<node_label_t, host_port_t>::iterator eg = egress.begin();
+      while (eg != egress.end()) {
+        uint32_t node  = eg->first.first;
+        uint32_t label = eg->first.second;
+        uint32_t host  = eg->second.first;
+        uint32_t port  = eg->second.second;
+        if (label != c.a && label != c.b) {
+          eg++;
+          continue;
+        }
+
+        b = new b_flow_mod();
+        b->match_mpls_label( label );
+        b_actions *a = b->apply_actions();
+        if (decoders.count(node)) {
+          a = a->set_mpls_label( c.coded )
+               ->xor_decode( c.decoded_a, c.decoded_b );
+          decoder_host[node] = eg->second;
+        }
+        a = pop_coding_headers(a);
+        if (host != session_dst[label])
+          a->set_ipv4_destination( host_ip(host) );
+        a->output( port );
+        ok = add(node, b) && ok;
+
+        egress.erase(eg++);
+      }
+
+      std::map<uint32_t, host_port_t>::const_iterator d;
+      for (d = decoder_host.begin(); d != decoder_host.end(); d++) {
+        uint32_t host = d->second.first;
+        uint32_t port = d->second.second;
+
+        b = new b_flow_mod();
+        b->match_mpls_label( c.coded );
+        b->apply_actions()->xor_decode( c.decoded_a, c.decoded_b );
+        ok = add(d->first, b) && ok;
+
+        const uint32_t decoded[] = { c.decoded_a, c.decoded_b };
+        for (int l = 0; l < 2; l++) {
+          b = new b_flow_mod();
+          b->match_mpls_label( decoded[l] );
+          pop_coding_headers(b->apply_actions())
+            ->set_ipv4_destination( host_ip(host) )
+            ->output( port );
+          ok = add(d->first, b) && ok;
+        }
+      }
+    }
+
+    /* Transit: forward by label. */
+    std::map<node_label_t, port_vec_t>::const_iterator t;
+    for (t = transit.begin(); t != transit.end(); t++) {
+      b = new b_flow_mod();
+      b->match_mpls_label( t->first.second );
+      forward(b, t->second);
+      ok = add(t->first.first, b) && ok;
+    }
+
+    /* Egress: back to IP, addressed to the host it is delivered to. */
+    std::map<node_label_t, host_port_t>::const_iterator e;
+    for (e = egress.begin(); e != egress.end(); e++) {
+      uint32_t host = e->second.first;
+
+      b = new b_flow_mod();
+      b->match_mpls_label( e->first.second );
+      b_actions *a = b->write_actions()->pop_mpls_header();
+      if (host != session_dst[e->first.second])
+        a->set_ipv4_destination( host_ip(host) );
+      a->output( e->second.second );
+      ok = add(e->first.first, b) && ok;
+    }
+
+    /* Return paths: whatever is not multicast goes back unchanged. */
+    for (size_t i = 0; i < returns.size(); i++) {
+      const path_t& p = returns[i];
+      for (size_t j = 1; j + 1 < p.size(); j++)
+        add_port(catch_all[p[j]], links.port_to(p[j], p[j + 1]));
+    }
+    std::map<uint32_t, port_vec_t>::const_iterator r;
+    for (r = catch_all.begin(); r != catch_all.end(); r++) {
+      b = new b_flow_mod();
+      forward(b, r->second);
+      ok = add(r->first, b) && ok;
+    }
+
+    lg.dbg(" %zu rules compiled for %zu nodes ", total, node_rules.size());
+
+    return ok;
+  }
+} // vigil namespace
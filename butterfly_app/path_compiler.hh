@@ -0,0 +1,104 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef path_compiler_HH
+#define path_compiler_HH
+
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ofp_builder.hh"
+#include "topology.hh"
+
+namespace vigil
+{
+  /** \brief Compiler of multicast paths into per-switch rules.
+   *
+   * The spec file lists the multicast sessions, the unicast paths
+   * of the reverse direction and the coding points.  Nodes are
+   * referred to by their ids in the links file, optionally prefixed
+   * by letters (h1, s5).  The first and the last node of a path are
+   * hosts, a host has the address 10.0.0.id.  Lines:
+   *
+   *   session <label> <path> [<path> ...]
+   *   return <path>
+   *   code <encoder> <label_a> <label_b> <coded>
+   *        <plain_a> <plain_b> <decoded_a> <decoded_b>
+   *
+   * where a path looks like h1-s5-s9-h3.  The destination address
+   * of a session is the last host of its first path, every path
+   * starts at the same host.  A 'return' path gets a catch-all rule
+   * on each of its switches.  A 'code' line pairs two sessions for
+   * network coding at the switch 'encoder'; it is only used by
+   * compile(true).
+   *
+   * compile() packs every rule into a b_flow_template, so a join
+   * only copies the messages of its datapath.  rules() can be called
+   * from any thread once compile() has returned.
+   */
+  class path_compiler
+  {
+  public:
+    typedef std::vector<b_flow_template*> rule_list_t;
+    typedef std::vector<uint32_t> path_t;
+
+    struct session
+    {
+      uint32_t label;
+      std::vector<path_t> paths;
+    };
+
+    path_compiler(const adjacency& links);
+    ~path_compiler();
+
+    bool load(const char *filename);
+    /* 'filename' only names the stream in errors. */
+    bool load(std::istream& stream, const char *filename);
+    bool compile(bool network_coding);
+
+    /* Rules of 'node' or NULL if it has none. */
+    const rule_list_t* rules(uint32_t node) const;
+    size_t num_rules() const { return total; }
+    const std::vector<session>& get_sessions() const { return sessions; }
+
+  private:
+    typedef path_spec_coding coding;
+
+    const adjacency& links;
+    std::vector<session> sessions;
+    std::vector<path_t> returns;
+    std::vector<coding> codings;
+    std::unordered_map<uint32_t, rule_list_t> node_rules;
+    size_t total;
+
+    void clear();
+    bool add_line(const path_spec_line& l, std::istream& rest,
+                  std::string& why);
+    bool add(uint32_t node, b_flow_mod *b);
+    const coding* find_coding(uint32_t label) const;
+
+    path_compiler(const path_compiler&);
+    path_compiler& operator=(const path_compiler&);
+  };
+} // vigil namespace
+
+#endif
@@ -0,0 +1,357 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Run the rules of the controller on emulated switches (b_pipeline):
+ *
+ *   pipe_sim [-n rounds] [-s size] [-t hold_ms] mpls|nc|greedy links spec
+ *
+ * In mpls and nc mode 'spec' is a path spec compiled the way the
+ * controller compiles paths=.  In a round every session sends a
+ * packet of 'size' bytes from its host, one session after the other,
+ * so the encoders of nc mode can pair them.  In greedy mode 'spec'
+ * holds the coordinates, every switch gets the rule of
+ * greedy_routing_join_handler(), and in a round every host sends a
+ * packet to another one.  The flow-mods go to the switches packed,
+ * as they would to a datapath, except for the greedy rules, which are
+ * given as ofl structures.
+ *
+ * After a round the emulated time is advanced by hold_ms, releasing
+ * the packets the encoders could not pair, then every receiver must
+ * have got every packet meant for it exactly once, with its source
+ * address and payload intact.  Reported are the deliveries, the
+ * packets lost, and the rate of the pipelines: packets per second
+ * entering table 0 (resubmits included).  The exit status is 1 if a
+ * delivery is wrong or missing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "greedy_embedding.hh"
+#include "greedy_rule.hh"
+#include "ofp_pipeline.hh"
+#include "path_compiler.hh"
+#include "topology.hh"
+
+using namespace vigil;
+
+struct flow
+{
+  uint32_t src;
+  b_packet packet;              /* without payload */
+  std::vector<uint32_t> receivers;
+};
+
+/* A packet sent, identified by the first bytes of its payload. */
+struct sent_packet
+{
+  uint32_t src_ip;
+  std::vector<uint32_t> receivers;
+  std::vector<uint8_t> got;
+};
+
+struct check_stats
+{
+  uint64_t expected;
+  uint64_t delivered;
+  uint64_t duplicates;
+  uint64_t misdelivered;
+  uint64_t corrupt;
+};
+
+static inline uint32_t
+host_ip(uint32_t host)
+{
+  return 0x0a000000 + host;     // as path_compiler has it
+}
+
+static void
+fill_payload(std::vector<uint8_t>& payload, uint32_t id, size_t size)
+{
+  payload.resize(size);
+  memcpy(&payload[0], &id, sizeof id);
+  for (size_t i = sizeof id; i < size; i++)
+    payload[i] = (id * 131 + i * 7) & 0xff;
+}
+
+static bool
+install_paths(b_network& net, const adjacency& links, bool nc,
+              const char *spec, std::vector<flow>& flows)
+{
+  path_compiler pc(links);
+  if (!pc.load(spec) || !pc.compile(nc)) {
+    fprintf(stderr, "%s: cannot compile the paths\n", spec);
+    return false;
+  }
+
+  for (uint32_t n = 0; n <= links.max_node(); n++) {
+    const path_compiler::rule_list_t *rules = pc.rules(n);
+    if (rules == NULL)
+      continue;
+    b_pipeline *s = net.add_switch(n);
+    for (size_t i = 0; i < rules->size(); i++) {
+      struct ofp_header *oh = (*rules)[i]->build();
+      bool ok = oh && s->message(oh);
+      free(oh);
+      if (!ok) {
+        fprintf(stderr, "s%u: %s\n", n, s->error().c_str());
+        return false;
+      }
+    }
+  }
+
+  const std::vector<path_compiler::session>& ss = pc.get_sessions();
+  for (size_t i = 0; i < ss.size(); i++) {
+    const path_compiler::session& s = ss[i];
+    flow f;
+    f.src = s.paths[0][0];
+    f.packet.ipv4_src = host_ip(f.src);
+    f.packet.ipv4_dst = host_ip(s.paths[0].back());
+    for (size_t j = 0; j < s.paths.size(); j++) {
+      uint32_t rcv = s.paths[j].back();
+      if (std::find(f.receivers.begin(), f.receivers.end(), rcv)
+          == f.receivers.end())
+        f.receivers.push_back(rcv);
+    }
+    flows.push_back(f);
+  }
+
+  return true;
+}
+
+static bool
+install_greedy(b_network& net, const adjacency& links, const char *spec,
+               std::vector<flow>& flows, coord_map_t& coords)
+{
+  topo_file t;
+  if (!t.load_coords(spec)) {
+    fprintf(stderr, "%s\n", t.error().c_str());
+    return false;
+  }
+  t.fill(coords);
+
+  for (uint32_t n = 0; n <= links.max_node(); n++) {
+    if (links.degree(n) == 1 && coords.count(n)) {
+      flow f;
+      f.src = n;
+      f.packet.ipv4_src = host_ip(n);
+      flows.push_back(f);
+    }
+    if (links.degree(n) < 2)
+      continue;
+
+    std::vector<greedy_neighbor> nbrs;
+    for (uint32_t i = links.begin(n); i < links.end(n); i++) {
+      coord_t c(0, 0);
+      coord_map_t::const_iterator ci = coords.find( links.neighbor(i) );
+      if (ci != coords.end())
+        c = ci->second;
+      greedy_neighbor g = { std::get<0>(c), std::get<1>(c),
+                            links.port_no(i) };
+      nbrs.push_back(g);
+    }
+
+    b_flow_mod b;
+    greedy_rule(&b, nbrs);
+    b_pipeline *s = net.add_switch(n);
+    if (!s->flow_mod(b.msg())) {
+      fprintf(stderr, "s%u: %s\n", n, s->error().c_str());
+      return false;
+    }
+  }
+
+  if (flows.size() < 2) {
+    fprintf(stderr, "%s: less than two hosts with coordinates\n", spec);
+    return false;
+  }
+  return true;
+}
+
+/* Round 'r' of greedy mode: host i sends to the host 1 + r % (n - 1)
+ * after it. */
+static void
+aim_greedy(std::vector<flow>& flows, const coord_map_t& coords, unsigned r)
+{
+  size_t n = flows.size();
+  for (size_t i = 0; i < n; i++) {
+    uint32_t dst = flows[(i + 1 + r % (n - 1)) % n].src;
+    const coord_t& c = coords.find(dst)->second;
+    flows[i].packet.eth_dst = greedy_eth_addr(std::get<0>(c),
+                                              std::get<1>(c));
+    flows[i].packet.ipv4_dst = host_ip(dst);
+    flows[i].receivers.assign(1, dst);
+  }
+}
+
+static void
+check(std::vector<b_delivery>& deliveries, std::vector<sent_packet>& sent,
+      size_t size, check_stats& cs)
+{
+  std::vector<uint8_t> payload;
+  for (size_t i = 0; i < deliveries.size(); i++) {
+    const b_delivery& d = deliveries[i];
+    const b_packet& p = d.packet;
+    uint32_t id = ~0U;
+    if (p.payload.size() >= sizeof id)
+      memcpy(&id, &p.payload[0], sizeof id);
+    if (id >= sent.size()) {
+      cs.corrupt++;
+      continue;
+    }
+
+    sent_packet& s = sent[id];
+    std::vector<uint32_t>::const_iterator r;
+    r = std::find(s.receivers.begin(), s.receivers.end(), d.host);
+    if (r == s.receivers.end()) {
+      cs.misdelivered++;
+      continue;
+    }
+    fill_payload(payload, id, size);
+    if (p.payload != payload || p.ipv4_src != s.src_ip
+        || p.num_labels != 0) {
+      cs.corrupt++;
+      continue;
+    }
+    if (s.got[r - s.receivers.begin()]++)
+      cs.duplicates++;
+    else
+      cs.delivered++;
+  }
+  deliveries.clear();
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned rounds = 1000, size = 1000, hold_ms = 10;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:s:t:")) != -1) {
+    switch (c) {
+    case 'n': rounds = atoi(optarg); break;
+    case 's': size = atoi(optarg); break;
+    case 't': hold_ms = atoi(optarg); break;
+    default:
+      return 1;
+    }
+  }
+  const char *mode = optind < argc ? argv[optind] : "";
+  bool greedy = strcmp(mode, "greedy") == 0;
+  bool nc = strcmp(mode, "nc") == 0;
+  if (argc - optind != 3 || size < 8
+      || (!greedy && !nc && strcmp(mode, "mpls") != 0)) {
+    fprintf(stderr, "usage: %s [-n rounds] [-s size] [-t hold_ms] "
+            "mpls|nc|greedy links spec\n", argv[0]);
+    return 1;
+  }
+  const char *links_file = argv[optind + 1];
+  const char *spec = argv[optind + 2];
+
+  topo_file f;
+  adjacency links;
+  if (!f.load_links(links_file)) {
+    fprintf(stderr, "%s\n", f.error().c_str());
+    return 1;
+  }
+  if (!links.build(f.links(), f.num_links())) {
+    fprintf(stderr, "%s: node ids exceed %u\n", links_file,
+            adjacency::max_node_id);
+    return 1;
+  }
+
+  b_network net(links);
+  unsigned num_switches = 0;
+  for (uint32_t n = 0; n <= links.max_node(); n++) {
+    if (links.degree(n) > 1) {
+      net.add_switch(n, hold_ms);
+      num_switches++;
+    }
+  }
+
+  std::vector<flow> flows;
+  coord_map_t coords;
+  if (greedy ? !install_greedy(net, links, spec, flows, coords)
+             : !install_paths(net, links, nc, spec, flows))
+    return 1;
+
+  size_t num_rules = 0;
+  for (uint32_t n = 0; n <= links.max_node(); n++) {
+    if (net.get_switch(n))
+      num_rules += net.get_switch(n)->num_entries();
+  }
+
+  std::vector<sent_packet> sent;
+  check_stats cs;
+  memset(&cs, 0, sizeof cs);
+  double secs = 0;
+  for (unsigned r = 0; r < rounds; r++) {
+    if (greedy)
+      aim_greedy(flows, coords, r);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (size_t i = 0; i < flows.size(); i++) {
+      flow& fl = flows[i];
+      sent.push_back(sent_packet());
+      sent.back().src_ip = fl.packet.ipv4_src;
+      sent.back().receivers = fl.receivers;
+      sent.back().got.assign(fl.receivers.size(), 0);
+      cs.expected += fl.receivers.size();
+
+      fill_payload(fl.packet.payload, sent.size() - 1, size);
+      net.send(fl.src, fl.packet);
+    }
+    net.tick(hold_ms);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    check(net.deliveries(), sent, size, cs);
+  }
+
+  b_pipeline_stats st = net.stats();
+  uint64_t missing = cs.expected - cs.delivered;
+  printf("%u switches, %zu entries, %zu flows\n", num_switches, num_rules,
+         flows.size());
+  printf("sent:         %zu packets, %llu copies expected\n", sent.size(),
+         (unsigned long long)cs.expected);
+  printf("delivered:    %llu, %llu missing, %llu duplicates\n",
+         (unsigned long long)cs.delivered, (unsigned long long)missing,
+         (unsigned long long)cs.duplicates);
+  printf("wrong:        %llu misdelivered, %llu corrupt\n",
+         (unsigned long long)cs.misdelivered,
+         (unsigned long long)cs.corrupt);
+  printf("lost:         %llu in the network, %llu table misses, "
+         "%llu dropped, %llu unsupported\n",
+         (unsigned long long)net.lost(), (unsigned long long)st.misses,
+         (unsigned long long)st.dropped, (unsigned long long)st.unsupported);
+  if (nc)
+    printf("coded:        %llu encoded, %llu decoded\n",
+           (unsigned long long)st.encoded, (unsigned long long)st.decoded);
+  printf("%.3f s, %.0f packets/s, %.0f lookups/s\n", secs,
+         secs > 0 ? st.packets / secs : 0.0,
+         secs > 0 ? st.lookups / secs : 0.0);
+
+  return missing || cs.duplicates || cs.misdelivered || cs.corrupt;
+}
@@ -0,0 +1,152 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "port_stats.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace vigil
+{
+  static const char port_stats_magic[8] = { 'B','F','L','Y','P','O','R','T' };
+
+  void
+  b_port_stats::update(const port_stats_record& r)
+  {
+    ports[key(r.dpid, r.port_no)] = r;
+  }
+
+  void
+  b_port_stats::remove(uint64_t dpid)
+  {
+    ports.erase(ports.lower_bound(key(dpid, 0)),
+                ports.upper_bound(key(dpid, 0xffffffff)));
+  }
+
+  /* Write into a temporary file next to 'filename', then rename it. */
+  bool
+  b_port_stats::write(const char *filename)
+  {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    port_stats_header h;
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, port_stats_magic, sizeof h.magic);
+    h.version   = port_stats_version;
+    h.num_ports = ports.size();
+    h.time_ms   = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+    std::string tmp = std::string(filename) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == NULL) {
+      err = "cannot create " + tmp + ": " + strerror(errno);
+      return false;
+    }
+    bool ok = fwrite(&h, sizeof h, 1, f) == 1;
+    std::map<key, port_stats_record>::const_iterator i;
+    for (i = ports.begin(); ok && i != ports.end(); i++)
+      ok = fwrite(&i->second, sizeof i->second, 1, f) == 1;
+    if (fclose(f) != 0 || !ok) {
+      err = "cannot write " + tmp;
+      unlink(tmp.c_str());
+      return false;
+    }
+    if (rename(tmp.c_str(), filename) != 0) {
+      err = std::string("cannot rename ") + tmp + ": " + strerror(errno);
+      unlink(tmp.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+  port_stats_file::port_stats_file()
+    : map(0), map_len(0), header(0), recs(0)
+  {
+  }
+
+  port_stats_file::~port_stats_file()
+  {
+    unmap();
+  }
+
+  void
+  port_stats_file::unmap()
+  {
+    if (map)
+      munmap(map, map_len);
+    map = 0;
+    map_len = 0;
+    header = 0;
+    recs = 0;
+  }
+
+  bool
+  port_stats_file::load(const char *filename)
+  {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      err = std::string("cannot open ") + filename + ": " + strerror(errno);
+      if (fd >= 0)
+        close(fd);
+      return false;
+    }
+
+    unmap();
+    map_len = st.st_size;
+    if (map_len >= sizeof(port_stats_header))
+      map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED || map == NULL) {
+      map = 0;
+      err = std::string("cannot map ") + filename;
+      unmap();
+      return false;
+    }
+
+    const port_stats_header *h = (const port_stats_header*)map;
+    if (memcmp(h->magic, port_stats_magic, sizeof h->magic) != 0
+        || h->version != port_stats_version) {
+      err = std::string(filename) + ": not a port statistics snapshot "
+        "of this version and byte order";
+      unmap();
+      return false;
+    }
+    size_t recs_len = (size_t)h->num_ports * sizeof(port_stats_record);
+    if (map_len != sizeof *h + recs_len) {
+      err = std::string(filename) + ": truncated";
+      unmap();
+      return false;
+    }
+
+    header = h;
+    recs   = (const port_stats_record*)(h + 1);
+
+    return true;
+  }
+} // vigil namespace
@@ -0,0 +1,119 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef port_stats_HH
+#define port_stats_HH
+
+#include <map>
+#include <string>
+#include <utility>
+#include <stdint.h>
+
+namespace vigil
+{
+  /* Records of the port statistics snapshot.  The file is a
+   * port_stats_header and num_ports port_stats_record records sorted
+   * by dpid and port, all in host byte order.  Times are milliseconds
+   * since the Epoch. */
+  struct port_stats_header
+  {
+    char magic[8];              /* "BFLYPORT" */
+    uint32_t version;           /* port_stats_version */
+    uint32_t num_ports;
+    uint64_t time_ms;           /* of writing the file */
+  };
+
+  struct port_stats_record
+  {
+    uint64_t dpid;
+    uint32_t port_no;
+    uint32_t pad;
+    uint64_t time_ms;           /* of the reply of the datapath */
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t rx_dropped;
+    uint64_t tx_dropped;
+    uint64_t rx_errors;
+    uint64_t tx_errors;
+  };
+
+  const uint32_t port_stats_version = 1;
+
+  /** \brief Port counters of the datapaths, as the last replies gave
+   * them.
+   *
+   * write() publishes a snapshot into a file, replaced atomically so
+   * readers (port_stats_file, topo.pl) never see half of it.  Errors
+   * are returned by error().
+   */
+  class b_port_stats
+  {
+  public:
+    void update(const port_stats_record& r);
+    /* Forget the ports of a datapath that left. */
+    void remove(uint64_t dpid);
+    size_t num_ports() const { return ports.size(); }
+
+    bool write(const char *filename);
+    const std::string& error() const { return err; }
+
+  private:
+    typedef std::pair<uint64_t, uint32_t> key;
+
+    std::map<key, port_stats_record> ports;
+    std::string err;
+  };
+
+  /** \brief Reader of a port statistics snapshot.
+   *
+   * The file is mapped into memory and used in place until the next
+   * load() or the destruction of the reader.
+   */
+  class port_stats_file
+  {
+  public:
+    port_stats_file();
+    ~port_stats_file();
+
+    bool load(const char *filename);
+
+    uint64_t time_ms() const { return header ? header->time_ms : 0; }
+    const port_stats_record* records() const { return recs; }
+    size_t num_records() const { return header ? header->num_ports : 0; }
+    const std::string& error() const { return err; }
+
+  private:
+    void *map;
+    size_t map_len;
+    const port_stats_header *header;
+    const port_stats_record *recs;
+    std::string err;
+
+    void unmap();
+
+    port_stats_file(const port_stats_file&);
+    port_stats_file& operator=(const port_stats_file&);
+  };
+} // vigil namespace
+
+#endif
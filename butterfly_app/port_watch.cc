@@ -0,0 +1,125 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Print the port statistics snapshot written by butterfly_app with
+ * port_stats=:
+ *
+ *   port_watch [-i seconds] snapshot
+ *
+ * Without -i the counters are printed once.  With -i the snapshot is
+ * read again every 'seconds', and the packet and byte rates of each
+ * port since the previous one are printed, taken from the times of
+ * the replies.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <map>
+#include <utility>
+#include "port_stats.hh"
+
+using namespace vigil;
+
+typedef std::map<std::pair<uint64_t, uint32_t>, port_stats_record> port_map;
+
+static void
+print_counters(const port_stats_file& f)
+{
+  printf("%-16s %5s %12s %12s %14s %14s %8s %8s\n", "dpid", "port",
+         "rx_packets", "tx_packets", "rx_bytes", "tx_bytes", "dropped",
+         "errors");
+  for (size_t i = 0; i < f.num_records(); i++) {
+    const port_stats_record& r = f.records()[i];
+    printf("%016" PRIx64 " %5u %12" PRIu64 " %12" PRIu64 " %14" PRIu64
+           " %14" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+           r.dpid, r.port_no, r.rx_packets, r.tx_packets, r.rx_bytes,
+           r.tx_bytes, r.rx_dropped + r.tx_dropped,
+           r.rx_errors + r.tx_errors);
+  }
+}
+
+/* Rates of the ports in both 'f' and 'last', then 'f' becomes
+ * 'last'. */
+static void
+print_rates(const port_stats_file& f, port_map& last)
+{
+  printf("%-16s %5s %12s %12s %14s %14s\n", "dpid", "port",
+         "rx_pkt/s", "tx_pkt/s", "rx_byte/s", "tx_byte/s");
+  port_map now;
+  for (size_t i = 0; i < f.num_records(); i++) {
+    const port_stats_record& r = f.records()[i];
+    std::pair<uint64_t, uint32_t> k(r.dpid, r.port_no);
+    now[k] = r;
+
+    port_map::const_iterator p = last.find(k);
+    if (p == last.end() || r.time_ms <= p->second.time_ms)
+      continue;
+    double s = (r.time_ms - p->second.time_ms) / 1000.0;
+    printf("%016" PRIx64 " %5u %12.0f %12.0f %14.0f %14.0f\n",
+           r.dpid, r.port_no,
+           (r.rx_packets - p->second.rx_packets) / s,
+           (r.tx_packets - p->second.tx_packets) / s,
+           (r.rx_bytes - p->second.rx_bytes) / s,
+           (r.tx_bytes - p->second.tx_bytes) / s);
+  }
+  last.swap(now);
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned interval = 0;
+  int c;
+
+  while ((c = getopt(argc, argv, "i:")) != -1) {
+    switch (c) {
+    case 'i': interval = atoi(optarg); break;
+    default: optind = argc + 1; break;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-i seconds] snapshot\n", argv[0]);
+    return 1;
+  }
+
+  port_stats_file f;
+  if (interval == 0) {
+    if (!f.load(argv[optind])) {
+      fprintf(stderr, "%s\n", f.error().c_str());
+      return 1;
+    }
+    print_counters(f);
+    return 0;
+  }
+
+  port_map last;
+  for (;;) {
+    if (f.load(argv[optind]))
+      print_rates(f, last);
+    else
+      fprintf(stderr, "%s\n", f.error().c_str());
+    printf("\n");
+    fflush(stdout);
+    sleep(interval);
+  }
+}
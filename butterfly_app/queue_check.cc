@@ -0,0 +1,136 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Check that b_dp_queue recovers from send errors: a batch the sender
+ * refuses with EAGAIN is sent again on the next drain(), a batch it
+ * fails with another error is dropped without stalling the queue or
+ * staying counted in the shared backlog.  Exits with 0 on success. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <boost/bind.hpp>
+#include "ofp_queue.hh"
+
+using namespace vigil;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                 \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+/* Sender failing each message with the next error of 'errors' (0
+ * once they run out) and recording the xids it accepts. */
+struct fake_conn
+{
+  std::vector<int> errors;
+  std::vector<uint32_t> sent;
+
+  int send(const struct ofp_header *oh)
+  {
+    int error = 0;
+    if (!errors.empty()) {
+      error = errors.front();
+      errors.erase(errors.begin());
+    }
+    if (error == 0)
+      sent.push_back(ntohl(oh->xid));
+
+    return error;
+  }
+};
+
+static b_batch*
+new_batch(size_t num_msgs)
+{
+  b_batch *b = new b_batch();
+  for (size_t i = 0; i < num_msgs; i++) {
+    struct ofp_header *oh = (struct ofp_header*)malloc(sizeof *oh);
+    oh->version = OFP_VERSION;
+    oh->type    = OFPT_ECHO_REQUEST;
+    oh->length  = htons(sizeof *oh);
+    oh->xid     = htonl(b_flow_mod::get_new_xid());
+    b->add(oh);
+  }
+  b->close();
+
+  return b;
+}
+
+int
+main()
+{
+  size_t total = 0;
+  fake_conn conn;
+  b_batch::sender send = boost::bind(&fake_conn::send, &conn, _1);
+
+  {
+    b_dp_queue q(1024, &total);
+    b_batch *first = new_batch(2);
+    b_batch *second = new_batch(1);
+    uint32_t first_xid = ntohl(((const struct ofp_header*)
+                                first->msgs()[0].iov_base)->xid);
+    uint32_t second_barrier = second->barrier_xid();
+    size_t second_size = second->size();
+    q.push(first);
+    q.push(second);
+    CHECK(total == first->size() + second_size);
+
+    // EAGAIN keeps the batch and the bytes.
+    conn.errors.push_back(EAGAIN);
+    CHECK(q.drain(send) == EAGAIN);
+    CHECK(conn.sent.empty());
+    CHECK(q.queued_bytes() == total);
+
+    // A hard error drops the first batch, the second one still goes.
+    conn.errors.push_back(0);
+    conn.errors.push_back(EPIPE);
+    CHECK(q.drain(send) == EPIPE);
+    CHECK(q.empty());
+    CHECK(q.queued_bytes() == 0);
+    CHECK(total == 0);
+    CHECK(q.lookup(first_xid) == NULL);
+    CHECK(conn.sent.size() == 3);
+    CHECK(conn.sent.back() == second_barrier);
+    CHECK(q.ack(second_barrier));
+
+    // The queue keeps working after the error.
+    conn.sent.clear();
+    q.push(new_batch(1));
+    CHECK(total > 0);
+    CHECK(q.drain(send) == 0);
+    CHECK(conn.sent.size() == 2);
+    CHECK(total == 0);
+  }
+  CHECK(total == 0);
+
+  if (failures)
+    fprintf(stderr, "%d check(s) failed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,277 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "rlnc.hh"
+#include <pthread.h>
+#include <string.h>
+
+/* The SIMD kernels need per-function target attributes. */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) \
+  && !defined(__clang__) \
+  && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define GF_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace vigil
+{
+  static const unsigned gf_poly = 0x11d;
+
+  /* Logarithms for gf_mul() and gf_inv(), the full multiplication
+   * table for the scalar kernel, and the products of the low and the
+   * high nibbles for the shuffle kernels. */
+  static struct
+  {
+    uint8_t exp[512];
+    uint8_t log[256];
+    uint8_t mul[256][256];
+    uint8_t lo[256][16];
+    uint8_t hi[256][16];
+  } gf;
+
+  static pthread_once_t gf_once = PTHREAD_ONCE_INIT;
+
+  static void
+  gf_init_tables()
+  {
+    unsigned x = 1;
+    for (int i = 0; i < 255; i++) {
+      gf.exp[i] = gf.exp[i + 255] = x;
+      gf.log[x] = i;
+      x <<= 1;
+      if (x & 0x100)
+        x ^= gf_poly;
+    }
+    gf.exp[510] = gf.exp[511] = gf.exp[0];
+
+    for (unsigned a = 0; a < 256; a++) {
+      for (unsigned b = 0; b < 256; b++)
+        gf.mul[a][b] = a && b ? gf.exp[gf.log[a] + gf.log[b]] : 0;
+      for (unsigned n = 0; n < 16; n++) {
+        gf.lo[a][n] = gf.mul[a][n];
+        gf.hi[a][n] = gf.mul[a][n << 4];
+      }
+    }
+  }
+
+  uint8_t
+  gf_mul(uint8_t a, uint8_t b)
+  {
+    pthread_once(&gf_once, gf_init_tables);
+    return gf.mul[a][b];
+  }
+
+  uint8_t
+  gf_inv(uint8_t a)
+  {
+    pthread_once(&gf_once, gf_init_tables);
+    return gf.exp[255 - gf.log[a]];
+  }
+
+  static void
+  madd_scalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+  {
+    if (c == 0)
+      return;
+    if (c == 1) {
+      for (size_t i = 0; i < n; i++)
+        dst[i] ^= src[i];
+      return;
+    }
+    const uint8_t *m = gf.mul[c];
+    for (size_t i = 0; i < n; i++)
+      dst[i] ^= m[src[i]];
+  }
+
+#ifdef GF_X86_KERNELS
+  __attribute__((target("ssse3")))
+  static void
+  madd_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+  {
+    if (c == 0)
+      return;
+
+    const __m128i lo = _mm_loadu_si128((const __m128i*)gf.lo[c]);
+    const __m128i hi = _mm_loadu_si128((const __m128i*)gf.hi[c]);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+      __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+      __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(s, mask));
+      __m128i h = _mm_shuffle_epi8(hi,
+                                   _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+      _mm_storeu_si128((__m128i*)(dst + i),
+                       _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+    madd_scalar(dst + i, src + i, c, n - i);
+  }
+
+  __attribute__((target("avx2")))
+  static void
+  madd_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+  {
+    if (c == 0)
+      return;
+
+    const __m256i lo = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i*)gf.lo[c]));
+    const __m256i hi = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i*)gf.hi[c]));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+      __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+      __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask));
+      __m256i h = _mm256_shuffle_epi8(
+        hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+      _mm256_storeu_si256((__m256i*)(dst + i),
+                          _mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+    }
+    madd_scalar(dst + i, src + i, c, n - i);
+  }
+#endif
+
+  static const gf_kernel gf_scalar = { "scalar", madd_scalar };
+#ifdef GF_X86_KERNELS
+  static const gf_kernel gf_ssse3 = { "ssse3", madd_ssse3 };
+  static const gf_kernel gf_avx2 = { "avx2", madd_avx2 };
+#endif
+
+  static std::vector<const gf_kernel*> gf_available;
+  static pthread_once_t gf_kernels_once = PTHREAD_ONCE_INIT;
+
+  static void
+  gf_init_kernels()
+  {
+    pthread_once(&gf_once, gf_init_tables);
+
+    gf_available.push_back(&gf_scalar);
+#ifdef GF_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+      gf_available.push_back(&gf_ssse3);
+    if (__builtin_cpu_supports("avx2"))
+      gf_available.push_back(&gf_avx2);
+#endif
+  }
+
+  const std::vector<const gf_kernel*>&
+  gf_kernels()
+  {
+    pthread_once(&gf_kernels_once, gf_init_kernels);
+    return gf_available;
+  }
+
+  const gf_kernel*
+  gf_best_kernel()
+  {
+    return gf_kernels().back();
+  }
+
+  // ----------------------------------------------------------------------
+
+  rlnc_encoder::rlnc_encoder(size_t num_symbols, size_t symbol_size,
+                             const gf_kernel *kernel)
+    : num_symbols(num_symbols), symbol_size(symbol_size), kernel(kernel),
+      symbols(0)
+  {
+  }
+
+  void
+  rlnc_encoder::encode(const uint8_t *coeffs, uint8_t *out) const
+  {
+    memset(out, 0x00, symbol_size);
+    for (size_t i = 0; i < num_symbols; i++)
+      kernel->madd(out, symbols + i * symbol_size, coeffs[i], symbol_size);
+  }
+
+  // ----------------------------------------------------------------------
+
+  rlnc_decoder::rlnc_decoder(size_t num_symbols, size_t symbol_size,
+                             const gf_kernel *kernel)
+    : num_symbols(num_symbols), symbol_size(symbol_size), kernel(kernel),
+      rows(num_symbols * (num_symbols + symbol_size)),
+      scratch(num_symbols + symbol_size)
+  {
+    reset();
+  }
+
+  void
+  rlnc_decoder::reset()
+  {
+    num_rows = 0;
+    pivot_row.assign(num_symbols, num_symbols);
+  }
+
+  /* Multiply the 'n' bytes at 'r' by 'c'. */
+  void
+  rlnc_decoder::scale(uint8_t *r, size_t n, uint8_t c)
+  {
+    memset(&scratch[0], 0x00, n);
+    kernel->madd(&scratch[0], r, c, n);
+    memcpy(r, &scratch[0], n);
+  }
+
+  bool
+  rlnc_decoder::add(const uint8_t *coeffs, const uint8_t *payload)
+  {
+    if (complete())
+      return false;
+
+    // The next free row.  Every row is zero before its pivot.
+    uint8_t *r = row(num_rows);
+    size_t len = row_size();
+    memcpy(r, coeffs, num_symbols);
+    memcpy(r + num_symbols, payload, symbol_size);
+
+    // Eliminating a pivot only changes the columns after it, so the
+    // first nonzero column without a pivot is final when reached.
+    size_t p = num_symbols;
+    for (size_t c = 0; c < num_symbols; c++) {
+      if (r[c] == 0)
+        continue;
+      if (pivot_row[c] != num_symbols)
+        kernel->madd(r + c, row(pivot_row[c]) + c, r[c], len - c);
+      else if (p == num_symbols)
+        p = c;
+    }
+    if (p == num_symbols)
+      return false;
+
+    scale(r + p, len - p, gf_inv(r[p]));
+    for (size_t i = 0; i < num_rows; i++) {
+      uint8_t *o = row(i);
+      if (o[p])
+        kernel->madd(o + p, r + p, o[p], len - p);
+    }
+    pivot_row[p] = num_rows++;
+
+    return true;
+  }
+
+  const uint8_t*
+  rlnc_decoder::symbol(size_t i) const
+  {
+    return &rows[pivot_row[i] * row_size() + num_symbols];
+  }
+} // vigil namespace
@@ -0,0 +1,116 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef rlnc_HH
+#define rlnc_HH
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace vigil
+{
+  /** \brief Multiply-accumulate over GF(2^8), dst ^= c * src.
+   *
+   * The field is GF(2)[x] / (x^8 + x^4 + x^3 + x^2 + 1), the
+   * polynomial 0x11d.  The scalar kernel looks the products up in a
+   * row of the multiplication table, the SIMD kernels split each byte
+   * into two nibbles and look both up with a byte shuffle.  Every
+   * kernel gives the same result; the SIMD ones are only compiled on
+   * x86 and only offered if the CPU has the instructions.
+   */
+  struct gf_kernel
+  {
+    const char *name;
+    void (*madd)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n);
+  };
+
+  /* Kernels this CPU can run, the fastest last. */
+  const std::vector<const gf_kernel*>& gf_kernels();
+  const gf_kernel* gf_best_kernel();
+
+  uint8_t gf_mul(uint8_t a, uint8_t b);
+  /* 'a' must not be 0. */
+  uint8_t gf_inv(uint8_t a);
+
+  /** \brief Random linear network coding of a generation.
+   *
+   * A generation is 'num_symbols' source symbols of 'symbol_size'
+   * bytes each, stored one after the other.  A coded symbol is the
+   * sum of the source symbols multiplied by its coefficient vector,
+   * one coefficient per source symbol.
+   */
+  class rlnc_encoder
+  {
+  public:
+    rlnc_encoder(size_t num_symbols, size_t symbol_size,
+                 const gf_kernel *kernel = gf_best_kernel());
+
+    /* 'data' must stay valid while encode() is called. */
+    void set_generation(const uint8_t *data) { symbols = data; }
+    void encode(const uint8_t *coeffs, uint8_t *out) const;
+
+  private:
+    size_t num_symbols;
+    size_t symbol_size;
+    const gf_kernel *kernel;
+    const uint8_t *symbols;
+  };
+
+  /** \brief Progressive Gauss-Jordan decoder of a generation.
+   *
+   * add() takes the coefficient vector and the payload of a coded
+   * symbol, and returns whether it raised the rank.  The symbols
+   * received are kept in reduced row echelon form, so the generation
+   * is decoded as soon as the rank reaches 'num_symbols'.
+   */
+  class rlnc_decoder
+  {
+  public:
+    rlnc_decoder(size_t num_symbols, size_t symbol_size,
+                 const gf_kernel *kernel = gf_best_kernel());
+
+    bool add(const uint8_t *coeffs, const uint8_t *payload);
+    void reset();
+
+    size_t rank() const { return num_rows; }
+    bool complete() const { return num_rows == num_symbols; }
+    /* Source symbol 'i' once complete(). */
+    const uint8_t* symbol(size_t i) const;
+
+  private:
+    size_t num_symbols;
+    size_t symbol_size;
+    const gf_kernel *kernel;
+    size_t num_rows;
+    /* Row of each pivot column or num_symbols, and the rows: their
+     * coefficients then their payload. */
+    std::vector<size_t> pivot_row;
+    std::vector<uint8_t> rows;
+    std::vector<uint8_t> scratch;
+
+    size_t row_size() const { return num_symbols + symbol_size; }
+    uint8_t* row(size_t i) { return &rows[i * row_size()]; }
+    void scale(uint8_t *r, size_t n, uint8_t c);
+  };
+} // vigil namespace
+
+#endif
@@ -0,0 +1,206 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Measure the GF(2^8) kernels of random linear network coding:
+ *
+ *   rlnc_bench [-k symbols] [-s symbol_size] [-t seconds]
+ *
+ * For each kernel the CPU can run, a single thread multiplies and
+ * adds buffers, encodes coded symbols of a generation of 'symbols'
+ * source symbols, and decodes whole generations.  Rates are of the
+ * payload (coded symbols out, generations decoded) in Gbit/s on one
+ * core.  Every kernel is checked against the scalar one first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "rlnc.hh"
+
+using namespace vigil;
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+fill_random(std::vector<uint8_t>& v)
+{
+  for (size_t i = 0; i < v.size(); i++)
+    v[i] = random();
+}
+
+static bool
+check(const gf_kernel *k, size_t symbol_size)
+{
+  std::vector<uint8_t> src(symbol_size + 31), a(src.size()), b;
+  fill_random(src);
+  fill_random(a);
+  b = a;
+  for (unsigned c = 0; c < 256; c++) {
+    // Odd lengths and offsets reach the tails of the SIMD loops.
+    size_t off = c % 7, n = symbol_size + c % 25;
+    gf_kernels()[0]->madd(&a[off], &src[off], c, n);
+    k->madd(&b[off], &src[off], c, n);
+  }
+  return a == b;
+}
+
+static double
+bench_madd(const gf_kernel *k, size_t symbol_size, double seconds)
+{
+  std::vector<uint8_t> src(symbol_size), dst(symbol_size);
+  fill_random(src);
+
+  uint64_t bytes = 0;
+  double start = now(), t;
+  unsigned c = 2;
+  do {
+    for (int i = 0; i < 1000; i++) {
+      k->madd(&dst[0], &src[0], c, symbol_size);
+      c = c == 255 ? 2 : c + 1;
+    }
+    bytes += 1000 * symbol_size;
+    t = now() - start;
+  } while (t < seconds);
+
+  return bytes * 8 / t / 1e9;
+}
+
+static double
+bench_encode(const gf_kernel *k, size_t num_symbols, size_t symbol_size,
+             double seconds)
+{
+  std::vector<uint8_t> data(num_symbols * symbol_size);
+  std::vector<uint8_t> coeffs(num_symbols * 64), out(symbol_size);
+  fill_random(data);
+  fill_random(coeffs);
+
+  rlnc_encoder enc(num_symbols, symbol_size, k);
+  enc.set_generation(&data[0]);
+  uint64_t bytes = 0;
+  double start = now(), t;
+  do {
+    for (int i = 0; i < 64; i++)
+      enc.encode(&coeffs[i * num_symbols], &out[0]);
+    bytes += 64 * symbol_size;
+    t = now() - start;
+  } while (t < seconds);
+
+  return bytes * 8 / t / 1e9;
+}
+
+/* Decode generations coded with random coefficients.  False if one
+ * comes out wrong. */
+static bool
+bench_decode(const gf_kernel *k, size_t num_symbols, size_t symbol_size,
+             double seconds, double& gbps, double& overhead)
+{
+  std::vector<uint8_t> data(num_symbols * symbol_size);
+  std::vector<uint8_t> coeffs(num_symbols), coded(symbol_size);
+  fill_random(data);
+
+  rlnc_encoder enc(num_symbols, symbol_size, k);
+  rlnc_decoder dec(num_symbols, symbol_size, k);
+  enc.set_generation(&data[0]);
+
+  // The coded symbols are made in advance, only decoding is timed.
+  std::vector<uint8_t> in_coeffs, in_coded;
+  for (size_t i = 0; dec.rank() < num_symbols; i++) {
+    fill_random(coeffs);
+    enc.encode(&coeffs[0], &coded[0]);
+    dec.add(&coeffs[0], &coded[0]);
+    in_coeffs.insert(in_coeffs.end(), coeffs.begin(), coeffs.end());
+    in_coded.insert(in_coded.end(), coded.begin(), coded.end());
+  }
+  for (size_t i = 0; i < num_symbols; i++) {
+    if (memcmp(dec.symbol(i), &data[i * symbol_size], symbol_size))
+      return false;
+  }
+  size_t received = in_coded.size() / symbol_size;
+  overhead = (double)received / num_symbols;
+
+  uint64_t bytes = 0;
+  double start = now(), t;
+  do {
+    dec.reset();
+    for (size_t i = 0; i < received; i++)
+      dec.add(&in_coeffs[i * num_symbols], &in_coded[i * symbol_size]);
+    bytes += num_symbols * symbol_size;
+    t = now() - start;
+  } while (t < seconds);
+  gbps = bytes * 8 / t / 1e9;
+
+  return true;
+}
+
+int
+main(int argc, char **argv)
+{
+  size_t num_symbols = 16, symbol_size = 1400;
+  double seconds = 1;
+  int c;
+
+  while ((c = getopt(argc, argv, "k:s:t:")) != -1) {
+    switch (c) {
+    case 'k': num_symbols = atoi(optarg); break;
+    case 's': symbol_size = atoi(optarg); break;
+    case 't': seconds = atof(optarg); break;
+    default:
+      return 1;
+    }
+  }
+  if (optind != argc || num_symbols == 0 || symbol_size == 0) {
+    fprintf(stderr, "usage: %s [-k symbols] [-s symbol_size] "
+            "[-t seconds]\n", argv[0]);
+    return 1;
+  }
+
+  printf("generation of %zu symbols of %zu bytes, Gbit/s per core\n",
+         num_symbols, symbol_size);
+  const std::vector<const gf_kernel*>& kernels = gf_kernels();
+  int status = 0;
+  for (size_t i = 0; i < kernels.size(); i++) {
+    const gf_kernel *k = kernels[i];
+    double decode, overhead;
+    if (!check(k, symbol_size)
+        || !bench_decode(k, num_symbols, symbol_size, seconds,
+                         decode, overhead)) {
+      printf("%-8s wrong results\n", k->name);
+      status = 1;
+      continue;
+    }
+    printf("%-8s madd %7.2f  encode %7.2f  decode %7.2f  "
+           "(%.3f symbols per source symbol)\n", k->name,
+           bench_madd(k, symbol_size, seconds),
+           bench_encode(k, num_symbols, symbol_size, seconds),
+           decode, overhead);
+  }
+
+  return status;
+}
@@ -0,0 +1,346 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Measure the rules sent to joining datapaths:
+ *
+ *   rule_bench [-k max_grid] [-g bloom_group] [-r repeats]
+ *
+ * The topologies are grids of k x k switches with a host on each,
+ * k doubling from 4 up to 'max_grid'.  In every mode the rules of
+ * every switch are built into a b_batch of its own, the way a join
+ * handler of the controller builds them:
+ *
+ *   mpls           path_compiler rules of two sessions per block of
+ *                  2 x 3 switches, laid out as the butterfly
+ *   nc             the same with a coding point per block
+ *   greedy         the greedy rule and the per-host entries of
+ *                  greedy_tables
+ *   bloom          a table per link
+ *   bloom_compact  'bloom_group' ports per table
+ *
+ * Each mode is run 'repeats' times and the fastest run is kept.  The
+ * results go to stdout as JSON, an object per mode and grid with the
+ * number of flow-mods, bytes per switch, the time of all the joins,
+ * and the time and the allocations per flow-mod.  Allocations are
+ * the malloc(), calloc() and realloc() calls, operator new included;
+ * building the batches is counted, filling the topology is not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sstream>
+#include <vector>
+#include "bloom_ids.hh"
+#include "join_rules.hh"
+#include "ofp_batch.hh"
+#include "path_compiler.hh"
+#include "topology.hh"
+
+using namespace vigil;
+
+/* Counting allocator in front of the one of glibc. */
+extern "C" {
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t num, size_t size);
+  void *__libc_realloc(void *p, size_t size);
+}
+
+static size_t num_allocs;
+
+extern "C" void*
+malloc(size_t size)
+{
+  num_allocs++;
+  return __libc_malloc(size);
+}
+
+extern "C" void*
+calloc(size_t num, size_t size)
+{
+  num_allocs++;
+  return __libc_calloc(num, size);
+}
+
+extern "C" void*
+realloc(void *p, size_t size)
+{
+  num_allocs++;
+  return __libc_realloc(p, size);
+}
+
+enum mode {
+  MPLS,
+  NC,
+  GREEDY,
+  BLOOM,
+  BLOOM_COMPACT,
+  NUM_MODES,
+};
+
+static const char *mode_names[NUM_MODES] = {
+  "mpls", "nc", "greedy", "bloom", "bloom_compact",
+};
+
+struct grid
+{
+  unsigned k;
+  adjacency links;
+  coord_map_t coords;
+  std::vector<uint32_t> switches;
+  std::string spec;             /* path spec of the sessions */
+  size_t num_sessions;
+};
+
+struct result
+{
+  size_t flow_mods;
+  size_t bytes;
+  size_t allocs;
+  double seconds;
+  size_t coding_points;
+};
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Switch (r, c) is 1 + r * k + c, its host k * k more, ports are
+ * numbered from 1 in the order of the links.  Link IDs are drawn as
+ * bloom_gen draws them. */
+static bool
+make_grid(unsigned k, grid& g)
+{
+  uint32_t n = k * k;
+  std::vector<topo_link> tl;
+
+  g.k = k;
+  g.switches.clear();
+  g.coords.clear();
+  for (uint32_t s = 1; s <= n; s++) {
+    uint32_t r = (s - 1) / k, c = (s - 1) % k;
+    uint32_t nbrs[5], num = 0;
+    if (c + 1 < k)
+      nbrs[num++] = s + 1;
+    if (c > 0)
+      nbrs[num++] = s - 1;
+    if (r + 1 < k)
+      nbrs[num++] = s + k;
+    if (r > 0)
+      nbrs[num++] = s - k;
+    nbrs[num++] = s + n;
+    for (uint32_t i = 0; i < num; i++) {
+      topo_link l = { s, nbrs[i], i + 1, 0, 0 };
+      tl.push_back(l);
+    }
+    g.switches.push_back(s);
+    g.coords[s] = coord_t(2 * c + 1, 2 * r + 1);
+    g.coords[s + n] = coord_t(2 * c + 2, 2 * r + 1);
+  }
+  for (uint32_t s = 1; s <= n; s++) {
+    topo_link l = { s + n, s, 1, 0, 0 };
+    tl.push_back(l);
+  }
+
+  if (!g.links.build(&tl[0], tl.size()))
+    return false;
+  bloom_id_sets ids(g.links, 1, bloom_id_sets::optimal_bits_per_id(2 * k));
+  ids.generate(k);
+  for (size_t i = 0; i < tl.size(); i++)
+    tl[i].addr = ids.id(0, i);
+  if (!g.links.build(&tl[0], tl.size()))
+    return false;
+
+  // A butterfly (see butterfly_paths.txt) in every block of 2 x 3
+  // switches: the sessions start at s1 and s2, and both reach r1 and
+  // r2, one of them through the coding point c - d.
+  //
+  //   s1 - c  - s2
+  //   |    |    |
+  //   r1 - d  - r2
+  std::ostringstream spec;
+  g.num_sessions = 0;
+  for (uint32_t r = 0; r + 1 < k; r += 2) {
+    for (uint32_t c = 0; c + 2 < k; c += 3) {
+      uint32_t s1 = 1 + r * k + c, s2 = s1 + 2, enc = s1 + 1;
+      uint32_t r1 = s1 + k, r2 = s2 + k, dec = enc + k;
+      uint32_t l = 7 * g.num_sessions / 2 + 1;
+      spec << "session " << l
+           << " h" << s1 + n << "-s" << s1 << "-s" << r1 << "-h" << r1 + n
+           << " h" << s1 + n << "-s" << s1 << "-s" << enc << "-s" << dec
+           << "-s" << r2 << "-h" << r2 + n << "\n";
+      spec << "session " << l + 1
+           << " h" << s2 + n << "-s" << s2 << "-s" << r2 << "-h" << r2 + n
+           << " h" << s2 + n << "-s" << s2 << "-s" << enc << "-s" << dec
+           << "-s" << r1 << "-h" << r1 + n << "\n";
+      spec << "return h" << r1 + n << "-s" << r1 << "-s" << s1
+           << "-h" << s1 + n << "\n";
+      spec << "return h" << r2 + n << "-s" << r2 << "-s" << s2
+           << "-h" << s2 + n << "\n";
+      spec << "code s" << enc;
+      for (uint32_t j = 0; j < 7; j++)
+        spec << " " << l + j;
+      spec << "\n";
+      g.num_sessions += 2;
+    }
+  }
+  g.spec = spec.str();
+
+  return true;
+}
+
+/* What path_join_handler() sends. */
+static void
+path_rules(const path_compiler& paths, uint32_t node, b_batch *b)
+{
+  const path_compiler::rule_list_t *l = paths.rules(node);
+  if (l == NULL)
+    return;
+  for (size_t i = 0; i < l->size(); i++)
+    b->add((*l)[i]->build());
+}
+
+static bool
+run(const grid& g, enum mode m, unsigned bloom_group, unsigned repeats,
+    result& res)
+{
+  path_compiler paths(g.links);
+  join_rules rules(g.links, g.coords);
+
+  res.coding_points = 0;
+  if (m == MPLS || m == NC) {
+    std::istringstream spec(g.spec);
+    if (!paths.load(spec, "grid") || !paths.compile(m == NC))
+      return false;
+    if (m == NC)
+      res.coding_points = g.num_sessions / 2;
+  }
+  if (m == GREEDY)
+    rules.set_greedy_tables();
+  if (m == BLOOM_COMPACT)
+    rules.set_bloom_group(bloom_group);
+
+  std::vector<b_batch*> batches(g.switches.size());
+  res.seconds = 0;
+  for (unsigned r = 0; r < repeats; r++) {
+    for (size_t i = 0; i < batches.size(); i++)
+      batches[i] = new b_batch();
+
+    size_t allocs = num_allocs;
+    double start = now();
+    for (size_t i = 0; i < g.switches.size(); i++) {
+      uint32_t node = g.switches[i];
+      switch (m) {
+      case MPLS:
+      case NC:
+        path_rules(paths, node, batches[i]);
+        break;
+      case GREEDY:
+        rules.greedy(node, NULL, batches[i]);
+        break;
+      case BLOOM:
+      case BLOOM_COMPACT:
+        rules.bloom(node, NULL, batches[i]);
+        break;
+      default:
+        break;
+      }
+    }
+    double t = now() - start;
+    res.allocs = num_allocs - allocs;
+    if (r == 0 || t < res.seconds)
+      res.seconds = t;
+
+    res.flow_mods = 0;
+    res.bytes = 0;
+    for (size_t i = 0; i < batches.size(); i++) {
+      res.flow_mods += batches[i]->num_msgs();
+      res.bytes += batches[i]->size();
+      delete batches[i];
+    }
+  }
+
+  return true;
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned max_grid = 16, bloom_group = 4, repeats = 5;
+  int c;
+
+  while ((c = getopt(argc, argv, "k:g:r:")) != -1) {
+    switch (c) {
+    case 'k': max_grid = atoi(optarg); break;
+    case 'g': bloom_group = atoi(optarg); break;
+    case 'r': repeats = atoi(optarg); break;
+    default: optind = argc + 1; break;
+    }
+  }
+  if (optind != argc || max_grid < 4 || bloom_group < 1 || bloom_group > 8
+      || repeats < 1) {
+    fprintf(stderr, "usage: %s [-k max_grid (>= 4)] "
+            "[-g bloom_group (1-8)] [-r repeats]\n", argv[0]);
+    return 1;
+  }
+
+  printf("{\n  \"bloom_group\": %u,\n  \"repeats\": %u,\n"
+         "  \"results\": [", bloom_group, repeats);
+  const char *sep = "\n";
+  for (unsigned k = 4; k <= max_grid; k *= 2) {
+    grid g;
+    if (!make_grid(k, g)) {
+      fprintf(stderr, "cannot build a grid of %u\n", k);
+      return 1;
+    }
+    for (int m = 0; m < NUM_MODES; m++) {
+      result res;
+      if (!run(g, (enum mode)m, bloom_group, repeats, res)) {
+        fprintf(stderr, "%s: cannot compile the sessions of a grid "
+                "of %u\n", mode_names[m], k);
+        return 1;
+      }
+      size_t n = res.flow_mods ? res.flow_mods : 1;
+      printf("%s    { \"mode\": \"%s\", \"grid\": %u, \"switches\": %zu, "
+             "\"links\": %zu,\n      \"sessions\": %zu, "
+             "\"coding_points\": %zu, \"flow_mods\": %zu, "
+             "\"bytes\": %zu,\n      \"bytes_per_switch\": %.1f, "
+             "\"join_ns\": %.0f, \"ns_per_flow_mod\": %.1f,\n"
+             "      \"allocs_per_flow_mod\": %.2f }",
+             sep, mode_names[m], k, g.switches.size(),
+             g.links.num_links(),
+             m == MPLS || m == NC ? g.num_sessions : 0, res.coding_points,
+             res.flow_mods, res.bytes,
+             (double)res.bytes / g.switches.size(), res.seconds * 1e9,
+             res.seconds * 1e9 / n, (double)res.allocs / n);
+      sep = ",\n";
+      fflush(stdout);
+    }
+  }
+  printf("\n  ]\n}\n");
+
+  return 0;
+}
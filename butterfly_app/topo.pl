@@ -211,6 +211,53 @@ sub add_node {
   $nodes{$name}[2] = $group;
 }
 
+# Snapshot of the port counters written by butterfly_app started
+# with port_stats=/tmp/butterfly_ports (see port_stats.hh).
+my $PORT_STATS = '/tmp/butterfly_ports';
+# A snapshot older than three updates (in seconds) is ignored, the
+# controller has stopped writing it.
+my $PORT_STATS_MAX_AGE = 3 * 2;
+
+# Fill %$db as get_stats does from the output of dpctl.  False if
+# there is no usable snapshot, or it is too old.
+sub read_port_stats {
+  my ($db) = @_;
+  my $hdr_len = 24;
+  my $rec_len = 88;
+
+  open my $fh, '<', $PORT_STATS
+    or return 0;
+  binmode $fh;
+  my $buf = do { local $/; <$fh> };
+  close $fh;
+  return 0
+    unless defined $buf && length($buf) >= $hdr_len;
+
+  my ($magic, $version, $num, $written) = unpack 'a8 L L Q', $buf;
+  return 0
+    unless $magic eq 'BFLYPORT' && $version == 1
+      && length($buf) == $hdr_len + $num * $rec_len;
+  return 0
+    if time() - $written / 1000 > $PORT_STATS_MAX_AGE;
+
+  for my $i (0 .. $num - 1) {
+    my ($dpid, $port_no, $pad, $time, $rx, $tx)
+      = unpack 'Q L L Q Q Q', substr($buf, $hdr_len + $i * $rec_len);
+    next unless $port_no >= 1 && $port_no < 0xffffff00;
+    my $node = "s$dpid";
+    my $p = $port_no - 1;
+    $db->{$node} = {}
+      unless defined $db->{$node};
+    $db->{$node}->{$p} = $tx;
+    next unless defined $ports{$node};
+    my $neighbor = $ports{$node}[$p];
+    $db->{$node}->{$p} += $rx
+      if defined $neighbor && $neighbor =~ m/^h/;
+  }
+
+  return 1;
+}
+
 sub get_stats {
   my @sw = glob '/tmp/s[0-9]*';
   my %db;
@@ -221,6 +268,10 @@ sub get_stats {
   my @list = grep {/tmp\/(s[0-9]+)$/} @sw;
   @list = keys %ip_addr
     if $REMOTE;
+  # No need to fork dpctl for every switch if the controller keeps
+  # the counters.
+  @list = ()
+    if read_port_stats(\%db);
 
   for my $item (@list) {
     my $node;
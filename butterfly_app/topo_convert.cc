@@ -0,0 +1,63 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+/* Convert the CSV links file (and optionally the coordinates file) of
+ * a topology into the binary format butterfly_app maps at startup:
+ *
+ *   topo_convert bloom_ids.csv [greedy_coords.csv] topology.bin
+ *
+ * The result can be given to both links= and coords=.
+ */
+
+#include <stdio.h>
+#include "topology.hh"
+
+using namespace vigil;
+
+int
+main(int argc, char **argv)
+{
+  if (argc != 3 && argc != 4) {
+    fprintf(stderr, "usage: %s links.csv [coords.csv] topology.bin\n",
+            argv[0]);
+    return 1;
+  }
+
+  topo_file t;
+  if (!t.load_links(argv[1])) {
+    fprintf(stderr, "%s\n", t.error().c_str());
+    return 1;
+  }
+  if (argc == 4 && !t.load_coords(argv[2])) {
+    fprintf(stderr, "%s\n", t.error().c_str());
+    return 1;
+  }
+
+  const char *out = argv[argc - 1];
+  if (!t.save(out)) {
+    perror(out);
+    return 1;
+  }
+  printf("%s: %zu links, %zu coordinates\n",
+         out, t.num_links(), t.num_coords());
+
+  return 0;
+}
@@ -0,0 +1,411 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "topology.hh"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vigil
+{
+  static const char topo_magic[8] = { 'B','F','L','Y','T','O','P','O' };
+
+  static bool
+  link_before(const topo_link& a, const topo_link& b)
+  {
+    return a.from < b.from;
+  }
+
+  topo_file::topo_file()
+    : map(0), map_len(0), link_p(0), n_links(0), coord_p(0), n_coords(0)
+  {
+  }
+
+  topo_file::~topo_file()
+  {
+    unmap();
+  }
+
+  void
+  topo_file::unmap()
+  {
+    if (map)
+      munmap(map, map_len);
+    map = 0;
+    map_len = 0;
+    link_p = 0;
+    n_links = 0;
+    coord_p = 0;
+    n_coords = 0;
+  }
+
+  bool
+  topo_file::is_binary(const char *filename)
+  {
+    char magic[sizeof topo_magic];
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+      return false;
+    bool binary = fread(magic, 1, sizeof magic, f) == sizeof magic
+      && memcmp(magic, topo_magic, sizeof magic) == 0;
+    fclose(f);
+
+    return binary;
+  }
+
+  bool
+  topo_file::load_binary(const char *filename)
+  {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      err = std::string("cannot open ") + filename + ": " + strerror(errno);
+      if (fd >= 0)
+        close(fd);
+      return false;
+    }
+
+    unmap();
+    map_len = st.st_size;
+    if (map_len >= sizeof(topo_file_header))
+      map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED || map == NULL) {
+      map = 0;
+      err = std::string("cannot map ") + filename;
+      unmap();
+      return false;
+    }
+
+    const topo_file_header *h = (const topo_file_header*)map;
+    size_t links_len  = (size_t)h->num_links * sizeof(topo_link);
+    size_t coords_len = (size_t)h->num_coords * sizeof(topo_coord);
+    if (h->version != topo_file_version) {
+      err = std::string(filename) + ": unknown version or byte order";
+      unmap();
+      return false;
+    }
+    if (map_len != sizeof(topo_file_header) + links_len + coords_len) {
+      err = std::string(filename) + ": truncated";
+      unmap();
+      return false;
+    }
+
+    const uint8_t *p = (const uint8_t*)map + sizeof(topo_file_header);
+    link_p   = (const topo_link*)p;
+    n_links  = h->num_links;
+    coord_p  = (const topo_coord*)(p + links_len);
+    n_coords = h->num_coords;
+    madvise(map, map_len, MADV_WILLNEED);
+
+    return true;
+  }
+
+  /* Parse the lines of 'filename' into 'num_fields' numbers each,
+   * the 'hex_field'th of them in hexadecimal. */
+  bool
+  topo_file::parse_csv(const char *filename, size_t num_fields,
+                       int hex_field, std::vector<uint64_t>& fields)
+  {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+      err = std::string("cannot open ") + filename + ": " + strerror(errno);
+      return false;
+    }
+
+    char line[LINE_MAX];
+    int line_no = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof line, f)) {
+      line_no++;
+      char *p = line + strspn(line, " \t\r\n");
+      if (*p == '\0' || *p == '#')
+        continue;
+
+      for (size_t i = 0; ok && i < num_fields; i++) {
+        int base = (int)i == hex_field ? 16 : 10;
+        char *end;
+        p += strspn(p, " \t");
+        errno = 0;
+        uint64_t v = strtoull(p, &end, base);
+        ok = end != p && *p != '-' && errno == 0
+          && (base == 16 || v <= UINT32_MAX);
+        end += strspn(end, " \t\r\n");
+        ok = ok && (i + 1 < num_fields ? *end == ',' : *end == '\0');
+        fields.push_back(v);
+        p = end + 1;
+      }
+      if (!ok) {
+        char buf[32];
+        snprintf(buf, sizeof buf, ":%d", line_no);
+        err = std::string(filename) + buf + ": malformed line";
+      }
+    }
+    fclose(f);
+
+    return ok;
+  }
+
+  bool
+  topo_file::load_links(const char *filename)
+  {
+    if (is_binary(filename))
+      return load_binary(filename);
+
+    std::vector<uint64_t> fields;
+    if (!parse_csv(filename, 4, 3, fields))
+      return false;
+
+    link_buf.resize(fields.size() / 4);
+    for (size_t i = 0; i < link_buf.size(); i++) {
+      topo_link& l = link_buf[i];
+      l.from    = fields[4 * i];
+      l.to      = fields[4 * i + 1];
+      l.port_no = fields[4 * i + 2];
+      l.pad     = 0;
+      l.addr    = fields[4 * i + 3];
+      if (l.from == 0 || l.to == 0) {
+        err = std::string(filename) + ": node id 0";
+        link_buf.clear();
+        return false;
+      }
+    }
+    std::stable_sort(link_buf.begin(), link_buf.end(), link_before);
+    link_p  = link_buf.empty() ? NULL : &link_buf[0];
+    n_links = link_buf.size();
+
+    return true;
+  }
+
+  bool
+  topo_file::load_coords(const char *filename)
+  {
+    if (is_binary(filename))
+      return load_binary(filename);
+
+    std::vector<uint64_t> fields;
+    if (!parse_csv(filename, 3, -1, fields))
+      return false;
+
+    coord_buf.resize(fields.size() / 3);
+    for (size_t i = 0; i < coord_buf.size(); i++) {
+      coord_buf[i].node = fields[3 * i];
+      coord_buf[i].x    = fields[3 * i + 1];
+      coord_buf[i].y    = fields[3 * i + 2];
+    }
+    coord_p  = coord_buf.empty() ? NULL : &coord_buf[0];
+    n_coords = coord_buf.size();
+
+    return true;
+  }
+
+  bool
+  topo_file::save(const char *filename) const
+  {
+    topo_file_header h;
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, topo_magic, sizeof h.magic);
+    h.version    = topo_file_version;
+    h.num_links  = n_links;
+    h.num_coords = n_coords;
+
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL)
+      return false;
+    bool ok = fwrite(&h, sizeof h, 1, f) == 1
+      && fwrite(link_p, sizeof(topo_link), n_links, f) == n_links
+      && fwrite(coord_p, sizeof(topo_coord), n_coords, f) == n_coords;
+
+    return fclose(f) == 0 && ok;
+  }
+
+  void
+  topo_file::fill(coord_map_t& coords) const
+  {
+    coords.rehash(n_coords + 1);
+    for (size_t i = 0; i < n_coords; i++) {
+      const topo_coord& c = coord_p[i];
+      coords[c.node] = std::make_tuple(c.x, c.y);
+    }
+  }
+
+  const uint32_t adjacency::max_node_id;
+  const uint32_t adjacency::no_link;
+
+  bool
+  adjacency::build(const topo_link *links, size_t num_links)
+  {
+    uint32_t max_id = 0;
+    for (size_t i = 0; i < num_links; i++)
+      max_id = std::max(max_id, std::max(links[i].from, links[i].to));
+    if (max_id > max_node_id)
+      return false;
+
+    // Counting sort by 'from', stable so the links of a node keep
+    // their order.
+    offsets.assign(max_id + 2, 0);
+    for (size_t i = 0; i < num_links; i++)
+      offsets[links[i].from + 1]++;
+    for (size_t n = 1; n < offsets.size(); n++)
+      offsets[n] += offsets[n - 1];
+
+    std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+    src.resize(num_links);
+    nbr.resize(num_links);
+    ports.resize(num_links);
+    addrs.resize(num_links);
+    for (size_t i = 0; i < num_links; i++) {
+      uint32_t j = next[links[i].from]++;
+      src[j]   = links[i].from;
+      nbr[j]   = links[i].to;
+      ports[j] = links[i].port_no;
+      addrs[j] = links[i].addr;
+    }
+
+    rev.assign(num_links, no_link);
+    for (uint32_t i = 0; i < num_links; i++) {
+      for (uint32_t j = begin(nbr[i]); j < end(nbr[i]); j++) {
+        if (nbr[j] == src[i]) {
+          rev[i] = j;
+          break;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  int
+  adjacency::port_to(uint32_t from, uint32_t to) const
+  {
+    uint32_t i = link_to(from, to);
+    return i == no_link ? -1 : ports[i];
+  }
+
+  uint32_t
+  adjacency::link_to(uint32_t from, uint32_t to) const
+  {
+    for (uint32_t i = begin(from); i < end(from); i++) {
+      if (nbr[i] == to)
+        return i;
+    }
+    return no_link;
+  }
+
+  bool
+  parse_node(const std::string& s, uint32_t& id)
+  {
+    size_t i = s.find_first_of("0123456789");
+    if (i == std::string::npos)
+      return false;
+    char *end;
+    id = strtoul(s.c_str() + i, &end, 10);
+    return *end == '\0' && id != 0;
+  }
+
+  bool
+  parse_path(const std::string& s, std::vector<uint32_t>& p)
+  {
+    std::istringstream in(s);
+    std::string node;
+    uint32_t id;
+
+    p.clear();
+    while (std::getline(in, node, '-')) {
+      if (!parse_node(node, id))
+        return false;
+      p.push_back(id);
+    }
+    return p.size() >= 3;
+  }
+
+  static bool
+  parse_spec_line(std::istream& in, path_spec_line& l)
+  {
+    std::string word;
+    std::vector<uint32_t> p;
+
+    if (l.keyword == "session") {
+      // Every path of a session starts at the same host and enters
+      // the network at the same switch.
+      if (!(in >> l.label) || l.label == 0)
+        return false;
+      while (in >> word) {
+        if (!parse_path(word, p) || p.size() < 4
+            || !(l.paths.empty()
+                 || (p[0] == l.paths[0][0] && p[1] == l.paths[0][1])))
+          return false;
+        l.paths.push_back(p);
+      }
+      return !l.paths.empty();
+    } else if (l.keyword == "return") {
+      if (!(in >> word) || !parse_path(word, p))
+        return false;
+      l.paths.push_back(p);
+    } else if (l.keyword == "code") {
+      path_spec_coding& c = l.coding;
+      return (in >> word >> c.a >> c.b >> c.coded >> c.plain_a
+              >> c.plain_b >> c.decoded_a >> c.decoded_b)
+        && parse_node(word, c.encoder);
+    }
+    return true;
+  }
+
+  bool
+  read_path_spec(std::istream& stream, const char *filename,
+                 const path_spec_handler& h, std::string& err)
+  {
+    std::string line;
+    int line_no = 0;
+
+    err.clear();
+    while (std::getline(stream, line)) {
+      line_no++;
+      std::istringstream in(line.substr(0, line.find('#')));
+      path_spec_line l;
+      std::string why;
+
+      if (!(in >> l.keyword))
+        continue;
+      l.label = 0;
+      if (parse_spec_line(in, l) && h(l, in, why))
+        continue;
+
+      if (err.empty()) {
+        std::ostringstream msg;
+        msg << filename << ":" << line_no << ": cannot use '" << line << "'";
+        if (!why.empty())
+          msg << ", " << why;
+        err = msg.str();
+      }
+    }
+
+    return err.empty();
+  }
+} // vigil namespace
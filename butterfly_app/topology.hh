@@ -0,0 +1,217 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef topology_HH
+#define topology_HH
+
+#include <istream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <boost/function.hpp>
+
+namespace vigil
+{
+  typedef std::tuple<uint32_t, uint32_t> coord_t;
+  typedef std::unordered_map<uint32_t, coord_t> coord_map_t;
+
+  /* Records of the binary topology file.  The file is a
+   * topo_file_header, num_links topo_link records sorted by 'from',
+   * then num_coords topo_coord records, all in host byte order. */
+  struct topo_file_header
+  {
+    char magic[8];              /* "BFLYTOPO" */
+    uint32_t version;           /* topo_file_version */
+    uint32_t num_links;
+    uint32_t num_coords;
+    uint32_t pad;
+  };
+
+  struct topo_link
+  {
+    uint32_t from;
+    uint32_t to;
+    uint32_t port_no;
+    uint32_t pad;
+    uint64_t addr;              /* Bloom ID */
+  };
+
+  struct topo_coord
+  {
+    uint32_t node;
+    uint32_t x;
+    uint32_t y;
+  };
+
+  const uint32_t topo_file_version = 1;
+
+  /** \brief Links and coordinates of a topology.
+   *
+   * A binary file (see topo_convert) is mapped into memory and used
+   * in place.  A CSV file is parsed line by line, and rejected as a
+   * whole if any of its lines is malformed.  The CSV layouts are
+   *
+   *   from_id, to_id, port_no, addr_in_hex     (links)
+   *   node_id, x_coordinate, y_coordinate      (coordinates)
+   *
+   * Empty lines and lines starting with '#' are skipped.  A binary
+   * file holds both the links and the coordinates, a CSV file only
+   * replaces one of them.  Errors are returned by error() instead of
+   * being logged.
+   */
+  class topo_file
+  {
+  public:
+    topo_file();
+    ~topo_file();
+
+    /* Binary files are recognized by their magic. */
+    bool load_links(const char *filename);
+    bool load_coords(const char *filename);
+    bool save(const char *filename) const;
+
+    const topo_link* links() const { return link_p; }
+    size_t num_links() const { return n_links; }
+    const topo_coord* coords() const { return coord_p; }
+    size_t num_coords() const { return n_coords; }
+    const std::string& error() const { return err; }
+
+    void fill(coord_map_t& coords) const;
+
+  private:
+    void *map;
+    size_t map_len;
+    const topo_link *link_p;
+    size_t n_links;
+    const topo_coord *coord_p;
+    size_t n_coords;
+    std::vector<topo_link> link_buf;
+    std::vector<topo_coord> coord_buf;
+    std::string err;
+
+    bool is_binary(const char *filename);
+    bool load_binary(const char *filename);
+    bool parse_csv(const char *filename, size_t num_fields, int hex_field,
+                   std::vector<uint64_t>& fields);
+    void unmap();
+
+    topo_file(const topo_file&);
+    topo_file& operator=(const topo_file&);
+  };
+
+  /** \brief Immutable adjacency of a topology in compressed sparse
+   * row form.
+   *
+   * The links leaving node n are the indices [begin(n), end(n)) of
+   * the parallel arrays behind neighbor(), port_no() and addr(), in
+   * the order of the input.  Node ids are used as indices directly,
+   * so they must be dense enough (at most max_node_id).  Everything
+   * is read-only after build(), several threads may walk it at once.
+   */
+  class adjacency
+  {
+  public:
+    static const uint32_t max_node_id = 1 << 24;
+    static const uint32_t no_link = 0xffffffff;
+
+    adjacency() {}
+
+    /* Replace the adjacency with 'links'.  False if a node id is
+     * larger than max_node_id. */
+    bool build(const topo_link *links, size_t num_links);
+
+    size_t num_links() const { return nbr.size(); }
+    uint32_t max_node() const
+    { return offsets.empty() ? 0 : offsets.size() - 2; }
+    uint32_t begin(uint32_t node) const
+    { return node + 1 < offsets.size() ? offsets[node] : 0; }
+    uint32_t end(uint32_t node) const
+    { return node + 1 < offsets.size() ? offsets[node + 1] : 0; }
+    uint32_t degree(uint32_t node) const
+    { return end(node) - begin(node); }
+
+    uint32_t source(uint32_t i) const { return src[i]; }
+    uint32_t neighbor(uint32_t i) const { return nbr[i]; }
+    uint32_t port_no(uint32_t i) const { return ports[i]; }
+    uint64_t addr(uint32_t i) const { return addrs[i]; }
+    /* IDs of all links: those of node n start at begin(n). */
+    const uint64_t* addr_data() const
+    { return addrs.empty() ? 0 : &addrs[0]; }
+    /* Index of the link in the opposite direction, or no_link. */
+    uint32_t reverse(uint32_t i) const { return rev[i]; }
+
+    /* Port of 'from' towards 'to', or -1 if they are not neighbors. */
+    int port_to(uint32_t from, uint32_t to) const;
+    /* Link from 'from' to 'to', or no_link. */
+    uint32_t link_to(uint32_t from, uint32_t to) const;
+
+  private:
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> src;
+    std::vector<uint32_t> nbr;
+    std::vector<uint32_t> ports;
+    std::vector<uint64_t> addrs;
+    std::vector<uint32_t> rev;
+  };
+
+  /* Nodes of a path spec (see path_compiler) are written as "h1",
+   * "s5" or "5", a path as at least three nodes joined by '-'. */
+  bool parse_node(const std::string& s, uint32_t& id);
+  bool parse_path(const std::string& s, std::vector<uint32_t>& p);
+
+  /* A line of a path spec as read_path_spec() hands it over.  The
+   * fields of its keyword are filled: 'session' sets 'label' and
+   * 'paths', 'return' the single path in 'paths', 'code' 'coding'. */
+  struct path_spec_coding
+  {
+    uint32_t encoder;
+    uint32_t a, b, coded;
+    uint32_t plain_a, plain_b;
+    uint32_t decoded_a, decoded_b;
+  };
+
+  struct path_spec_line
+  {
+    std::string keyword;
+    uint32_t label;
+    std::vector<std::vector<uint32_t> > paths;
+    path_spec_coding coding;
+  };
+
+  /* Called for each line, with the words after the keyword in 'rest'
+   * if the keyword is not one of the above.  False rejects the line,
+   * 'why' may tell the reason. */
+  typedef boost::function<bool(const path_spec_line& l, std::istream& rest,
+                               std::string& why)> path_spec_handler;
+
+  /* Read the path spec 'stream' (see path_compiler) and pass its
+   * lines to 'h'.  Comments and empty lines are skipped.  The syntax
+   * of sessions, return paths and coding points is checked here.
+   * Every line is read even after an error; the first one is put in
+   * 'err' and false returned.  'filename' only names the stream in
+   * the error. */
+  bool read_path_spec(std::istream& stream, const char *filename,
+                      const path_spec_handler& h, std::string& err);
+} // vigil namespace
+
+#endif
@@ -0,0 +1,98 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#include "worker_pool.hh"
+#include "vlog.hh"
+
+namespace vigil
+{
+  static Vlog_module lg("butterfly_app");
+
+  worker_pool::worker_pool(unsigned num_threads)
+    : stopping(false)
+  {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+
+    for (unsigned i = 0; i < num_threads; i++) {
+      pthread_t t;
+      int error = pthread_create(&t, NULL, run, this);
+      if (error) {
+        lg.err("cannot start worker thread (%d), %zu running",
+               error, threads.size());
+        break;
+      }
+      threads.push_back(t);
+    }
+  }
+
+  void
+  worker_pool::submit(const job &j)
+  {
+    if (threads.empty()) {
+      j();
+      return;
+    }
+
+    pthread_mutex_lock(&mutex);
+    jobs.push_back(j);
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  void*
+  worker_pool::run(void *p)
+  {
+    worker_pool *pool = (worker_pool*)p;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+      while (pool->jobs.empty() && !pool->stopping)
+        pthread_cond_wait(&pool->cond, &pool->mutex);
+      if (pool->jobs.empty())
+        break;
+
+      job j = pool->jobs.front();
+      pool->jobs.pop_front();
+      pthread_mutex_unlock(&pool->mutex);
+      j();
+      pthread_mutex_lock(&pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+  }
+
+  /* Queued jobs are finished before the threads exit. */
+  worker_pool::~worker_pool()
+  {
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+
+    for (size_t i = 0; i < threads.size(); i++)
+      pthread_join(threads[i], NULL);
+
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+  }
+} // vigil namespace
@@ -0,0 +1,117 @@
+/* Copyright 2012 (C) Budapest University of Technology and Economics
+ *
+ * This file is NOT part of NOX.
+ *
+ * Butterfly_app is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Author: Felicián Németh <nemethf@tmit.bme.hu>
+ */
+
+#ifndef worker_pool_HH
+#define worker_pool_HH
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include <boost/function.hpp>
+
+namespace vigil
+{
+  /** \brief Fixed set of threads running queued jobs in FIFO order.
+   *
+   * Jobs must not touch NOX: they run outside of the event loop.  A
+   * pool of zero threads runs every job inside submit().
+   */
+  class worker_pool
+  {
+  public:
+    typedef boost::function<void()> job;
+
+    worker_pool(unsigned num_threads);
+    ~worker_pool();
+
+    void submit(const job &j);
+    unsigned size() const { return threads.size(); }
+
+  private:
+    std::vector<pthread_t> threads;
+    std::deque<job> jobs;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool stopping;
+
+    static void* run(void *pool);
+
+    worker_pool(const worker_pool&);
+    worker_pool& operator=(const worker_pool&);
+  };
+
+  /* Helpers of parallel_for(). */
+  template <typename F>
+  struct par_state
+  {
+    F *f;
+    size_t n;
+    size_t next;
+  };
+
+  template <typename F>
+  struct par_thread
+  {
+    par_state<F> *st;
+    unsigned id;
+    bool started;
+    pthread_t tid;
+  };
+
+  template <typename F>
+  void*
+  par_main(void *arg)
+  {
+    par_thread<F> *t = (par_thread<F>*)arg;
+    size_t i;
+    while ((i = __sync_fetch_and_add(&t->st->next, 1)) < t->st->n)
+      (*t->st->f)(t->id, i);
+    return NULL;
+  }
+
+  /* Runs f(thread, i) for every i < n on at most 'num_threads'
+   * threads, the calling one included, and returns when all are
+   * done.  Items are handed out one by one.  Unlike worker_pool it
+   * does not log. */
+  template <typename F>
+  void
+  parallel_for(unsigned num_threads, size_t n, F& f)
+  {
+    par_state<F> st = { &f, n, 0 };
+    num_threads = std::max<size_t>(std::min<size_t>(num_threads, n), 1);
+    std::vector<par_thread<F> > threads(num_threads);
+    for (unsigned i = 0; i < num_threads; i++) {
+      threads[i].st = &st;
+      threads[i].id = i;
+      // A thread that cannot be started leaves its share to the others.
+      threads[i].started = i > 0 &&
+        pthread_create(&threads[i].tid, NULL, par_main<F>, &threads[i]) == 0;
+    }
+    par_main<F>(&threads[0]);
+    for (unsigned i = 1; i < num_threads; i++) {
+      if (threads[i].started)
+        pthread_join(threads[i].tid, NULL);
+    }
+  }
+} // vigil namespace
+
+#endif